@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <random>
+#include <sstream>
+
+#include "caffe2/core/net.h"
+#include "caffe2/core/operator.h"
+#include "caffe2/proto/caffe2.pb.h"
+#include "caffe2/utils/proto_utils.h"
+#include "caffe2/binaries/gflags_namespace.h"
+#include "glog/logging.h"
+
+DEFINE_string(init_net, "",
+              "The given path to the net that initializes the parameters.");
+DEFINE_string(net, "", "The given path to the net to benchmark.");
+DEFINE_string(input, "",
+              "Comma-separated names of the input blobs of the net, which are "
+              "filled with random floats.");
+DEFINE_string(input_dims, "",
+              "Semicolon-separated dimensions of the inputs, with the "
+              "dimensions of each input separated by commas, e.g. "
+              "\"32,3,227,227;32\". The first dimension of the first input is "
+              "taken as the batch size.");
+DEFINE_int32(warmup, 10, "The number of iterations to run before timing.");
+DEFINE_int32(iter, 100, "The number of timed iterations.");
+DEFINE_bool(per_op, false,
+            "If set, also reports the time spent in each operator. This runs "
+            "the net through the \"profile\" net type, which adds a little "
+            "overhead to every operator.");
+DEFINE_int32(optimization_level, -1,
+             "If not negative, overrides the optimization_level of the net. "
+             "Level 2 fuses Conv/FC + Relu (+ MaxPool) chains.");
+DEFINE_string(profile_output, "",
+              "If set together with --per_op, the per-operator statistics are "
+              "also written to this file, as CSV if it ends with \".csv\".");
+DEFINE_int32(parallel_net_threads, 0,
+             "If positive, the number of threads of the executor that the "
+             "parallel nets share. Defaults to the hardware concurrency.");
+
+namespace caffe2 {
+namespace {
+
+vector<string> Split(const string& str, char delimiter) {
+  vector<string> pieces;
+  std::stringstream stream(str);
+  string piece;
+  while (std::getline(stream, piece, delimiter)) {
+    pieces.push_back(piece);
+  }
+  return pieces;
+}
+
+void FillInputs(Workspace* workspace) {
+  vector<string> names = Split(FLAGS_input, ',');
+  vector<string> all_dims = Split(FLAGS_input_dims, ';');
+  CHECK_EQ(names.size(), all_dims.size())
+      << "--input and --input_dims should have the same number of entries.";
+  std::mt19937 random_generator(1701);
+  std::uniform_real_distribution<float> distribution(-1, 1);
+  for (int i = 0; i < names.size(); ++i) {
+    vector<int> dims;
+    for (const string& dim : Split(all_dims[i], ',')) {
+      dims.push_back(std::stoi(dim));
+    }
+    auto* tensor = workspace->CreateBlob(names[i])->
+        GetMutable<Tensor<float, CPUContext> >();
+    tensor->Reshape(dims);
+    float* data = tensor->mutable_data();
+    for (int j = 0; j < tensor->size(); ++j) {
+      data[j] = distribution(random_generator);
+    }
+    LOG(INFO) << "Filled input " << names[i] << " with " << tensor->size()
+              << " random values.";
+  }
+}
+
+float Percentile(const vector<float>& sorted_values, float percentile) {
+  const int last = sorted_values.size() - 1;
+  return sorted_values[static_cast<int>(last * percentile + 0.5)];
+}
+
+void ReportPerOperatorTime(const NetProfile& profile) {
+  vector<const OperatorProfile*> op_profiles;
+  float total_ms = 0;
+  for (const OperatorProfile& op_profile : profile.op()) {
+    op_profiles.push_back(&op_profile);
+    total_ms += op_profile.total_ms();
+  }
+  std::sort(op_profiles.begin(), op_profiles.end(),
+            [](const OperatorProfile* a, const OperatorProfile* b) {
+              return a->total_ms() > b->total_ms();
+            });
+  LOG(INFO) << "Per-operator time of the timed iterations, slowest first:";
+  for (const OperatorProfile* op_profile : op_profiles) {
+    LOG(INFO) << "  " << op_profile->name() << " (" << op_profile->type()
+              << "): mean " << op_profile->mean_ms() << " ms, p50 "
+              << op_profile->p50_ms() << " ms, p99 " << op_profile->p99_ms()
+              << " ms, " << 100 * op_profile->total_ms() / total_ms
+              << "% of operator time.";
+  }
+}
+
+}  // namespace
+}  // namespace caffe2
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::SetUsageMessage("Benchmarks a given net.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK_GT(FLAGS_iter, 0) << "Need at least one timed iteration.";
+  if (FLAGS_parallel_net_threads > 0) {
+    caffe2::SetParallelNetThreads(FLAGS_parallel_net_threads);
+  }
+  std::unique_ptr<caffe2::Workspace> workspace(new caffe2::Workspace());
+  if (FLAGS_init_net.size()) {
+    LOG(INFO) << "Running init net: " << FLAGS_init_net;
+    caffe2::NetDef init_net_def;
+    CHECK(ReadProtoFromFile(FLAGS_init_net, &init_net_def));
+    CHECK(workspace->RunNetOnce(init_net_def));
+  }
+  if (FLAGS_input.size()) {
+    caffe2::FillInputs(workspace.get());
+  }
+
+  LOG(INFO) << "Loading net: " << FLAGS_net;
+  caffe2::NetDef net_def;
+  CHECK(ReadProtoFromFile(FLAGS_net, &net_def));
+  if (!net_def.has_name()) {
+    net_def.set_name("benchmark");
+  }
+  for (const std::string& name : caffe2::Split(FLAGS_input, ',')) {
+    net_def.add_external_input(name);
+  }
+  if (FLAGS_optimization_level >= 0) {
+    net_def.set_optimization_level(FLAGS_optimization_level);
+  }
+  if (FLAGS_per_op) {
+    net_def.set_profiled_net_type(
+        net_def.has_net_type() ? net_def.net_type() : "simple");
+    net_def.set_net_type("profile");
+    if (FLAGS_profile_output.size()) {
+      net_def.set_profile_output(FLAGS_profile_output);
+    }
+  }
+  CHECK(workspace->CreateNet(net_def));
+
+  LOG(INFO) << "Running " << FLAGS_warmup << " warmup iterations.";
+  for (int i = 0; i < FLAGS_warmup; ++i) {
+    CHECK(workspace->RunNet(net_def.name()));
+  }
+  if (FLAGS_per_op) {
+    // Only the timed iterations count in the per-operator report.
+    caffe2::ProfileNet* net = dynamic_cast<caffe2::ProfileNet*>(
+        workspace->GetNet(net_def.name()));
+    CHECK(net);
+    net->ResetProfile();
+  }
+  LOG(INFO) << "Running " << FLAGS_iter << " timed iterations.";
+  std::vector<float> latencies_ms;
+  caffe2::Timer total_timer;
+  for (int i = 0; i < FLAGS_iter; ++i) {
+    caffe2::Timer timer;
+    CHECK(workspace->RunNet(net_def.name()));
+    latencies_ms.push_back(timer.MilliSeconds());
+  }
+  const float total_seconds = total_timer.MilliSeconds() / 1000;
+  std::sort(latencies_ms.begin(), latencies_ms.end());
+  float mean_ms = 0;
+  for (float latency_ms : latencies_ms) {
+    mean_ms += latency_ms / latencies_ms.size();
+  }
+  LOG(INFO) << "Latency: mean " << mean_ms << " ms, p50 "
+            << caffe2::Percentile(latencies_ms, 0.5) << " ms, p90 "
+            << caffe2::Percentile(latencies_ms, 0.9) << " ms, p99 "
+            << caffe2::Percentile(latencies_ms, 0.99) << " ms, max "
+            << latencies_ms.back() << " ms.";
+  const float iterations_per_second = FLAGS_iter / total_seconds;
+  LOG(INFO) << "Throughput: " << iterations_per_second << " iterations/s.";
+  if (FLAGS_input_dims.size()) {
+    const int batch_size = std::stoi(FLAGS_input_dims);
+    LOG(INFO) << "Throughput: " << iterations_per_second * batch_size
+              << " examples/s with a batch size of " << batch_size << ".";
+  }
+  if (FLAGS_per_op) {
+    caffe2::ProfileNet* net = dynamic_cast<caffe2::ProfileNet*>(
+        workspace->GetNet(net_def.name()));
+    CHECK(net);
+    caffe2::ReportPerOperatorTime(net->GetProfile());
+  }
+
+  // Destroy the workspace first, so that the profile is written out.
+  workspace.reset();
+  // This is to allow us to use memory leak checks.
+  google::protobuf::ShutdownProtobufLibrary();
+  gflags::ShutDownCommandLineFlags();
+  return 0;
+}
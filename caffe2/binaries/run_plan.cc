@@ -1,20 +1,37 @@
 #include "caffe2/core/operator.h"
+#include "caffe2/core/tracing.h"
 #include "caffe2/proto/caffe2.pb.h"
 #include "caffe2/utils/proto_utils.h"
 #include "caffe2/binaries/gflags_namespace.h"
 #include "glog/logging.h"
 
 DEFINE_string(plan, "", "The given path to the plan protobuffer.");
+DEFINE_string(trace_file, "",
+              "If set, a Chrome trace of the run is written to this file.");
+DEFINE_int32(parallel_net_threads, 0,
+             "If positive, the number of threads of the executor that the "
+             "parallel nets share. Defaults to the hardware concurrency.");
 
 int main(int argc, char** argv) {
   google::InitGoogleLogging(argv[0]);
   gflags::SetUsageMessage("Runs a given plan.");
   gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (FLAGS_parallel_net_threads > 0) {
+    caffe2::SetParallelNetThreads(FLAGS_parallel_net_threads);
+  }
   LOG(INFO) << "Loading plan: " << FLAGS_plan;
   caffe2::PlanDef plan_def;
   CHECK(ReadProtoFromFile(FLAGS_plan, &plan_def));
   std::unique_ptr<caffe2::Workspace> workspace(new caffe2::Workspace());
+  if (FLAGS_trace_file.size()) {
+    caffe2::tracing::StartTracing();
+  }
   workspace->RunPlan(plan_def);
+  if (FLAGS_trace_file.size()) {
+    caffe2::tracing::StopTracing();
+    LOG(INFO) << "Writing trace to " << FLAGS_trace_file;
+    caffe2::tracing::WriteTrace(FLAGS_trace_file);
+  }
 
   // This is to allow us to use memory leak checks.
   google::protobuf::ShutdownProtobufLibrary();
@@ -0,0 +1,318 @@
+#include <cstdlib>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif  // __linux__
+
+#include "caffe2/core/allocator.h"
+#include "glog/logging.h"
+
+namespace caffe2 {
+
+namespace {
+// Every block starts with a header that records its free list, so Delete()
+// knows where to put it back. The header takes a full kAlignment bytes so that
+// the memory handed out is aligned just like the block itself.
+struct BlockHeader {
+  int free_list;
+  size_t class_bytes;
+};
+const size_t kHeaderBytes = CachingCPUAllocator::kAlignment;
+static_assert(sizeof(BlockHeader) <= kHeaderBytes, "BlockHeader too large.");
+
+// The free list of blocks that are too large to be cached.
+const int kUncachedFreeList = -1;
+// The smallest size class is 64 bytes, so size class 0 covers everything up
+// to 64 bytes; above that there are kClassesPerPowerOfTwo classes between
+// consecutive powers of two.
+const int kLogMinClassBytes = 6;
+const int kLogClassesPerPowerOfTwo = 2;
+const int kClassesPerPowerOfTwo = 1 << kLogClassesPerPowerOfTwo;
+// The number of bytes a single thread keeps for itself before it returns
+// blocks to the shared free lists.
+const size_t kMaxThreadCacheBytes = size_t(1) << 25;
+// MPOL_BIND from linux/mempolicy.h, which is not always installed.
+const int kMpolBind = 2;
+
+thread_local CPUMemoryOptions current_memory_options;
+
+inline void* BlockData(void* block) {
+  return static_cast<char*>(block) + kHeaderBytes;
+}
+inline BlockHeader* DataHeader(void* data) {
+  return reinterpret_cast<BlockHeader*>(
+      static_cast<char*>(data) - kHeaderBytes);
+}
+
+// Set once the calling thread's cache has been destroyed at thread exit. Memory
+// can still be freed after that, e.g. by static tensors of the main thread,
+// and then goes straight to the shared free lists.
+thread_local bool thread_cache_destroyed = false;
+}  // namespace
+
+// The per-thread free lists. When the thread exits, its cached blocks go to
+// the shared free lists so that other threads can still reuse them.
+struct CachingCPUAllocator::ThreadCache {
+  CachingCPUAllocator* owner = nullptr;
+  vector<vector<void*> > free_blocks;
+  size_t bytes = 0;
+
+  ~ThreadCache() {
+    if (owner) owner->ReturnThreadCache(this);
+    thread_cache_destroyed = true;
+  }
+};
+
+int CachingCPUAllocator::SizeClass(size_t nbytes, size_t* class_bytes) {
+  const size_t min_class_bytes = size_t(1) << kLogMinClassBytes;
+  if (nbytes <= min_class_bytes) {
+    *class_bytes = min_class_bytes;
+    return 0;
+  }
+  // Find the power of two such that 2^log < nbytes <= 2^(log + 1), and round
+  // nbytes up to a multiple of 2^log / kClassesPerPowerOfTwo.
+  int log = 0;
+  while ((size_t(1) << (log + 1)) < nbytes) ++log;
+  const size_t step = size_t(1) << (log - kLogClassesPerPowerOfTwo);
+  const size_t sub_class = (nbytes - (size_t(1) << log) + step - 1) / step;
+  *class_bytes = (size_t(1) << log) + sub_class * step;
+  return (log - kLogMinClassBytes) * kClassesPerPowerOfTwo + sub_class;
+}
+
+const CPUMemoryOptions& GetCurrentCPUMemoryOptions() {
+  return current_memory_options;
+}
+
+void SetCurrentCPUMemoryOptions(const CPUMemoryOptions& options) {
+  CHECK_GE(options.numa_node_id, -1) << "NUMA node id out of range.";
+  CHECK_LE(options.numa_node_id, CachingCPUAllocator::kMaxNumaNodeId)
+      << "NUMA node id out of range.";
+  current_memory_options = options;
+}
+
+namespace {
+int NumSizeClasses() {
+  size_t max_class_bytes;
+  return CachingCPUAllocator::SizeClass(
+      CachingCPUAllocator::kMaxClassBytes, &max_class_bytes) + 1;
+}
+}  // namespace
+
+CachingCPUAllocator::CachingCPUAllocator(size_t max_cached_bytes)
+    : max_cached_bytes_(max_cached_bytes), bytes_in_use_(0), bytes_cached_(0),
+      num_allocations_(0), num_cache_hits_(0),
+      num_size_classes_(NumSizeClasses()) {
+  free_blocks_.resize(num_size_classes_);
+}
+
+int CachingCPUAllocator::FreeListIndex(
+    int size_class, const CPUMemoryOptions& options) const {
+  // Huge pages only matter for blocks that span at least one of them, so all
+  // the smaller blocks of a NUMA node share the same free lists.
+  size_t class_bytes;
+  const bool huge_pages = options.huge_pages &&
+      size_class >= SizeClass(kHugePageBytes, &class_bytes);
+  const int pool = (options.numa_node_id + 1) * 2 + (huge_pages ? 1 : 0);
+  return pool * num_size_classes_ + size_class;
+}
+
+void* CachingCPUAllocator::AllocateBlock(
+    size_t class_bytes, const CPUMemoryOptions& options) {
+  const size_t block_bytes = kHeaderBytes + class_bytes;
+  const bool huge_pages = options.huge_pages && class_bytes >= kHugePageBytes;
+  const bool numa_bound = options.numa_node_id >= 0;
+  // madvise() and mbind() work on whole pages.
+  size_t alignment = kAlignment;
+  if (huge_pages) {
+    alignment = kHugePageBytes;
+  } else if (numa_bound) {
+    alignment = 4096;
+  }
+  void* block = nullptr;
+  if (posix_memalign(&block, alignment, block_bytes) != 0) {
+    return nullptr;
+  }
+#ifdef __linux__
+  if (huge_pages && madvise(block, block_bytes, MADV_HUGEPAGE) != 0) {
+    VLOG(1) << "madvise(MADV_HUGEPAGE) failed, using normal pages.";
+  }
+  if (numa_bound) {
+    uint64_t node_mask = uint64_t(1) << options.numa_node_id;
+    const size_t page_bytes = sysconf(_SC_PAGESIZE);
+    const size_t bound_bytes =
+        (block_bytes + page_bytes - 1) / page_bytes * page_bytes;
+    if (syscall(SYS_mbind, block, bound_bytes, kMpolBind, &node_mask,
+                sizeof(node_mask) * 8 + 1, 0) != 0) {
+      LOG(WARNING) << "Failed to bind memory to NUMA node "
+                   << options.numa_node_id << ".";
+    }
+  }
+#endif  // __linux__
+  return block;
+}
+
+CachingCPUAllocator::~CachingCPUAllocator() {
+  FreeCached();
+  // FreeCached() made the calling thread's cache point to this allocator.
+  ThreadCache* cache = GetThreadCache();
+  if (cache) cache->owner = nullptr;
+}
+
+CachingCPUAllocator::ThreadCache* CachingCPUAllocator::GetThreadCache() {
+  if (thread_cache_destroyed) return nullptr;
+  static thread_local ThreadCache cache;
+  if (cache.owner != this) {
+    // The thread switched to a different allocator; hand the blocks back to
+    // the previous one.
+    if (cache.owner) cache.owner->ReturnThreadCache(&cache);
+    cache.owner = this;
+  }
+  return &cache;
+}
+
+void CachingCPUAllocator::ReturnThreadCache(ThreadCache* cache) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_blocks_.size() < cache->free_blocks.size()) {
+    free_blocks_.resize(cache->free_blocks.size());
+  }
+  for (int i = 0; i < cache->free_blocks.size(); ++i) {
+    auto& blocks = cache->free_blocks[i];
+    free_blocks_[i].insert(free_blocks_[i].end(), blocks.begin(), blocks.end());
+    blocks.clear();
+  }
+  cache->bytes = 0;
+}
+
+void* CachingCPUAllocator::New(
+    size_t nbytes, const CPUMemoryOptions& options) {
+  ++num_allocations_;
+  size_t class_bytes;
+  int free_list = kUncachedFreeList;
+  if (nbytes <= kMaxClassBytes) {
+    free_list = FreeListIndex(SizeClass(nbytes, &class_bytes), options);
+    ThreadCache* cache = GetThreadCache();
+    if (cache && free_list < cache->free_blocks.size() &&
+        cache->free_blocks[free_list].size()) {
+      auto& thread_blocks = cache->free_blocks[free_list];
+      void* block = thread_blocks.back();
+      thread_blocks.pop_back();
+      cache->bytes -= class_bytes;
+      bytes_cached_ -= class_bytes;
+      bytes_in_use_ += class_bytes;
+      ++num_cache_hits_;
+      return BlockData(block);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_list < free_blocks_.size() && free_blocks_[free_list].size()) {
+      auto& shared_blocks = free_blocks_[free_list];
+      void* block = shared_blocks.back();
+      shared_blocks.pop_back();
+      bytes_cached_ -= class_bytes;
+      bytes_in_use_ += class_bytes;
+      ++num_cache_hits_;
+      return BlockData(block);
+    }
+  } else {
+    class_bytes = nbytes;
+  }
+  void* block = AllocateBlock(class_bytes, options);
+  if (block == nullptr && bytes_cached_ > 0) {
+    // Give the cached memory back to the system and try again.
+    LOG(WARNING) << "Failed to allocate " << class_bytes << " bytes, freeing "
+                 << bytes_cached_ << " cached bytes and retrying.";
+    FreeCached();
+    block = AllocateBlock(class_bytes, options);
+  }
+  CHECK(block) << "Failed to allocate " << class_bytes << " bytes.";
+  BlockHeader* header = static_cast<BlockHeader*>(block);
+  header->free_list = free_list;
+  header->class_bytes = class_bytes;
+  bytes_in_use_ += class_bytes;
+  return BlockData(block);
+}
+
+void CachingCPUAllocator::Delete(void* data) {
+  if (data == nullptr) return;
+  BlockHeader* header = DataHeader(data);
+  void* block = header;
+  const int free_list = header->free_list;
+  const size_t class_bytes = header->class_bytes;
+  bytes_in_use_ -= class_bytes;
+  if (free_list == kUncachedFreeList) {
+    free(block);
+    return;
+  }
+  if (class_bytes <= kMaxThreadCacheBytes) {
+    ThreadCache* cache = GetThreadCache();
+    if (cache && cache->bytes + class_bytes <= kMaxThreadCacheBytes) {
+      if (free_list >= cache->free_blocks.size()) {
+        cache->free_blocks.resize(free_list + 1);
+      }
+      cache->free_blocks[free_list].push_back(block);
+      cache->bytes += class_bytes;
+      bytes_cached_ += class_bytes;
+      return;
+    }
+  }
+  if (bytes_cached_ + class_bytes > max_cached_bytes_) {
+    free(block);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_list >= free_blocks_.size()) {
+    free_blocks_.resize(free_list + 1);
+  }
+  free_blocks_[free_list].push_back(block);
+  bytes_cached_ += class_bytes;
+}
+
+void CachingCPUAllocator::FreeCached() {
+  ThreadCache* cache = GetThreadCache();
+  if (cache) ReturnThreadCache(cache);
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& blocks : free_blocks_) {
+    for (void* block : blocks) {
+      FreeBlock(block, static_cast<BlockHeader*>(block)->class_bytes);
+    }
+    blocks.clear();
+  }
+}
+
+void CachingCPUAllocator::FreeBlock(void* block, size_t class_bytes) {
+  bytes_cached_ -= class_bytes;
+  free(block);
+}
+
+CPUAllocatorStats CachingCPUAllocator::Stats() {
+  return CPUAllocatorStats{
+      bytes_in_use_.load(), bytes_cached_.load(), num_allocations_.load(),
+      num_cache_hits_.load()};
+}
+
+namespace {
+std::unique_ptr<CPUAllocator>& CPUAllocatorSingleton() {
+  // The allocator is intentionally leaked: static tensors may still return
+  // memory to it during program exit.
+  static std::unique_ptr<CPUAllocator>* allocator =
+      new std::unique_ptr<CPUAllocator>(new CachingCPUAllocator());
+  return *allocator;
+}
+}  // namespace
+
+CPUAllocator* GetCPUAllocator() {
+  return CPUAllocatorSingleton().get();
+}
+
+void SetCPUAllocator(CPUAllocator* allocator) {
+  CHECK(allocator) << "The CPU allocator cannot be null.";
+  CHECK_EQ(GetCPUAllocator()->Stats().num_allocations, 0)
+      << "The CPU allocator cannot be replaced once memory was allocated.";
+  // The previous allocator is leaked: other threads may still have caches
+  // that point to it.
+  CPUAllocatorSingleton().release();
+  CPUAllocatorSingleton().reset(allocator);
+}
+
+}  // namespace caffe2
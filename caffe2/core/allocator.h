@@ -0,0 +1,167 @@
+#ifndef CAFFE2_CORE_ALLOCATOR_H_
+#define CAFFE2_CORE_ALLOCATOR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>  // NOLINT
+#include <vector>
+
+#include "caffe2/core/common.h"
+
+namespace caffe2 {
+
+// Statistics of a CPU allocator. Allocators that do not keep track of
+// statistics simply report zeros.
+struct CPUAllocatorStats {
+  // The number of bytes handed out and not yet returned.
+  size_t bytes_in_use;
+  // The number of bytes that have been returned but are kept for reuse.
+  size_t bytes_cached;
+  // The number of New() calls, and how many of them were served from cache.
+  int64_t num_allocations;
+  int64_t num_cache_hits;
+
+  inline float hit_rate() const {
+    return num_allocations ?
+        static_cast<float>(num_cache_hits) / num_allocations : 0;
+  }
+};
+
+// Placement options of CPU memory. They are set from the DeviceOption of a
+// CPUContext, see CPUContext::SwitchToDevice().
+struct CPUMemoryOptions {
+  CPUMemoryOptions() : huge_pages(false), numa_node_id(-1) {}
+  // Whether large buffers should be backed by transparent huge pages.
+  bool huge_pages;
+  // If non-negative, the NUMA node the memory should be bound to.
+  int numa_node_id;
+
+  inline bool operator==(const CPUMemoryOptions& other) const {
+    return huge_pages == other.huge_pages &&
+           numa_node_id == other.numa_node_id;
+  }
+};
+
+// The memory options that CPUContext::New() currently uses on the calling
+// thread. Like the current device of CUDA, this is per thread.
+const CPUMemoryOptions& GetCurrentCPUMemoryOptions();
+void SetCurrentCPUMemoryOptions(const CPUMemoryOptions& options);
+
+// CPUAllocator is the interface behind CPUContext::New() and
+// CPUContext::Delete(). Everything that CPUContext allocates, notably the
+// storage of CPU tensors, goes through the allocator returned by
+// GetCPUAllocator().
+class CPUAllocator {
+ public:
+  CPUAllocator() {}
+  virtual ~CPUAllocator() {}
+  // Allocates nbytes with the default memory options.
+  void* New(size_t nbytes) { return New(nbytes, CPUMemoryOptions()); }
+  // Allocators are free to ignore the options they do not support.
+  virtual void* New(size_t nbytes, const CPUMemoryOptions& options) = 0;
+  virtual void Delete(void* data) = 0;
+  virtual CPUAllocatorStats Stats() {
+    return CPUAllocatorStats{0, 0, 0, 0};
+  }
+
+  DISABLE_COPY_AND_ASSIGN(CPUAllocator);
+};
+
+// The plain allocator that simply calls new and delete, and ignores the memory
+// options.
+class DefaultCPUAllocator final : public CPUAllocator {
+ public:
+  DefaultCPUAllocator() {}
+  using CPUAllocator::New;
+  void* New(size_t nbytes, const CPUMemoryOptions& options) override {
+    return new char[nbytes];
+  }
+  void Delete(void* data) override { delete[] static_cast<char*>(data); }
+};
+
+// CachingCPUAllocator keeps the memory that is returned to it and hands it
+// out again on later allocations of a similar size, so that a steady-state
+// training or serving loop, which allocates the same sizes over and over, does
+// not call malloc and free at all.
+//
+// Allocation sizes are rounded up to size classes: four classes per power of
+// two, so at most 25% of a block is wasted. Returned blocks first go to a small
+// free list of the returning thread, which needs no locking, and overflow to a
+// free list shared by all threads. Blocks larger than the largest size class
+// are not cached. If the total cached size would exceed max_cached_bytes, the
+// block is freed instead.
+//
+// All blocks are aligned to kAlignment bytes, so that SIMD loads never cross a
+// cache line. Blocks allocated with different memory options are kept in
+// different free lists: blocks of at least kHugePageBytes are advised to use
+// transparent huge pages if options.huge_pages is set, and blocks are bound to
+// the NUMA node options.numa_node_id if it is non-negative. Both only have an
+// effect on Linux.
+class CachingCPUAllocator final : public CPUAllocator {
+ public:
+  explicit CachingCPUAllocator(size_t max_cached_bytes = kDefaultMaxCachedBytes);
+  // All the threads that used the allocator should have exited, or at least
+  // stopped using it, before it is destroyed.
+  ~CachingCPUAllocator();
+  using CPUAllocator::New;
+  void* New(size_t nbytes, const CPUMemoryOptions& options) override;
+  void Delete(void* data) override;
+  CPUAllocatorStats Stats() override;
+  // Frees all the blocks cached in the shared free list and in the calling
+  // thread's free list.
+  void FreeCached();
+
+  // Returns the size class index of an allocation of nbytes, and sets
+  // class_bytes to the rounded up size.
+  static int SizeClass(size_t nbytes, size_t* class_bytes);
+
+  static const size_t kDefaultMaxCachedBytes = size_t(1) << 32;
+  static const size_t kAlignment = 64;
+  static const size_t kHugePageBytes = size_t(1) << 21;
+  // The largest NUMA node id that memory can be bound to.
+  static const int kMaxNumaNodeId = 63;
+  // The largest block size that is cached.
+  static const size_t kMaxClassBytes = size_t(1) << 30;
+
+ private:
+  struct ThreadCache;
+
+  // Returns the calling thread's cache, or nullptr if the thread is exiting.
+  ThreadCache* GetThreadCache();
+  // Returns the free list index of blocks of the given size class and memory
+  // options.
+  int FreeListIndex(int size_class, const CPUMemoryOptions& options) const;
+  // Allocates a new block from the system.
+  void* AllocateBlock(size_t class_bytes, const CPUMemoryOptions& options);
+  // Moves all the blocks of the given thread cache to the shared free list.
+  void ReturnThreadCache(ThreadCache* cache);
+  // Frees a block (pointing at its header) back to the system.
+  void FreeBlock(void* block, size_t class_bytes);
+
+  const size_t max_cached_bytes_;
+  std::atomic<size_t> bytes_in_use_;
+  std::atomic<size_t> bytes_cached_;
+  std::atomic<int64_t> num_allocations_;
+  std::atomic<int64_t> num_cache_hits_;
+  const int num_size_classes_;
+  // The shared free lists, one per size class and memory options, guarded by
+  // mutex_. They are grown as new memory options show up.
+  std::mutex mutex_;
+  vector<vector<void*> > free_blocks_;
+
+  DISABLE_COPY_AND_ASSIGN(CachingCPUAllocator);
+};
+
+// Returns the current CPU allocator. Unless SetCPUAllocator() is called, this
+// is a CachingCPUAllocator.
+CPUAllocator* GetCPUAllocator();
+// Replaces the CPU allocator, and takes ownership of the given one. Since
+// memory has to be returned to the allocator it came from, this must be
+// called before any CPU memory is allocated; this is checked for allocators
+// that keep statistics. The previous allocator is never destroyed.
+void SetCPUAllocator(CPUAllocator* allocator);
+
+}  // namespace caffe2
+
+#endif  // CAFFE2_CORE_ALLOCATOR_H_
@@ -2,6 +2,7 @@
 #define CAFFE2_CORE_BLOB_H_
 
 #include <cstddef>
+#include <utility>
 #include <vector>
 
 #include "caffe2/core/common.h"
@@ -35,6 +36,8 @@ class Blob {
 
   template <class T>
   inline bool IsType() const { return internal::IsTypeId<T>(id_); }
+  // Whether the blob holds nothing yet.
+  inline bool IsEmpty() const { return pointer_ == nullptr; }
   inline string TypeName() const { return internal::TypeName(id_); }
   template <class T>
   const T& Get() const {
@@ -64,6 +67,13 @@ class Blob {
     }
   }
 
+  // Swaps the contents of the two blobs, without copying them.
+  inline void Swap(Blob* other) {
+    std::swap(id_, other->id_);
+    std::swap(pointer_, other->pointer_);
+    std::swap(destroy_, other->destroy_);
+  }
+
   // Serializes the current blob, if possible. This serialization uses
   // registration so we don't need to deal with multiple platform problems.
   inline string Serialize(const string& name) const;
@@ -104,20 +114,20 @@ inline string Blob::Serialize(const string& name) const {
 template <typename dtype, class Context>
 class Tensor {
  public:
-  Tensor() : ndim_(0), size_(0), data_(nullptr) {}
+  Tensor() : ndim_(0), size_(0), capacity_(0), data_(nullptr) {}
 
   // Creates a tensor. The actual data allocation is going to be carried out
   // till the first time mutable_data() is called, so there is no overhead of
   // creating multiple tensors just as placeholders (although I haven't got a
   // clear idea where such cases would happen).
   explicit Tensor(const vector<int>& dims)
-      : data_(nullptr) {
+      : capacity_(0), data_(nullptr) {
     Reshape(dims);
   }
 
   template <class SrcContext, class ContextForCopy>
   Tensor(const Tensor<dtype, SrcContext>& src, ContextForCopy* context)
-      : data_(nullptr) {
+      : capacity_(0), data_(nullptr) {
     Reshape(src.dims());
     context->template Copy<dtype, SrcContext, Context>(
         src.size(), src.data(), mutable_data());
@@ -126,7 +136,7 @@ class Tensor {
   // Creates a tensor, and fills its contents with the given values. We need to
   // have a context passed in as the copy function is device dependent.
   Tensor(const vector<int>& dims, const vector<dtype>& values, Context* context)
-      : data_(nullptr) {
+      : capacity_(0), data_(nullptr) {
     Reshape(dims);
     CHECK_EQ(values.size(), size_);
     context->template Copy<dtype, CPUContext, Context>(
@@ -135,7 +145,7 @@ class Tensor {
 
   // Special case of above: create a tensor of shape 1, and the given value.
   Tensor(const dtype& value, Context* context)
-      : data_(nullptr) {
+      : capacity_(0), data_(nullptr) {
     Reshape(std::vector<int>());
     context->template Copy<dtype, CPUContext, Context>(
         1, &value, mutable_data());
@@ -152,14 +162,38 @@ class Tensor {
       CHECK_GT(d, 0);
       new_size *= d;
     }
-    // If the size changes, we will free the data. the next mutable_data() call
-    // will create the data storage.
-    if (data_.get() && size_ != new_size) {
+    // If the new size does not fit in the current storage, or the size of a
+    // storage shared with other tensors changes, we will free the data, and
+    // the next mutable_data() call will create the data storage. Otherwise the
+    // storage is kept, so that shrinking a tensor (e.g. for a short last batch)
+    // and growing it back does not reallocate, and reshaping a shared tensor
+    // to its own size (e.g. an in-place operator on an alias) keeps sharing.
+    if (data_.get() && (new_size > capacity_ ||
+                        (new_size != size_ && data_.use_count() > 1))) {
       data_.reset();
+      capacity_ = 0;
     }
     size_ = new_size;
   }
 
+  // Makes sure that the tensor can grow to the given number of elements
+  // without reallocating. If a new storage is needed, the current content is
+  // copied over with the given context, and the tensor no longer shares its
+  // data with other tensors.
+  void Reserve(int capacity, Context* context) {
+    if (capacity < size_) capacity = size_;
+    if (capacity <= capacity_) return;
+    Reallocate(capacity, context);
+  }
+
+  // Frees the part of the storage that is beyond the current size. As with
+  // Reserve(), the content is copied over and sharing is broken if a new
+  // storage is needed.
+  void ShrinkToFit(Context* context) {
+    if (!data_.get() || capacity_ == size_) return;
+    Reallocate(size_, context);
+  }
+
   template <typename other_type, class OtherContext>
   inline void ReshapeLike(const Tensor<other_type, OtherContext>& src_tensor) {
     Reshape(src_tensor.dims());
@@ -180,10 +214,26 @@ class Tensor {
         << "Source tensor has no content yet.";
     // Finally, do sharing.
     data_ = src.data_;
+    capacity_ = src.capacity_;
   }
 
+  // Swaps the shapes and storages of the two tensors, without copying them.
+  void Swap(Tensor* other) {
+    std::swap(ndim_, other->ndim_);
+    dims_.swap(other->dims_);
+    std::swap(size_, other->size_);
+    std::swap(capacity_, other->capacity_);
+    data_.swap(other->data_);
+  }
+
+  // Whether other tensors hold the storage of this one too (see ShareData()).
+  inline bool shares_data() const { return data_.use_count() > 1; }
+
   inline int ndim() const { return ndim_; }
   inline int size() const { return size_; }
+  // The number of elements the current storage can hold, or 0 if there is no
+  // storage yet.
+  inline int capacity() const { return capacity_; }
   inline const vector<int>& dims() const { return dims_; }
   inline int dim(const int i) const {
     CHECK_LT(i, ndim_) << "Exceeding ndim limit " << ndim_;
@@ -205,12 +255,27 @@ class Tensor {
     CHECK_GT(size_, 0);
     data_.reset(static_cast<dtype*>(Context::New(size_ * sizeof(dtype))),
                 Context::Delete);
+    capacity_ = size_;
   }
 
  protected:
+  void Reallocate(int capacity, Context* context) {
+    CHECK_GT(capacity, 0);
+    std::shared_ptr<dtype> new_data(
+        static_cast<dtype*>(Context::New(capacity * sizeof(dtype))),
+        Context::Delete);
+    if (data_.get()) {
+      context->template Copy<dtype, Context, Context>(
+          size_, data_.get(), new_data.get());
+    }
+    data_ = new_data;
+    capacity_ = capacity;
+  }
+
   int ndim_;
   vector<int> dims_;
   int size_;
+  int capacity_;
   std::shared_ptr<dtype> data_;
   DISABLE_COPY_AND_ASSIGN(Tensor);
 };
@@ -43,6 +43,17 @@ TEST(BlobTest, Blob) {
   EXPECT_FALSE(blob.IsType<int>());
 }
 
+TEST(BlobTest, BlobSwap) {
+  Blob a, b;
+  int* int_pointer = a.GetMutable<int>();
+  Foo* foo_pointer = b.GetMutable<Foo>();
+  a.Swap(&b);
+  EXPECT_TRUE(a.IsType<Foo>());
+  EXPECT_TRUE(b.IsType<int>());
+  EXPECT_EQ(&a.Get<Foo>(), foo_pointer);
+  EXPECT_EQ(&b.Get<int>(), int_pointer);
+}
+
 TEST(BlobDeathTest, BlobUninitialized) {
   Blob blob;
   ASSERT_DEATH(blob.Get<int>(), ".*wrong type for the Blob instance.*");
@@ -168,6 +179,101 @@ TYPED_TEST(TensorCPUTest, NoLongerSharesAfterReshape) {
   EXPECT_NE(old_pointer, tensor.mutable_data());
 }
 
+TYPED_TEST(TensorCPUTest, KeepsStorageWhenShrinking) {
+  vector<int> dims{4, 5};
+  Tensor<TypeParam, CPUContext> tensor(dims);
+  EXPECT_EQ(tensor.capacity(), 0);
+  auto* pointer = tensor.mutable_data();
+  EXPECT_EQ(tensor.capacity(), 20);
+  // A short batch reuses the storage.
+  dims[0] = 2;
+  tensor.Reshape(dims);
+  EXPECT_EQ(tensor.size(), 10);
+  EXPECT_EQ(tensor.capacity(), 20);
+  EXPECT_EQ(tensor.mutable_data(), pointer);
+  // Growing back to the capacity still does not reallocate.
+  dims[0] = 4;
+  tensor.Reshape(dims);
+  EXPECT_EQ(tensor.mutable_data(), pointer);
+  // Growing past the capacity does.
+  dims[0] = 5;
+  tensor.Reshape(dims);
+  EXPECT_EQ(tensor.capacity(), 0);
+  tensor.mutable_data();
+  EXPECT_EQ(tensor.capacity(), 25);
+}
+
+TYPED_TEST(TensorCPUTest, ReserveAndShrinkToFit) {
+  CPUContext context;
+  Tensor<TypeParam, CPUContext> tensor(vector<int>{3});
+  for (int i = 0; i < 3; ++i) {
+    tensor.mutable_data()[i] = i;
+  }
+  tensor.Reserve(10, &context);
+  EXPECT_EQ(tensor.size(), 3);
+  EXPECT_EQ(tensor.capacity(), 10);
+  auto* pointer = tensor.data();
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(tensor.data()[i], i);
+  }
+  // Reserving less than the capacity does nothing.
+  tensor.Reserve(5, &context);
+  EXPECT_EQ(tensor.capacity(), 10);
+  tensor.Reshape(vector<int>{10});
+  EXPECT_EQ(tensor.mutable_data(), pointer);
+  tensor.Reshape(vector<int>{2});
+  tensor.ShrinkToFit(&context);
+  EXPECT_EQ(tensor.capacity(), 2);
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ(tensor.data()[i], i);
+  }
+}
+
+TYPED_TEST(TensorCPUTest, ReshapeStopsSharingData) {
+  vector<int> dims{4, 5};
+  Tensor<TypeParam, CPUContext> tensor(dims);
+  tensor.mutable_data();
+  Tensor<TypeParam, CPUContext> other_tensor(dims);
+  other_tensor.ShareData(tensor);
+  EXPECT_EQ(other_tensor.capacity(), 20);
+  // Even a reshape that fits in the shared storage stops the sharing.
+  dims[0] = 2;
+  other_tensor.Reshape(dims);
+  EXPECT_EQ(other_tensor.capacity(), 0);
+  EXPECT_NE(other_tensor.mutable_data(), tensor.data());
+  EXPECT_FALSE(tensor.shares_data());
+}
+
+TYPED_TEST(TensorCPUTest, SameSizeReshapeKeepsSharingData) {
+  Tensor<TypeParam, CPUContext> tensor(vector<int>{4, 5});
+  tensor.mutable_data();
+  Tensor<TypeParam, CPUContext> other_tensor(vector<int>{20});
+  other_tensor.ShareData(tensor);
+  // Reshaping to the same size, as an in-place operator does through
+  // ReshapeLike(), keeps the shared storage.
+  other_tensor.Reshape(vector<int>{2, 10});
+  EXPECT_TRUE(other_tensor.shares_data());
+  EXPECT_EQ(other_tensor.data(), tensor.data());
+  other_tensor.ReshapeLike(other_tensor);
+  EXPECT_EQ(other_tensor.data(), tensor.data());
+}
+
+TYPED_TEST(TensorCPUTest, SwapExchangesShapesAndStorages) {
+  Tensor<TypeParam, CPUContext> tensor(vector<int>{2, 3});
+  Tensor<TypeParam, CPUContext> other_tensor;
+  auto* pointer = tensor.mutable_data();
+  EXPECT_FALSE(tensor.shares_data());
+  tensor.Swap(&other_tensor);
+  EXPECT_EQ(tensor.ndim(), 0);
+  EXPECT_EQ(tensor.capacity(), 0);
+  EXPECT_EQ(other_tensor.dims(), (vector<int>{2, 3}));
+  EXPECT_EQ(other_tensor.capacity(), 6);
+  EXPECT_EQ(other_tensor.data(), pointer);
+  tensor.Reshape(vector<int>{6});
+  tensor.ShareData(other_tensor);
+  EXPECT_TRUE(tensor.shares_data());
+  EXPECT_TRUE(other_tensor.shares_data());
+}
 
 TYPED_TEST(TensorCPUDeathTest, CannotAccessDataWhenEmpty) {
   Tensor<TypeParam, CPUContext> tensor;
@@ -11,6 +11,10 @@ Client::Client(const string& client_def_name) : workspace_(new Workspace()) {
   CHECK(ReadProtoFromFile(client_def_name, &client_def));
   workspace_->RunNetOnce(client_def.init_net());
   client_def.mutable_main_net()->set_name("main");
+  // Declare the input and output of the client, so that they are kept intact
+  // if the main net plans its memory.
+  client_def.mutable_main_net()->add_external_input(client_def.input());
+  client_def.mutable_main_net()->add_external_output(client_def.output());
   CHECK(workspace_->CreateNet(client_def.main_net()));
   input_blob_ = workspace_->GetBlob(client_def.input());
   output_blob_ = workspace_->GetBlob(client_def.output());
@@ -1,9 +1,13 @@
 #ifndef CAFFE2_CORE_CONTEXT_H_
 #define CAFFE2_CORE_CONTEXT_H_
 
+#include <algorithm>
 #include <random>
+#include <thread>  // NOLINT
 
+#include "caffe2/core/allocator.h"
 #include "caffe2/proto/caffe2.pb.h"
+#include "caffe2/utils/thread_pool.h"
 #include "glog/logging.h"
 
 namespace caffe2 {
@@ -14,19 +18,43 @@ class CPUContext {
   explicit CPUContext(const DeviceOption& device_option)
       : random_generator_(device_option.random_seed()) {
     DCHECK_EQ(device_option.device_type(), CPU);
+    memory_options_.huge_pages = device_option.cpu_huge_pages();
+    memory_options_.numa_node_id = device_option.numa_node_id();
+    CHECK(memory_options_.numa_node_id >= -1 &&
+          memory_options_.numa_node_id <= CachingCPUAllocator::kMaxNumaNodeId)
+        << "Invalid NUMA node id " << memory_options_.numa_node_id << ".";
+    SwitchToDevice();
   }
   virtual ~CPUContext() {}
-  inline void SwitchToDevice() {}
+  // Similar to the current device of CUDA, the memory options of the context
+  // apply to all CPU memory allocated by the calling thread until another
+  // context switches to its own.
+  inline void SwitchToDevice() {
+    if (!(GetCurrentCPUMemoryOptions() == memory_options_)) {
+      SetCurrentCPUMemoryOptions(memory_options_);
+    }
+  }
   inline bool FinishDeviceComputation() { return true; }
 
   inline std::mt19937& RandGenerator() { return random_generator_; }
 
+  // The thread pool shared by all CPU contexts, across which CPU operators
+  // split their work with ParallelFor() (see caffe2/utils/parallel_for.h).
+  // Together with the calling thread, it keeps every core busy. The pool is
+  // intentionally leaked, since its threads may still be running at exit.
+  static ThreadPool* thread_pool() {
+    static ThreadPool* pool = new ThreadPool(std::max(
+        1, static_cast<int>(std::thread::hardware_concurrency()) - 1));
+    return pool;
+  }
+
+  // New() and Delete() go through the CPU allocator, see allocator.h.
   static void* New(size_t nbytes) {
-    void* data = new char[nbytes];
+    void* data = GetCPUAllocator()->New(nbytes, GetCurrentCPUMemoryOptions());
     // memset(data, 0, nbytes);
     return data;
   }
-  static void Delete(void* data) { delete[] static_cast<char*>(data); }
+  static void Delete(void* data) { GetCPUAllocator()->Delete(data); }
 
   // Two copy functions that deals with cross-device copies.
   template <class SrcContext, class DstContext>
@@ -40,6 +68,7 @@ class CPUContext {
 
  protected:
   std::mt19937 random_generator_;
+  CPUMemoryOptions memory_options_;
 };
 
 template<>
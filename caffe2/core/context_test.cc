@@ -1,4 +1,5 @@
 #include <random>
+#include <thread>  // NOLINT
 
 #include "caffe2/proto/caffe2.pb.h"
 #include "caffe2/core/context.h"
@@ -42,4 +43,180 @@ TEST(CPUContextTest, TestAllocDealloc) {
   CPUContext::Delete(dst_data);
 }
 
+TEST(CPUContextTest, TestMemoryOptions) {
+  DeviceOption option;
+  option.set_cpu_huge_pages(true);
+  option.set_numa_node_id(0);
+  CPUContext context(option);
+  EXPECT_TRUE(GetCurrentCPUMemoryOptions().huge_pages);
+  EXPECT_EQ(GetCurrentCPUMemoryOptions().numa_node_id, 0);
+  CPUContext default_context{DeviceOption()};
+  EXPECT_FALSE(GetCurrentCPUMemoryOptions().huge_pages);
+  EXPECT_EQ(GetCurrentCPUMemoryOptions().numa_node_id, -1);
+  context.SwitchToDevice();
+  EXPECT_TRUE(GetCurrentCPUMemoryOptions().huge_pages);
+  default_context.SwitchToDevice();
+}
+
+TEST(CPUContextDeathTest, CannotReplaceAllocatorAfterAllocating) {
+  CPUContext::Delete(CPUContext::New(16));
+  ASSERT_DEATH(SetCPUAllocator(new DefaultCPUAllocator()), "");
+}
+
+TEST(CPUContextDeathTest, RejectsInvalidNumaNode) {
+  DeviceOption option;
+  option.set_numa_node_id(-2);
+  ASSERT_DEATH(CPUContext context(option), "");
+  CPUMemoryOptions options;
+  options.numa_node_id = -2;
+  ASSERT_DEATH(SetCurrentCPUMemoryOptions(options), "");
+}
+
+TEST(CachingCPUAllocatorTest, TestSizeClass) {
+  size_t class_bytes;
+  EXPECT_EQ(CachingCPUAllocator::SizeClass(1, &class_bytes), 0);
+  EXPECT_EQ(class_bytes, 64);
+  EXPECT_EQ(CachingCPUAllocator::SizeClass(64, &class_bytes), 0);
+  EXPECT_EQ(class_bytes, 64);
+  EXPECT_EQ(CachingCPUAllocator::SizeClass(65, &class_bytes), 1);
+  EXPECT_EQ(class_bytes, 80);
+  EXPECT_EQ(CachingCPUAllocator::SizeClass(128, &class_bytes), 4);
+  EXPECT_EQ(class_bytes, 128);
+  EXPECT_EQ(CachingCPUAllocator::SizeClass(129, &class_bytes), 5);
+  EXPECT_EQ(class_bytes, 160);
+  EXPECT_EQ(CachingCPUAllocator::SizeClass(1000, &class_bytes), 16);
+  EXPECT_EQ(class_bytes, 1024);
+  // No size class wastes more than a quarter of the requested size.
+  for (size_t nbytes = 65; nbytes < 100000; nbytes += 7) {
+    CachingCPUAllocator::SizeClass(nbytes, &class_bytes);
+    EXPECT_GE(class_bytes, nbytes);
+    EXPECT_LT(class_bytes, nbytes * 5 / 4);
+  }
+}
+
+TEST(CachingCPUAllocatorTest, TestReuse) {
+  CachingCPUAllocator allocator;
+  void* data = allocator.New(1000);
+  CPUAllocatorStats stats = allocator.Stats();
+  EXPECT_EQ(stats.bytes_in_use, 1024);
+  EXPECT_EQ(stats.bytes_cached, 0);
+  allocator.Delete(data);
+  stats = allocator.Stats();
+  EXPECT_EQ(stats.bytes_in_use, 0);
+  EXPECT_EQ(stats.bytes_cached, 1024);
+  // An allocation of the same size class gets the same block back.
+  void* data_again = allocator.New(1020);
+  EXPECT_EQ(data_again, data);
+  stats = allocator.Stats();
+  EXPECT_EQ(stats.num_allocations, 2);
+  EXPECT_EQ(stats.num_cache_hits, 1);
+  EXPECT_FLOAT_EQ(stats.hit_rate(), 0.5);
+  // A different size class does not.
+  void* other_data = allocator.New(2000);
+  EXPECT_NE(other_data, data);
+  allocator.Delete(data_again);
+  allocator.Delete(other_data);
+  allocator.FreeCached();
+  stats = allocator.Stats();
+  EXPECT_EQ(stats.bytes_in_use, 0);
+  EXPECT_EQ(stats.bytes_cached, 0);
+}
+
+TEST(CachingCPUAllocatorTest, TestAlignment) {
+  CachingCPUAllocator allocator;
+  CPUMemoryOptions huge_page_options;
+  huge_page_options.huge_pages = true;
+  for (size_t nbytes : {1, 63, 100, 4097, 1 << 20, 3 << 20}) {
+    void* data = allocator.New(nbytes);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(data) %
+              CachingCPUAllocator::kAlignment, 0);
+    allocator.Delete(data);
+    data = allocator.New(nbytes, huge_page_options);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(data) %
+              CachingCPUAllocator::kAlignment, 0);
+    allocator.Delete(data);
+  }
+}
+
+TEST(CachingCPUAllocatorTest, TestMemoryOptionsUseSeparateFreeLists) {
+  CachingCPUAllocator allocator;
+  CPUMemoryOptions huge_page_options;
+  huge_page_options.huge_pages = true;
+  CPUMemoryOptions numa_options;
+  numa_options.numa_node_id = 0;
+  // Small blocks do not use huge pages, so they come from the same free list.
+  void* data = allocator.New(1000);
+  allocator.Delete(data);
+  void* huge_page_data = allocator.New(1000, huge_page_options);
+  EXPECT_EQ(huge_page_data, data);
+  allocator.Delete(huge_page_data);
+  // But blocks bound to a NUMA node do not.
+  void* numa_data = allocator.New(1000, numa_options);
+  EXPECT_NE(numa_data, data);
+  allocator.Delete(numa_data);
+  EXPECT_EQ(allocator.New(1000, numa_options), numa_data);
+  allocator.Delete(numa_data);
+  // Large blocks with and without huge pages do not share a free list.
+  const size_t nbytes = 4 * CachingCPUAllocator::kHugePageBytes;
+  data = allocator.New(nbytes);
+  allocator.Delete(data);
+  huge_page_data = allocator.New(nbytes, huge_page_options);
+  EXPECT_NE(huge_page_data, data);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(huge_page_data) %
+            CachingCPUAllocator::kAlignment, 0);
+  allocator.Delete(huge_page_data);
+}
+
+TEST(CachingCPUAllocatorTest, TestLargeBlocksAreNotCached) {
+  CachingCPUAllocator allocator;
+  const size_t nbytes = CachingCPUAllocator::kMaxClassBytes + 1;
+  void* data = allocator.New(nbytes);
+  EXPECT_EQ(allocator.Stats().bytes_in_use, nbytes);
+  allocator.Delete(data);
+  EXPECT_EQ(allocator.Stats().bytes_in_use, 0);
+  EXPECT_EQ(allocator.Stats().bytes_cached, 0);
+}
+
+TEST(CachingCPUAllocatorTest, TestMaxCachedBytes) {
+  CachingCPUAllocator allocator(0);
+  // Blocks first go to the thread's own free list, which does not count
+  // against the limit; past that, they are freed.
+  const size_t nbytes = size_t(1) << 26;
+  void* data = allocator.New(nbytes);
+  allocator.Delete(data);
+  EXPECT_EQ(allocator.Stats().bytes_cached, 0);
+}
+
+TEST(CachingCPUAllocatorTest, TestThreadExitReturnsBlocks) {
+  CachingCPUAllocator allocator;
+  void* data = nullptr;
+  std::thread thread([&allocator, &data]() {
+    data = allocator.New(100);
+    allocator.Delete(data);
+  });
+  thread.join();
+  EXPECT_EQ(allocator.Stats().bytes_cached, 112);
+  // The block the thread cached is now available to other threads.
+  void* data_again = allocator.New(100);
+  EXPECT_EQ(data_again, data);
+  EXPECT_EQ(allocator.Stats().num_cache_hits, 1);
+  allocator.Delete(data_again);
+}
+
+TEST(CachingCPUAllocatorTest, TestCrossThreadDelete) {
+  CachingCPUAllocator allocator;
+  const int kNumBlocks = 1000;
+  vector<void*> blocks;
+  for (int i = 0; i < kNumBlocks; ++i) {
+    blocks.push_back(allocator.New(i + 1));
+  }
+  std::thread thread([&allocator, &blocks]() {
+    for (void* data : blocks) allocator.Delete(data);
+  });
+  thread.join();
+  EXPECT_EQ(allocator.Stats().bytes_in_use, 0);
+  allocator.FreeCached();
+  EXPECT_EQ(allocator.Stats().bytes_cached, 0);
+}
+
 }  // namespace caffe2
@@ -0,0 +1,110 @@
+#include <set>
+#include <vector>
+
+#include "caffe2/core/memory_planner.h"
+#include "caffe2/core/net.h"
+#include "caffe2/core/operator.h"
+#include "caffe2/core/workspace.h"
+#include "glog/logging.h"
+
+namespace caffe2 {
+
+MemoryPlan PlanNetMemory(const NetDef& net_def, const Workspace& ws) {
+  std::set<string> external_blobs;
+  for (const string& name : net_def.external_input()) {
+    external_blobs.insert(name);
+  }
+  for (const string& name : net_def.external_output()) {
+    external_blobs.insert(name);
+  }
+  // The outputs that share the storage of an input instead of getting
+  // storage of their own (see REGISTER_SHARED_STORAGE_OUTPUTS in operator.h).
+  // A shared blob that held one of them or one of the inputs of their
+  // operator would still point at that storage when it is handed to another
+  // blob, so these blobs are never planned.
+  // First pass: figure out, for each blob, the operator that first produces
+  // it and the last operator that touches it. Blobs that are read before they
+  // are produced come from outside the network and are never planned.
+  CaffeMap<string, int> first_def;
+  CaffeMap<string, int> last_use;
+  std::set<string> not_plannable(external_blobs);
+  for (int idx = 0; idx < net_def.op_size(); ++idx) {
+    const OperatorDef& op_def = net_def.op(idx);
+    for (int i = 0; i < op_def.output_size(); ++i) {
+      if (OutputSharesInputStorage(op_def.type(), i)) {
+        not_plannable.insert(op_def.input().begin(), op_def.input().end());
+        not_plannable.insert(op_def.output(i));
+      }
+    }
+    for (const string& input : op_def.input()) {
+      if (first_def.count(input) == 0) {
+        not_plannable.insert(input);
+      }
+      last_use[input] = idx;
+    }
+    for (const string& output : op_def.output()) {
+      if (first_def.count(output) == 0) {
+        first_def[output] = idx;
+      }
+      last_use[output] = idx;
+    }
+  }
+  // Blobs whose lifetime starts or ends at a given operator.
+  vector<vector<string> > born_at(net_def.op_size());
+  vector<vector<string> > dead_after(net_def.op_size());
+  for (const auto& it : first_def) {
+    const string& name = it.first;
+    if (not_plannable.count(name) || ws.HasBlob(name)) {
+      continue;
+    }
+    born_at[it.second].push_back(name);
+    dead_after[last_use[name]].push_back(name);
+  }
+  // Second pass: greedily hand out shared blobs. A shared blob becomes free
+  // only after the operator that last touches its blob has finished, so no
+  // operator ever gets one of its inputs aliased to one of its outputs.
+  MemoryPlan plan;
+  plan.num_shared_blobs = 0;
+  vector<string> free_shared_blobs;
+  for (int idx = 0; idx < net_def.op_size(); ++idx) {
+    for (const string& name : born_at[idx]) {
+      if (free_shared_blobs.size()) {
+        // Take the most recently freed one, which is most likely still in
+        // cache.
+        plan.shared_blob_names[name] = free_shared_blobs.back();
+        free_shared_blobs.pop_back();
+      } else {
+        plan.shared_blob_names[name] =
+            "__" + net_def.name() + "_shared_" +
+            std::to_string(plan.num_shared_blobs++);
+      }
+    }
+    for (const string& name : dead_after[idx]) {
+      free_shared_blobs.push_back(plan.shared_blob_names[name]);
+    }
+  }
+  return plan;
+}
+
+void ApplyMemoryPlan(const MemoryPlan& plan, NetDef* net_def) {
+  for (OperatorDef& op_def : *net_def->mutable_op()) {
+    for (string& input : *op_def.mutable_input()) {
+      auto it = plan.shared_blob_names.find(input);
+      if (it != plan.shared_blob_names.end()) {
+        VLOG(1) << "Mapping input " << input << " of operator "
+                << op_def.name() << " to " << it->second;
+        input = it->second;
+      }
+    }
+    for (string& output : *op_def.mutable_output()) {
+      auto it = plan.shared_blob_names.find(output);
+      if (it != plan.shared_blob_names.end()) {
+        VLOG(1) << "Mapping output " << output << " of operator "
+                << op_def.name() << " to " << it->second;
+        output = it->second;
+      }
+    }
+  }
+}
+
+}  // namespace caffe2
@@ -0,0 +1,44 @@
+#ifndef CAFFE2_CORE_MEMORY_PLANNER_H_
+#define CAFFE2_CORE_MEMORY_PLANNER_H_
+
+#include "caffe2/core/common.h"
+#include "caffe2/proto/caffe2.pb.h"
+
+namespace caffe2 {
+
+class Workspace;
+
+// MemoryPlan describes how the intermediate blobs of a sequentially executed
+// network are mapped onto a smaller set of shared blobs. An intermediate blob
+// is one that is first produced by an operator of the network, is not listed
+// as an external input or output of the network, and does not exist in the
+// workspace before the network is created (which rules out parameters). Its
+// lifetime spans from the operator that first produces it to the last
+// operator that touches it, and two intermediate blobs whose lifetimes do not
+// overlap can live in the same shared blob, and thus the same storage. The
+// outputs that share the data of an input, such as those of Alias and Flatten
+// (see REGISTER_SHARED_STORAGE_OUTPUTS in operator.h), and the inputs of their
+// operators are not planned.
+struct MemoryPlan {
+  // Maps the name of every intermediate blob to the name of the shared blob
+  // it is assigned to.
+  CaffeMap<string, string> shared_blob_names;
+  // The number of shared blobs. Since a shared blob is reused as soon as the
+  // intermediate blob it holds is dead, this is also the peak number of
+  // intermediate buffers alive at the same time with the plan, while without
+  // the plan all shared_blob_names.size() of them are alive all the time.
+  int num_shared_blobs;
+};
+
+// Computes the memory plan of the given network, assuming that its operators
+// run in the order they are listed. Blobs that already exist in the given
+// workspace are not planned.
+MemoryPlan PlanNetMemory(const NetDef& net_def, const Workspace& ws);
+
+// Rewrites the inputs and outputs of the network's operators according to the
+// given memory plan.
+void ApplyMemoryPlan(const MemoryPlan& plan, NetDef* net_def);
+
+}  // namespace caffe2
+
+#endif  // CAFFE2_CORE_MEMORY_PLANNER_H_
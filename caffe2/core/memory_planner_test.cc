@@ -0,0 +1,99 @@
+#include "caffe2/core/memory_planner.h"
+#include "caffe2/core/net.h"
+#include "caffe2/core/operator.h"
+#include "caffe2/core/workspace.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+namespace caffe2 {
+
+// A chain of operators in which every intermediate blob dies right after the
+// next operator consumes it, plus one blob that skips an operator.
+const char kChainNetDefString[] =
+"  name: \"chain\""
+"  op { input: \"data\" input: \"w\" output: \"a\" type: \"Foo\" }"
+"  op { input: \"a\" output: \"b\" type: \"Foo\" }"
+"  op { input: \"b\" output: \"c\" type: \"Foo\" }"
+"  op { input: \"c\" input: \"a\" output: \"d\" type: \"Foo\" }"
+"  op { input: \"d\" output: \"e\" type: \"Foo\" }"
+"  op { input: \"e\" output: \"out\" type: \"Foo\" }"
+"  external_output: \"out\"";
+
+TEST(MemoryPlannerTest, TestChainNet) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kChainNetDefString), &net_def));
+  Workspace ws;
+  // w is a parameter that already lives in the workspace.
+  ws.CreateBlob("w");
+  MemoryPlan plan = PlanNetMemory(net_def, ws);
+  // data and w are inputs, and out is an external output.
+  EXPECT_EQ(plan.shared_blob_names.size(), 5);
+  EXPECT_EQ(plan.shared_blob_names.count("data"), 0);
+  EXPECT_EQ(plan.shared_blob_names.count("w"), 0);
+  EXPECT_EQ(plan.shared_blob_names.count("out"), 0);
+  // a is alive till d is computed, so b, c and d need two more blobs; e can
+  // then reuse the storage of a.
+  EXPECT_EQ(plan.num_shared_blobs, 3);
+  EXPECT_NE(plan.shared_blob_names["a"], plan.shared_blob_names["b"]);
+  EXPECT_NE(plan.shared_blob_names["a"], plan.shared_blob_names["c"]);
+  EXPECT_NE(plan.shared_blob_names["a"], plan.shared_blob_names["d"]);
+  EXPECT_NE(plan.shared_blob_names["b"], plan.shared_blob_names["c"]);
+  EXPECT_NE(plan.shared_blob_names["c"], plan.shared_blob_names["d"]);
+  EXPECT_NE(plan.shared_blob_names["d"], plan.shared_blob_names["e"]);
+
+  ApplyMemoryPlan(plan, &net_def);
+  EXPECT_EQ(net_def.op(0).input(0), "data");
+  EXPECT_EQ(net_def.op(0).input(1), "w");
+  EXPECT_EQ(net_def.op(0).output(0), plan.shared_blob_names["a"]);
+  EXPECT_EQ(net_def.op(3).input(1), plan.shared_blob_names["a"]);
+  EXPECT_EQ(net_def.op(5).output(0), "out");
+  // No operator should have an input aliased to one of its outputs.
+  for (const OperatorDef& op_def : net_def.op()) {
+    for (const string& input : op_def.input()) {
+      for (const string& output : op_def.output()) {
+        EXPECT_NE(input, output);
+      }
+    }
+  }
+}
+
+TEST(MemoryPlannerTest, TestInPlaceBlobIsNotPlanned) {
+  NetDef net_def;
+  net_def.set_name("inplace");
+  OperatorDef* op = net_def.add_op();
+  op->add_input("x");
+  op->add_output("x");
+  Workspace ws;
+  MemoryPlan plan = PlanNetMemory(net_def, ws);
+  EXPECT_EQ(plan.shared_blob_names.size(), 0);
+  EXPECT_EQ(plan.num_shared_blobs, 0);
+}
+
+// The second output of SharingFoo shares the data of its input.
+REGISTER_SHARED_STORAGE_OUTPUTS(SharingFoo, 1);
+
+TEST(MemoryPlannerTest, TestAliasedBlobsAreNotPlanned) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      "  name: \"alias\""
+      "  op { output: \"a\" type: \"Foo\" }"
+      "  op { input: \"a\" output: \"own\" output: \"b\""
+      "       type: \"SharingFoo\" }"
+      "  op { input: \"b\" input: \"own\" output: \"c\" type: \"Foo\" }"
+      "  op { output: \"d\" type: \"Foo\" }"
+      "  op { input: \"c\" input: \"d\" output: \"e\" type: \"Foo\" }"
+      "  op { input: \"e\" input: \"b\" output: \"out\" type: \"Foo\" }"
+      "  external_output: \"out\"", &net_def));
+  Workspace ws;
+  MemoryPlan plan = PlanNetMemory(net_def, ws);
+  // b shares the storage of a, so neither of them can be handed to d. The
+  // other output of SharingFoo has storage of its own.
+  EXPECT_EQ(plan.shared_blob_names.count("a"), 0);
+  EXPECT_EQ(plan.shared_blob_names.count("b"), 0);
+  EXPECT_EQ(plan.shared_blob_names.count("own"), 1);
+  EXPECT_EQ(plan.shared_blob_names.count("c"), 1);
+  EXPECT_EQ(plan.shared_blob_names.count("d"), 1);
+}
+
+}  // namespace caffe2
@@ -2,6 +2,7 @@
 #include <mutex>
 
 #include "caffe2/core/db.h"
+#include "caffe2/core/tracing.h"
 #include "glog/logging.h"
 
 namespace caffe2 {
@@ -25,6 +26,7 @@ class MiniDBCursor : public Cursor {
   }
 
   void Next() override {
+    TRACE_EVENT("db", "Cursor::Next");
     // First, read in the key and value length.
     if (fread(&key_len_, sizeof(int), 1, file_) == 0) {
       // Reaching EOF.
@@ -87,6 +89,7 @@ class MiniDBTransaction : public Transaction {
   }
 
   void Commit() override {
+    TRACE_EVENT("db", "Transaction::Commit");
     CHECK_EQ(fflush(file_), 0);
   }
 
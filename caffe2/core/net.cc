@@ -1,6 +1,10 @@
+#include <algorithm>
+
 #include "caffe2/core/net.h"
 #include "caffe2/core/operator.h"
+#include "caffe2/core/tracing.h"
 #include "caffe2/proto/caffe2.pb.h"
+#include "caffe2/utils/thread_pool.h"
 
 namespace caffe2 {
 
@@ -11,6 +15,12 @@ NetBase* CreateNet(const NetDef& net_def, Workspace* ws) {
   } else if (net_def.net_type() == "parallel") {
     VLOG(1) << "Creating parallel net.";
     return new ParallelNet(net_def, ws);
+  } else if (net_def.net_type() == "dag_ws") {
+    VLOG(1) << "Creating work-stealing parallel net.";
+    return new WorkStealingNet(net_def, ws);
+  } else if (net_def.net_type() == "profile") {
+    VLOG(1) << "Creating profile net.";
+    return new ProfileNet(net_def, ws);
   } else {
     LOG(ERROR) << "Unknown net type: " << net_def.net_type();
     return nullptr;
@@ -50,21 +60,47 @@ bool SimpleNet::Verify() {
   return true;
 }
 
+vector<OperatorBase*> SimpleNet::GetOperators() {
+  vector<OperatorBase*> operators;
+  for (auto& op : operators_) {
+    operators.push_back(op.get());
+  }
+  return operators;
+}
+
+bool NetBase::RunOperator(int idx, OperatorBase* op) {
+  TRACE_EVENT("operator", op->def().name().size() ?
+                          op->def().name() : op->def().type());
+  if (!profiler_) {
+    return op->Run();
+  }
+  Timer timer;
+  bool success = op->Run();
+  profiler_->AddOperatorTime(idx, timer.MilliSeconds());
+  return success;
+}
+
 bool SimpleNet::Run() {
   VLOG(1) << "Running net.";
-  for (const auto& op : operators_) {
+  for (int idx = 0; idx < operators_.size(); ++idx) {
+    OperatorBase* op = operators_[idx].get();
     VLOG(1) << "Running operator " << op->def().name()
             << "(" << op->def().type() << ").";
     // TODO(Yangqing): convert this sequential run to event-based.
-    if (!op->Run()) return false;
+    if (!RunOperator(idx, op)) return false;
   }
   return true;
 }
 
-ParallelNet::ParallelNet(const NetDef& net_def, Workspace* ws)
-    : NetBase(net_def, ws), operator_nodes_(net_def.op_size()) {
-  // Blob creator allows us to track which operator created which blob.
-  std::map<string, int> blob_creator;
+namespace internal {
+
+vector<int> CreateOperatorNodes(
+    const NetDef& net_def, Workspace* ws, vector<OperatorNode>* nodes) {
+  vector<OperatorNode>& operator_nodes = *nodes;
+  // Blob creator allows us to track which operator created which blob. It is
+  // indexed by blob id, and -1 means that the blob is not produced by this
+  // net.
+  vector<int> blob_creator;
   std::map<string, int> execution_chains;
   bool net_def_has_device_option = net_def.has_device_option();
   // Initialize the operators
@@ -75,29 +111,37 @@ ParallelNet::ParallelNet(const NetDef& net_def, Workspace* ws)
     if (!op_def.has_device_option() && net_def_has_device_option) {
       OperatorDef temp_def(op_def);
       temp_def.mutable_device_option()->CopyFrom(net_def.device_option());
-      operator_nodes_[idx].operator_.reset(CreateOperator(temp_def, ws));
+      operator_nodes[idx].operator_.reset(CreateOperator(temp_def, ws));
     } else {
-      operator_nodes_[idx].operator_.reset(CreateOperator(op_def, ws));
+      operator_nodes[idx].operator_.reset(CreateOperator(op_def, ws));
     }
+    // Creating the operator has created its outputs, so all the blobs it
+    // touches now have ids, unless the creation failed, which Verify() will
+    // report later.
+    blob_creator.resize(ws->NumBlobs(), -1);
     // Check the inputs, and set up parents if necessary.
     for (const string& input : op_def.input()) {
-      if (blob_creator.count(input) == 0) {
+      int input_id = ws->GetBlobId(input);
+      int parent = input_id < 0 ? -1 : blob_creator[input_id];
+      if (parent < 0) {
         VLOG(1) << "Input " << input << " not produced by this net. "
                 << "Assuming it is pre-existing.";
       } else {
-        int parent = blob_creator[input];
         VLOG(1) << "op dependency: " << parent << "->" << idx;
-        operator_nodes_[idx].parents_.push_back(parent);
-        operator_nodes_[parent].children_.push_back(idx);
+        operator_nodes[idx].parents_.push_back(parent);
+        operator_nodes[parent].children_.push_back(idx);
       }
     }
     for (const string& output : op_def.output()) {
-      if (blob_creator.count(output) != 0) {
+      int output_id = ws->GetBlobId(output);
+      if (output_id < 0) continue;
+      int& creator = blob_creator[output_id];
+      if (creator >= 0) {
         LOG(WARNING) << "Output " << output << " produced again. "
                      << "Such operation is not strictly tested. "
                      << "Use at your own risk.";
       }
-      blob_creator[output] = idx;
+      creator = idx;
     }
 
     for (const auto& arg : op_def.arg()) {
@@ -110,8 +154,8 @@ ParallelNet::ParallelNet(const NetDef& net_def, Workspace* ws)
             int parent = execution_chains[name];
             VLOG(1) << "op dependency due to execution chain " << name
                     << ": " << parent << "->" << idx;
-            operator_nodes_[idx].parents_.push_back(parent);
-            operator_nodes_[parent].children_.push_back(idx);
+            operator_nodes[idx].parents_.push_back(parent);
+            operator_nodes[parent].children_.push_back(idx);
             // update the tail of the current execution chain.
             execution_chains[name] = idx;
           }
@@ -121,12 +165,229 @@ ParallelNet::ParallelNet(const NetDef& net_def, Workspace* ws)
   }
   // Figure out the initial frontier - this is the one we will feed into the job
   // queue to start a run.
-  for (int idx = 0; idx < operator_nodes_.size(); ++idx) {
-    if (operator_nodes_[idx].parents_.size() == 0) {
-      initial_frontier_.push_back(idx);
+  vector<int> initial_frontier;
+  for (int idx = 0; idx < operator_nodes.size(); ++idx) {
+    if (operator_nodes[idx].parents_.size() == 0) {
+      initial_frontier.push_back(idx);
+    }
+  }
+  return initial_frontier;
+}
+
+}  // namespace internal
+
+namespace {
+// The executor shared by all the parallel nets. It is intentionally leaked,
+// since its threads may still be running at exit.
+std::mutex gParallelNetExecutorMutex;
+int gParallelNetThreads = 0;
+ThreadPool* gParallelNetExecutor = nullptr;
+
+ThreadPool* ParallelNetExecutor() {
+  std::lock_guard<std::mutex> lock(gParallelNetExecutorMutex);
+  if (gParallelNetExecutor == nullptr) {
+    const int num_threads = gParallelNetThreads > 0 ? gParallelNetThreads :
+        std::max(2, static_cast<int>(std::thread::hardware_concurrency()));
+    LOG(INFO) << "Starting the parallel net executor with " << num_threads
+              << " threads.";
+    gParallelNetExecutor = new ThreadPool(num_threads);
+  }
+  return gParallelNetExecutor;
+}
+}  // namespace
+
+void SetParallelNetThreads(int num_threads) {
+  CHECK_GT(num_threads, 0);
+  std::lock_guard<std::mutex> lock(gParallelNetExecutorMutex);
+  CHECK(gParallelNetExecutor == nullptr)
+      << "The parallel net executor has already been started with "
+      << gParallelNetExecutor->num_threads() << " threads.";
+  gParallelNetThreads = num_threads;
+}
+
+ParallelNet::ParallelNet(const NetDef& net_def, Workspace* ws)
+    : NetBase(net_def, ws), operator_nodes_(net_def.op_size()),
+      critical_path_scheduling_(net_def.critical_path_scheduling()),
+      operator_costs_(net_def.op_size(), 1),
+      num_cost_measurements_(net_def.op_size(), 0),
+      priorities_(net_def.op_size(), 0), num_pushed_ops_(0),
+      num_active_workers_(0), num_starting_workers_(0), remaining_ops_(0),
+      success_(true) {
+  initial_frontier_ =
+      internal::CreateOperatorNodes(net_def, ws, &operator_nodes_);
+  max_workers_ = net_def.has_num_workers() ? net_def.num_workers() : 1;
+  CHECK_GT(max_workers_, 0) << "Must have a nonnegative number of workers";
+  if (max_workers_ == 1) {
+    LOG(WARNING) << "Number of workers is 1: this means that all operators "
+                 << "will be executed sequentially. Did you forget to set "
+                 << "num_workers in the NetDef?";
+  }
+  if (critical_path_scheduling_) {
+    // Until their costs are measured, the operators without a cost argument
+    // count as 1 each, which favors the longest chains of operators.
+    for (int idx = 0; idx < operator_nodes_.size(); ++idx) {
+      OperatorBase* op = operator_nodes_[idx].operator_.get();
+      if (op != nullptr && op->HasArgument("cost")) {
+        operator_costs_[idx] = op->GetSingleArgument<float>("cost", 1);
+        num_cost_measurements_[idx] = -1;
+      }
+    }
+    UpdatePriorities();
+  }
+  // Make sure the executor exists before the net runs.
+  ParallelNetExecutor();
+}
+
+bool ParallelNet::Verify() {
+  for (auto& op_node : operator_nodes_) {
+    auto& op = op_node.operator_;
+    VLOG(1) << "Verifying operator " << op->def().name()
+            << "(" << op->def().type() << ").";
+    if (op.get() == nullptr || !op->Verify()) {
+      return false;
     }
   }
-  // Finally, start the workers.
+  return true;
+}
+
+vector<OperatorBase*> ParallelNet::GetOperators() {
+  vector<OperatorBase*> operators;
+  for (auto& op_node : operator_nodes_) {
+    operators.push_back(op_node.operator_.get());
+  }
+  return operators;
+}
+
+bool ParallelNet::Run() {
+  VLOG(1) << "Running parallel net.";
+  std::unique_lock<std::mutex> lock(mutex_);
+  remaining_ops_ = operator_nodes_.size();
+  success_ = true;
+  // Initialize the runtime parent count.
+  for (auto& node : operator_nodes_) {
+    node.runtime_parent_count_ = node.parents_.size();
+  }
+  if (critical_path_scheduling_) {
+    UpdatePriorities();
+  }
+  // Kickstart the workers.
+  for (int idx : initial_frontier_) {
+    PushReadyOp(idx);
+  }
+  StartWorkers();
+  // Once the last worker has exited, all the operators have run, and nothing
+  // on the executor refers to the net anymore.
+  cv_.wait(lock, [this]() { return num_active_workers_ == 0; });
+  DCHECK_EQ(remaining_ops_, 0);
+  VLOG(2) << "All ops finished running.";
+  return success_;
+}
+
+void ParallelNet::StartWorkers() {
+  while (num_active_workers_ < max_workers_ &&
+         num_starting_workers_ < static_cast<int>(ready_ops_.size())) {
+    ++num_active_workers_;
+    ++num_starting_workers_;
+    ParallelNetExecutor()->RunTask([this]() { WorkerFunction(); });
+  }
+}
+
+void ParallelNet::PushReadyOp(int idx) {
+  ready_ops_.push(ReadyOp{priorities_[idx], num_pushed_ops_++, idx});
+}
+
+void ParallelNet::UpdatePriorities() {
+  // The children of an operator always come after it in the net, so the
+  // priorities of its children are known by the time we get to it.
+  for (int idx = operator_nodes_.size() - 1; idx >= 0; --idx) {
+    float longest_child_path = 0;
+    for (int child : operator_nodes_[idx].children_) {
+      DCHECK_GT(child, idx);
+      longest_child_path = std::max(longest_child_path, priorities_[child]);
+    }
+    priorities_[idx] = operator_costs_[idx] + longest_child_path;
+  }
+}
+
+void ParallelNet::WorkerFunction() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  --num_starting_workers_;
+  vector<int> ready_children;
+  while (ready_ops_.size()) {
+    int idx = ready_ops_.top().idx;
+    ready_ops_.pop();
+    lock.unlock();
+    // Run the operator we checked out, and then keep running one of its ready
+    // children in this worker for as long as there is one. This saves a queue
+    // round trip per operator on linear sections of the net, and keeps the
+    // data the child consumes hot in cache.
+    while (idx >= 0) {
+      VLOG(1) << "Running operator #" << idx << " "
+              << operator_nodes_[idx].operator_->def().name()
+              << "(" << operator_nodes_[idx].operator_->def().type() << ").";
+      Timer timer;
+      bool this_success =
+          RunOperator(idx, operator_nodes_[idx].operator_.get());
+      if (critical_path_scheduling_ && num_cost_measurements_[idx] >= 0) {
+        // Only this worker touches the cost of the operator during the run,
+        // and Run() only reads it once all the workers have exited.
+        operator_costs_[idx] += (timer.MilliSeconds() - operator_costs_[idx]) /
+            ++num_cost_measurements_[idx];
+      }
+      int next_idx = -1;
+      ready_children.clear();
+      for (int child : operator_nodes_[idx].children_) {
+        int count = --operator_nodes_[child].runtime_parent_count_;
+        // The count should never be smaller than zero.
+        DCHECK_GE(count, 0)
+            << "Found runtime parent count smaller than zero for "
+            << "operator node "
+            << operator_nodes_[child].operator_->def().name()
+            << "(" << operator_nodes_[child].operator_->def().type() << ").";
+        if (count == 0) {
+          if (next_idx < 0 && !critical_path_scheduling_) {
+            VLOG(2) << "Continuing with operator #" << child << " inline.";
+            next_idx = child;
+          } else {
+            VLOG(2) << "Pushing operator #" << child << " to queue.";
+            ready_children.push_back(child);
+          }
+        }
+      }
+      lock.lock();
+      if (!this_success) {
+        success_ = false;
+      }
+      --remaining_ops_;
+      DCHECK_GE(remaining_ops_, 0);
+      for (int child : ready_children) {
+        PushReadyOp(child);
+      }
+      if (critical_path_scheduling_ && ready_ops_.size()) {
+        next_idx = ready_ops_.top().idx;
+        ready_ops_.pop();
+      }
+      if (ready_ops_.size()) {
+        StartWorkers();
+      }
+      lock.unlock();
+      VLOG(2) << "Finished executing operator #" << idx;
+      idx = next_idx;
+    }
+    lock.lock();
+  }
+  // Only the last worker to exit needs to wake up Run().
+  if (--num_active_workers_ == 0) {
+    cv_.notify_one();
+  }
+}
+
+WorkStealingNet::WorkStealingNet(const NetDef& net_def, Workspace* ws)
+    : NetBase(net_def, ws), operator_nodes_(net_def.op_size()),
+      num_pending_jobs_(0), num_idle_workers_(0), remaining_ops_(0),
+      success_(true), no_more_jobs_(false) {
+  initial_frontier_ =
+      internal::CreateOperatorNodes(net_def, ws, &operator_nodes_);
   int num_workers = net_def.has_num_workers() ? net_def.num_workers() : 1;
   CHECK_GT(num_workers, 0) << "Must have a nonnegative number of workers";
   if (num_workers == 1) {
@@ -134,22 +395,29 @@ ParallelNet::ParallelNet(const NetDef& net_def, Workspace* ws)
                  << "will be executed sequentially. Did you forget to set "
                  << "num_workers in the NetDef?";
   }
+  for (int i = 0; i < num_workers; ++i) {
+    deques_.emplace_back(new WorkerDeque());
+  }
   for (int i = 0; i < num_workers; ++i) {
     VLOG(1) << "Start worker #" << i;
-    workers_.push_back(std::thread(&ParallelNet::WorkerFunction, this));
+    workers_.push_back(std::thread(&WorkStealingNet::WorkerFunction, this, i));
   }
 }
 
-ParallelNet::~ParallelNet() {
+WorkStealingNet::~WorkStealingNet() {
   // Safely join all the workers before exiting.
-  job_queue_.NoMoreJobs();
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    no_more_jobs_ = true;
+  }
+  idle_cv_.notify_all();
   VLOG(1) << "Joining workers.";
   for (auto& worker : workers_) {
     worker.join();
   }
 }
 
-bool ParallelNet::Verify() {
+bool WorkStealingNet::Verify() {
   for (auto& op_node : operator_nodes_) {
     auto& op = op_node.operator_;
     VLOG(1) << "Verifying operator " << op->def().name()
@@ -161,64 +429,161 @@ bool ParallelNet::Verify() {
   return true;
 }
 
-bool ParallelNet::Run() {
-  VLOG(1) << "Running parallel net.";
-  // First, set up job queue.
+vector<OperatorBase*> WorkStealingNet::GetOperators() {
+  vector<OperatorBase*> operators;
+  for (auto& op_node : operator_nodes_) {
+    operators.push_back(op_node.operator_.get());
+  }
+  return operators;
+}
+
+bool WorkStealingNet::Run() {
+  VLOG(1) << "Running work-stealing net.";
+  if (operator_nodes_.size() == 0) {
+    return true;
+  }
   remaining_ops_ = operator_nodes_.size();
   success_ = true;
-  // TODO(jiayq): Start all worker threads.
-  // Initialize the runtime parent count.
   for (auto& node : operator_nodes_) {
     node.runtime_parent_count_ = node.parents_.size();
   }
-  // Kickstart the job queue.
-  for (auto& value : initial_frontier_) {
-    job_queue_.Push(value);
+  // Spread the initial frontier over the workers in a round-robin fashion.
+  for (int i = 0; i < initial_frontier_.size(); ++i) {
+    PushJob(i % deques_.size(), initial_frontier_[i]);
   }
-  std::unique_lock<std::mutex> mutex_lock(remaining_ops_mutex_);
+  std::unique_lock<std::mutex> mutex_lock(finish_mutex_);
   while (remaining_ops_ > 0) {
     VLOG(2) << "Remaining ops to run: " << remaining_ops_;
-    cv_.wait(mutex_lock);
+    finish_cv_.wait(mutex_lock);
   }
   VLOG(2) << "All ops finished running.";
-  // If the above while loop finished, we know that the current run finished.
   return success_;
 }
 
-void ParallelNet::WorkerFunction() {
-  // WorkerFunctions() is an infinite loop until there are no more jobs to run.
+void WorkStealingNet::PushJob(int worker_id, int idx) {
+  {
+    std::lock_guard<std::mutex> lock(deques_[worker_id]->mutex_);
+    deques_[worker_id]->jobs_.push_back(idx);
+  }
+  ++num_pending_jobs_;
+  // Only touch the idle lock if somebody may be sleeping on it. Since both
+  // counters are sequentially consistent, a worker that is about to sleep
+  // will either see the pending job or be seen here as idle.
+  if (num_idle_workers_ > 0) {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    idle_cv_.notify_one();
+  }
+}
+
+bool WorkStealingNet::PopJob(int worker_id, int* idx) {
+  WorkerDeque& deque = *deques_[worker_id];
+  std::lock_guard<std::mutex> lock(deque.mutex_);
+  if (deque.jobs_.empty()) {
+    return false;
+  }
+  // The owner works on the most recently pushed job, which is most likely to
+  // have its inputs still in cache.
+  *idx = deque.jobs_.back();
+  deque.jobs_.pop_back();
+  --num_pending_jobs_;
+  return true;
+}
+
+bool WorkStealingNet::StealJob(int worker_id, int* idx) {
+  for (int offset = 1; offset < deques_.size(); ++offset) {
+    WorkerDeque& deque = *deques_[(worker_id + offset) % deques_.size()];
+    std::lock_guard<std::mutex> lock(deque.mutex_);
+    if (!deque.jobs_.empty()) {
+      // Thieves take the oldest job, leaving the hot end to the owner.
+      *idx = deque.jobs_.front();
+      deque.jobs_.pop_front();
+      --num_pending_jobs_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingNet::WorkerFunction(int worker_id) {
   while (true) {
     int idx;
-    // If there is no more jobs - meaning that the ParallelNet is destructing -
-    // we will exit safely.
-    if (!job_queue_.Pop(&idx)) {
-      return;
+    if (!PopJob(worker_id, &idx) && !StealJob(worker_id, &idx)) {
+      // Nothing to run anywhere: go to sleep until a job is pushed or the net
+      // is destructing.
+      std::unique_lock<std::mutex> mutex_lock(idle_mutex_);
+      ++num_idle_workers_;
+      while (num_pending_jobs_ <= 0 && !no_more_jobs_) {
+        idle_cv_.wait(mutex_lock);
+      }
+      --num_idle_workers_;
+      if (no_more_jobs_) {
+        return;
+      }
+      continue;
     }
-    VLOG(1) << "Running operator #" << idx << " "
+    VLOG(1) << "Worker #" << worker_id << " running operator #" << idx << " "
             << operator_nodes_[idx].operator_->def().name()
             << "(" << operator_nodes_[idx].operator_->def().type() << ").";
-    bool this_success = operator_nodes_[idx].operator_->Run();
+    if (!RunOperator(idx, operator_nodes_[idx].operator_.get())) {
+      success_ = false;
+    }
     for (int child : operator_nodes_[idx].children_) {
       int count = --operator_nodes_[child].runtime_parent_count_;
-      // The count should never be smaller than zero.
       DCHECK_GE(count, 0)
           << "Found runtime parent count smaller than zero for "
           << "operator node "
           << operator_nodes_[child].operator_->def().name()
           << "(" << operator_nodes_[child].operator_->def().type() << ").";
       if (count == 0) {
-        VLOG(2) << "Pushing operator #" << child << " to queue.";
-        job_queue_.Push(child);
+        VLOG(2) << "Pushing operator #" << child << " to worker #"
+                << worker_id;
+        PushJob(worker_id, child);
       }
     }
-    // Notify that the processed op is incremented by one.
-    std::unique_lock<std::mutex> mutex_lock(remaining_ops_mutex_);
-    --remaining_ops_;
-    success_ &= this_success;
-    DCHECK_GE(remaining_ops_, 0);
-    cv_.notify_one();
+    if (--remaining_ops_ == 0) {
+      // This is the last operator of the run: wake up Run().
+      std::lock_guard<std::mutex> lock(finish_mutex_);
+      finish_cv_.notify_one();
+    }
     VLOG(2) << "Finished executing operator #" << idx;
   }
 }
 
+ProfileNet::ProfileNet(const NetDef& net_def, Workspace* ws)
+    : NetBase(net_def, ws), net_profiler_(net_def),
+      profile_output_(net_def.profile_output()) {
+  CHECK_NE(net_def.profiled_net_type(), "profile")
+      << "Cannot profile a profile net.";
+  NetDef profiled_net_def(net_def);
+  profiled_net_def.set_net_type(net_def.profiled_net_type());
+  net_.reset(CreateNet(profiled_net_def, ws));
+  if (net_.get()) {
+    net_->SetProfiler(&net_profiler_);
+  }
+}
+
+ProfileNet::~ProfileNet() {
+  // Destroy the profiled net first, as its workers may still be reporting.
+  net_.reset();
+  if (profile_output_.size()) {
+    LOG(INFO) << "Writing the profile of the network to " << profile_output_;
+    WriteNetProfile(GetProfile(), profile_output_);
+  }
+}
+
+bool ProfileNet::Verify() {
+  return net_.get() != nullptr && net_->Verify();
+}
+
+vector<OperatorBase*> ProfileNet::GetOperators() {
+  return net_->GetOperators();
+}
+
+bool ProfileNet::Run() {
+  Timer timer;
+  bool success = net_->Run();
+  net_profiler_.AddNetTime(timer.MilliSeconds());
+  return success;
+}
+
 }  // namespace caffe2
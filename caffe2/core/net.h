@@ -3,17 +3,22 @@
 
 #include <atomic>
 #include <climits>
+#include <condition_variable>  // NOLINT
 #include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>  // NOLINT
+#include <queue>
 #include <thread>  // NOLINT
 #include <typeinfo>
 #include <vector>
 
 #include "caffe2/core/blob.h"
 #include "caffe2/core/common.h"
+#include "caffe2/core/net_profiler.h"
 #include "caffe2/core/registry.h"
 #include "caffe2/core/workspace.h"
 #include "caffe2/proto/caffe2.pb.h"
-#include "caffe2/utils/simple_queue.h"
 
 namespace caffe2 {
 
@@ -23,14 +28,36 @@ class OperatorBase;
 // contexts.
 class NetBase {
  public:
-  NetBase(const NetDef& net_def, Workspace* ws) {}
+  NetBase(const NetDef& net_def, Workspace* ws) : profiler_(nullptr) {}
   virtual ~NetBase() {}
   virtual bool Verify() = 0;
   virtual bool Run() = 0;
+  // Returns the operators of the net, in the order of the net definition.
+  virtual vector<OperatorBase*> GetOperators() = 0;
+
+  // Makes the net report the run time of each of its operators to the given
+  // profiler, which should outlive the net. Pass nullptr to stop profiling.
+  inline void SetProfiler(NetProfiler* profiler) { profiler_ = profiler; }
+
+ protected:
+  // Runs the operator with the given index in the net def. Net
+  // implementations should run their operators through this function, so that
+  // they can be profiled.
+  bool RunOperator(int idx, OperatorBase* op);
+
+  NetProfiler* profiler_;
 
   DISABLE_COPY_AND_ASSIGN(NetBase);
 };
 
+// ParallelNet runs the operators of all the parallel nets in the process on a
+// single shared executor, so that the number of threads does not grow with the
+// number of nets, and the num_workers of a net only caps how many of its
+// operators run at the same time. The executor has as many threads as the
+// hardware concurrency, and at least 2, unless SetParallelNetThreads() is
+// called before the first parallel net is created.
+void SetParallelNetThreads(int num_threads);
+
 // Essentially, we won't expect too many Net instances, so we will simply
 // have a function that produces different net implementations. If needed we can
 // switch to a registration pattern later.
@@ -44,6 +71,7 @@ class SimpleNet final : public NetBase {
   SimpleNet(const NetDef& net_def, Workspace* ws);
   bool Verify() override;
   bool Run() override;
+  vector<OperatorBase*> GetOperators() override;
 
  protected:
   vector<unique_ptr<OperatorBase> > operators_;
@@ -58,33 +86,159 @@ struct OperatorNode {
   vector<int> parents_;
   std::atomic<int> runtime_parent_count_;
 };
+
+// Creates the operators of a DAG net into the given nodes, and sets up their
+// parent-children dependencies from the blobs they consume and produce, as
+// well as from any "execution_chain" arguments. The nodes vector should have
+// already been resized to the number of operators in the net. Returns the
+// initial frontier, i.e. the operators that have no parents.
+vector<int> CreateOperatorNodes(
+    const NetDef& net_def, Workspace* ws, vector<OperatorNode>* nodes);
 }
 
 class ParallelNet final : public NetBase {
  public:
   ParallelNet(const NetDef& net_def, Workspace* ws);
-  ~ParallelNet();
   bool Verify() override;
   bool Run() override;
-  // WorkerFunction() is a function wrapper to allow us to run worker threads.
-  // It checks out one ready-to-run operator from the job queue, runs it,
-  // notifies all its children, and for any children that is ready, enqueues
-  // it to the job queue.
+  vector<OperatorBase*> GetOperators() override;
+  // WorkerFunction() is what the workers of the net run on the shared
+  // executor. It checks out ready-to-run operators and runs them, and notifies
+  // their children. The first child that becomes ready is run directly by the
+  // same worker, and any other ready children are queued, with more workers
+  // started for them if the net is below its num_workers cap. With critical
+  // path scheduling, all the ready children are queued, and the worker goes
+  // on with the ready operator of the highest priority instead. The worker
+  // exits once there is no ready operator left.
   void WorkerFunction();
 
  protected:
+  // A ready operator in the queue. Operators of higher priority come first,
+  // and operators of the same priority in the order they became ready.
+  struct ReadyOp {
+    float priority;
+    int64_t sequence;
+    int idx;
+    inline bool operator<(const ReadyOp& other) const {
+      return priority < other.priority ||
+          (priority == other.priority && sequence > other.sequence);
+    }
+  };
+
+  // Starts workers on the shared executor while there are more ready
+  // operators than workers about to pick them up, and the net is below its
+  // cap. Should be called with mutex_ held.
+  void StartWorkers();
+  // Queues a ready operator. Should be called with mutex_ held.
+  void PushReadyOp(int idx);
+  // Sets the priority of each operator to the cost of the longest path from
+  // it to the end of the net, from the current operator costs.
+  void UpdatePriorities();
+
   vector<internal::OperatorNode> operator_nodes_;
   vector<int> initial_frontier_;
-  SimpleQueue<int> job_queue_;
-  std::vector<std::thread> workers_;
+  // The maximum number of operators of the net that run at the same time.
+  int max_workers_;
+  // For critical path scheduling, the cost and priority of each operator, and
+  // the number of runs its cost has been measured over, or -1 if its cost is
+  // given by its cost argument. Without critical path scheduling, all the
+  // priorities are 0, so the operators run in the order they become ready.
+  bool critical_path_scheduling_;
+  vector<float> operator_costs_;
+  vector<int> num_cost_measurements_;
+  vector<float> priorities_;
+  // The state of the current run, protected by mutex_. cv_ is used to wake
+  // up Run() once the last worker has exited.
+  std::priority_queue<ReadyOp> ready_ops_;
+  int64_t num_pushed_ops_;
+  int num_active_workers_;
+  // The workers that have been started but have not checked out an operator
+  // yet.
+  int num_starting_workers_;
   int remaining_ops_;
   bool success_;
-  std::mutex remaining_ops_mutex_;
+  std::mutex mutex_;
   std::condition_variable cv_;
 
   DISABLE_COPY_AND_ASSIGN(ParallelNet);
 };
 
+// WorkStealingNet runs the same DAG as ParallelNet, but instead of funneling
+// all ready operators through a single shared job queue, each worker owns its
+// own deque. When a worker finishes an operator, it pushes the children that
+// became ready to the back of its own deque and pops from there, so dependent
+// operators tend to stay on the same thread. A worker whose deque runs dry
+// steals from the front of the other workers' deques, and only goes to sleep
+// if there is nothing left to steal anywhere.
+class WorkStealingNet final : public NetBase {
+ public:
+  WorkStealingNet(const NetDef& net_def, Workspace* ws);
+  ~WorkStealingNet();
+  bool Verify() override;
+  bool Run() override;
+  vector<OperatorBase*> GetOperators() override;
+  // WorkerFunction() is the main loop of the worker with the given id. It
+  // checks out ready-to-run operators from its own deque or, failing that,
+  // steals them from the other workers, and runs them until the net is
+  // destructed.
+  void WorkerFunction(int worker_id);
+
+ protected:
+  // A deque of ready operators owned by a single worker. Each deque has its
+  // own lock, so workers only contend with each other when stealing.
+  struct WorkerDeque {
+    std::mutex mutex_;
+    std::deque<int> jobs_;
+  };
+
+  void PushJob(int worker_id, int idx);
+  bool PopJob(int worker_id, int* idx);
+  bool StealJob(int worker_id, int* idx);
+
+  vector<internal::OperatorNode> operator_nodes_;
+  vector<int> initial_frontier_;
+  vector<unique_ptr<WorkerDeque> > deques_;
+  std::vector<std::thread> workers_;
+  // The number of jobs sitting in all the deques, and the number of workers
+  // that are (about to be) sleeping because they could not find any job.
+  std::atomic<int> num_pending_jobs_;
+  std::atomic<int> num_idle_workers_;
+  std::atomic<int> remaining_ops_;
+  std::atomic<bool> success_;
+  bool no_more_jobs_;
+  // idle_mutex_ and idle_cv_ are used to put idle workers to sleep.
+  std::mutex idle_mutex_;
+  std::condition_variable idle_cv_;
+  // finish_mutex_ and finish_cv_ are used to notify Run() that the last
+  // operator has finished.
+  std::mutex finish_mutex_;
+  std::condition_variable finish_cv_;
+
+  DISABLE_COPY_AND_ASSIGN(WorkStealingNet);
+};
+
+// ProfileNet runs the network as a network of type profiled_net_type, and
+// records the wall-clock time of the whole network and of each of its
+// operators across runs. The statistics can be obtained with GetProfile(), and
+// are also written to profile_output, if set, when the net is destroyed.
+class ProfileNet final : public NetBase {
+ public:
+  ProfileNet(const NetDef& net_def, Workspace* ws);
+  ~ProfileNet();
+  bool Verify() override;
+  bool Run() override;
+  vector<OperatorBase*> GetOperators() override;
+  inline NetProfile GetProfile() const { return net_profiler_.GetProfile(); }
+  inline void ResetProfile() { net_profiler_.Reset(); }
+
+ protected:
+  NetProfiler net_profiler_;
+  unique_ptr<NetBase> net_;
+  string profile_output_;
+
+  DISABLE_COPY_AND_ASSIGN(ProfileNet);
+};
+
 }  // namespace caffe2
 
 #endif  // CAFFE2_CORE_NET_H_
@@ -0,0 +1,362 @@
+#include <set>
+#include <sstream>
+
+#include "caffe2/core/net_optimizer.h"
+#include "glog/logging.h"
+
+namespace caffe2 {
+
+DEFINE_REGISTRY(NetOptimizationPassRegistry, NetOptimizationPass);
+
+namespace {
+
+// OptimizeNet gives up repeating the passes after this many rounds.
+const int kMaxOptimizationRounds = 10;
+
+struct BlobWrites {
+  // The number of operators that write the blob, and the first of them.
+  int count = 0;
+  int first_writer = -1;
+};
+
+CaffeMap<string, BlobWrites> GetBlobWrites(const NetDef& net_def) {
+  CaffeMap<string, BlobWrites> writes;
+  for (int idx = 0; idx < net_def.op_size(); ++idx) {
+    for (const string& output : net_def.op(idx).output()) {
+      BlobWrites& blob_writes = writes[output];
+      if (blob_writes.count++ == 0) {
+        blob_writes.first_writer = idx;
+      }
+    }
+  }
+  return writes;
+}
+
+// Returns whether the operator does something besides computing its outputs,
+// such as writing to a file, freeing memory or taking part in a collective
+// communication, so that it must run even if nothing reads its outputs.
+// Operators without outputs run only for their side effects.
+bool HasSideEffects(const OperatorDef& op_def) {
+  static const std::set<string> kSideEffectTypes{
+      "Allreduce", "Broadcast", "Free", "Print", "PrintInt", "Save",
+      "Snapshot", "Summarize"};
+  return op_def.output_size() == 0 || kSideEffectTypes.count(op_def.type());
+}
+
+// Returns the blobs whose values must survive the network: its external
+// outputs, and the blobs that it reads before it writes them. The latter hold
+// state that is carried over from one run of the network to the next, such as
+// parameters that it updates. A network that declares no external outputs
+// may have any of its blobs read by other networks or by the caller, so all
+// of them persist.
+std::set<string> GetPersistentBlobs(const NetDef& net_def) {
+  std::set<string> persistent(net_def.external_output().begin(),
+                              net_def.external_output().end());
+  std::set<string> written;
+  for (const OperatorDef& op_def : net_def.op()) {
+    if (net_def.external_output_size() == 0) {
+      persistent.insert(op_def.output().begin(), op_def.output().end());
+    }
+    for (const string& input : op_def.input()) {
+      if (!written.count(input)) {
+        persistent.insert(input);
+      }
+    }
+    written.insert(op_def.output().begin(), op_def.output().end());
+  }
+  return persistent;
+}
+
+// Whether the blob holds a single value for all the operators from idx on,
+// i.e. it is either not written by the network, or written once before idx.
+bool HasSingleValueFrom(const CaffeMap<string, BlobWrites>& writes,
+                        const string& blob, const int idx) {
+  auto it = writes.find(blob);
+  return it == writes.end() ||
+      (it->second.count == 1 && it->second.first_writer < idx);
+}
+
+// Whether the blob is written by the given operator and no other.
+bool IsWrittenOnlyBy(const CaffeMap<string, BlobWrites>& writes,
+                     const string& blob, const int idx) {
+  auto it = writes.find(blob);
+  return it != writes.end() && it->second.count == 1 &&
+      it->second.first_writer == idx;
+}
+
+// Makes the operators from begin on read to instead of from.
+void RenameReads(const int begin, const string& from, const string& to,
+                 NetDef* net_def) {
+  for (int idx = begin; idx < net_def->op_size(); ++idx) {
+    for (string& input : *net_def->mutable_op(idx)->mutable_input()) {
+      if (input == from) {
+        input = to;
+      }
+    }
+  }
+}
+
+void RemoveOperators(const vector<bool>& removed, NetDef* net_def) {
+  NetDef original(*net_def);
+  net_def->clear_op();
+  for (int idx = 0; idx < original.op_size(); ++idx) {
+    if (!removed[idx]) {
+      *net_def->add_op() = original.op(idx);
+    }
+  }
+}
+
+string DescribeOperator(const NetDef& net_def, const int idx) {
+  std::stringstream description;
+  description << "operator " << idx << " (" << net_def.op(idx).type();
+  if (net_def.op(idx).name().size()) {
+    description << " " << net_def.op(idx).name();
+  }
+  description << ")";
+  return description.str();
+}
+
+// Removes the operators none of whose outputs are read later or persist.
+// Operators with side effects, such as Free or Summarize, are always kept.
+class DeadOperatorEliminationPass final : public NetOptimizationPass {
+ public:
+  bool Run(NetDef* net_def) override {
+    if (net_def->external_output_size() == 0) {
+      VLOG(1) << "Network " << net_def->name() << " declares no external "
+              << "outputs, skipping dead operator elimination.";
+      return false;
+    }
+    std::set<string> live = GetPersistentBlobs(*net_def);
+    vector<bool> removed(net_def->op_size(), false);
+    bool changed = false;
+    for (int idx = net_def->op_size() - 1; idx >= 0; --idx) {
+      const OperatorDef& op_def = net_def->op(idx);
+      bool needed = HasSideEffects(op_def);
+      for (const string& output : op_def.output()) {
+        needed |= live.count(output) > 0;
+      }
+      if (!needed) {
+        LOG(INFO) << "Dead operator elimination: removed "
+                  << DescribeOperator(*net_def, idx)
+                  << ", whose outputs are never read.";
+        removed[idx] = true;
+        changed = true;
+        continue;
+      }
+      for (const string& output : op_def.output()) {
+        live.erase(output);
+      }
+      live.insert(op_def.input().begin(), op_def.input().end());
+    }
+    RemoveOperators(removed, net_def);
+    return changed;
+  }
+};
+
+// Removes the operators that compute exactly what an earlier operator has
+// computed, and makes the readers of their outputs read the outputs of the
+// earlier operator instead. To keep this simple, an operator is only
+// considered if its inputs are not rewritten and its outputs are written by
+// nothing else.
+class CommonSubexpressionEliminationPass final : public NetOptimizationPass {
+ public:
+  bool Run(NetDef* net_def) override {
+    const CaffeMap<string, BlobWrites> writes = GetBlobWrites(*net_def);
+    const std::set<string> persistent = GetPersistentBlobs(*net_def);
+    // Maps an operator definition, without its name and outputs, to the first
+    // operator with that definition.
+    CaffeMap<string, int> first_ops;
+    vector<bool> removed(net_def->op_size(), false);
+    bool changed = false;
+    for (int idx = 0; idx < net_def->op_size(); ++idx) {
+      const OperatorDef& op_def = net_def->op(idx);
+      if (!IsCandidate(op_def, idx, writes)) {
+        continue;
+      }
+      OperatorDef key_def(op_def);
+      key_def.clear_name();
+      key_def.clear_output();
+      string key;
+      key_def.SerializeToString(&key);
+      if (!first_ops.count(key)) {
+        first_ops[key] = idx;
+        continue;
+      }
+      const int first_idx = first_ops[key];
+      const OperatorDef& first_def = net_def->op(first_idx);
+      bool outputs_persist = first_def.output_size() != op_def.output_size();
+      for (const string& output : op_def.output()) {
+        outputs_persist |= persistent.count(output) > 0;
+      }
+      if (outputs_persist) {
+        continue;
+      }
+      for (int i = 0; i < op_def.output_size(); ++i) {
+        RenameReads(idx + 1, op_def.output(i), first_def.output(i), net_def);
+      }
+      LOG(INFO) << "Common subexpression elimination: removed "
+                << DescribeOperator(*net_def, idx) << ", which computes the "
+                << "same as " << DescribeOperator(*net_def, first_idx) << ".";
+      removed[idx] = true;
+      changed = true;
+    }
+    RemoveOperators(removed, net_def);
+    return changed;
+  }
+
+ private:
+  bool IsCandidate(const OperatorDef& op_def, const int idx,
+                   const CaffeMap<string, BlobWrites>& writes) {
+    // Operators without inputs, such as fillers and data readers, and the
+    // operators below produce different outputs every time they run. The
+    // random fillers may read their shape from an input.
+    static const std::set<string> kNondeterministicTypes{
+        "Accumulate", "Dropout", "GaussianFill", "UniformFill", "XavierFill"};
+    if (op_def.input_size() == 0 || HasSideEffects(op_def) ||
+        kNondeterministicTypes.count(op_def.type())) {
+      return false;
+    }
+    for (const string& input : op_def.input()) {
+      if (!HasSingleValueFrom(writes, input, idx)) {
+        return false;
+      }
+    }
+    for (const string& output : op_def.output()) {
+      if (!IsWrittenOnlyBy(writes, output, idx)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// Folds away the operators that only make a blob available under other
+// names: Alias and Split, whose outputs share the data of their input, and
+// Flatten when it only feeds FC operators, which flatten their input
+// themselves. Flatten of a Flatten is also reduced to a single Flatten.
+class AliasFoldingPass final : public NetOptimizationPass {
+ public:
+  bool Run(NetDef* net_def) override {
+    const CaffeMap<string, BlobWrites> writes = GetBlobWrites(*net_def);
+    const std::set<string> persistent = GetPersistentBlobs(*net_def);
+    vector<bool> removed(net_def->op_size(), false);
+    bool changed = false;
+    for (int idx = 0; idx < net_def->op_size(); ++idx) {
+      OperatorDef* op_def = net_def->mutable_op(idx);
+      if (op_def->input_size() != 1 ||
+          !HasSingleValueFrom(writes, op_def->input(0), idx)) {
+        continue;
+      }
+      const string input = op_def->input(0);
+      if (op_def->type() == "Alias" || op_def->type() == "Split") {
+        vector<string> kept_outputs;
+        for (const string& output : op_def->output()) {
+          if (output == input) {
+            // An in-place alias does nothing.
+            continue;
+          }
+          if (persistent.count(output) ||
+              !IsWrittenOnlyBy(writes, output, idx)) {
+            kept_outputs.push_back(output);
+            continue;
+          }
+          RenameReads(idx + 1, output, input, net_def);
+          LOG(INFO) << "Alias folding: " << output << " of "
+                    << DescribeOperator(*net_def, idx) << " is replaced by "
+                    << input << ".";
+        }
+        if (kept_outputs.size() == op_def->output_size()) {
+          continue;
+        }
+        changed = true;
+        if (kept_outputs.empty()) {
+          removed[idx] = true;
+        } else {
+          op_def->clear_output();
+          for (const string& output : kept_outputs) {
+            op_def->add_output(output);
+          }
+        }
+      } else if (op_def->type() == "Flatten" && op_def->output_size() == 1) {
+        auto it = writes.find(input);
+        if (it != writes.end() && it->second.count == 1 &&
+            it->second.first_writer < idx &&
+            net_def->op(it->second.first_writer).type() == "Flatten") {
+          const string& original =
+              net_def->op(it->second.first_writer).input(0);
+          if (HasSingleValueFrom(writes, original, idx)) {
+            LOG(INFO) << "Alias folding: " << DescribeOperator(*net_def, idx)
+                      << " flattens " << original << " instead of the "
+                      << "flattened " << input << ".";
+            op_def->set_input(0, original);
+            changed = true;
+          }
+        }
+        const string& output = op_def->output(0);
+        if (output != op_def->input(0) && !persistent.count(output) &&
+            IsWrittenOnlyBy(writes, output, idx) &&
+            IsOnlyReadByFC(*net_def, idx, output)) {
+          LOG(INFO) << "Alias folding: removed "
+                    << DescribeOperator(*net_def, idx) << ", since only FC "
+                    << "operators read its output " << output << ".";
+          RenameReads(idx + 1, output, op_def->input(0), net_def);
+          removed[idx] = true;
+          changed = true;
+        }
+      }
+    }
+    RemoveOperators(removed, net_def);
+    return changed;
+  }
+
+ private:
+  // Whether the blob is only read by the operators after idx as the data
+  // input of FC operators.
+  bool IsOnlyReadByFC(const NetDef& net_def, const int idx,
+                      const string& blob) {
+    for (int reader = idx + 1; reader < net_def.op_size(); ++reader) {
+      const OperatorDef& op_def = net_def.op(reader);
+      for (int i = 0; i < op_def.input_size(); ++i) {
+        if (op_def.input(i) == blob &&
+            (i != 0 || (op_def.type() != "FC" && op_def.type() != "FCRelu"))) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+};
+
+REGISTER_NET_OPTIMIZATION_PASS(AliasFolding, AliasFoldingPass);
+REGISTER_NET_OPTIMIZATION_PASS(CommonSubexpressionElimination,
+                               CommonSubexpressionEliminationPass);
+REGISTER_NET_OPTIMIZATION_PASS(DeadOperatorElimination,
+                               DeadOperatorEliminationPass);
+
+}  // namespace
+
+NetDef OptimizeNet(const NetDef& net_def, int optimization_level) {
+  NetDef optimized_net_def(net_def);
+  vector<unique_ptr<NetOptimizationPass> > passes;
+  for (const string& name : NetOptimizationPassRegistry()->Keys()) {
+    passes.emplace_back(NetOptimizationPassRegistry()->Create(name));
+    if (passes.back()->level() > optimization_level) {
+      passes.pop_back();
+    }
+  }
+  for (int round = 0; round < kMaxOptimizationRounds; ++round) {
+    bool changed = false;
+    for (auto& pass : passes) {
+      changed |= pass->Run(&optimized_net_def);
+    }
+    if (!changed) {
+      break;
+    }
+  }
+  LOG(INFO) << "Optimized network " << net_def.name() << " from "
+            << net_def.op_size() << " to " << optimized_net_def.op_size()
+            << " operators.";
+  return optimized_net_def;
+}
+
+}  // namespace caffe2
@@ -0,0 +1,40 @@
+#ifndef CAFFE2_CORE_NET_OPTIMIZER_H_
+#define CAFFE2_CORE_NET_OPTIMIZER_H_
+
+#include "caffe2/core/common.h"
+#include "caffe2/core/registry.h"
+#include "caffe2/proto/caffe2.pb.h"
+
+namespace caffe2 {
+
+// A NetOptimizationPass rewrites a network into an equivalent one that is
+// cheaper to run. Like memory planning, the passes assume that the only blobs
+// read after the network runs are its external outputs, and that the network
+// runs its operators in order.
+class NetOptimizationPass {
+ public:
+  NetOptimizationPass() {}
+  virtual ~NetOptimizationPass() {}
+
+  // The lowest optimization level at which the pass runs.
+  virtual int level() const { return 1; }
+  // Rewrites the network in place, logging the changes it makes. Returns
+  // whether it changed anything.
+  virtual bool Run(NetDef* net_def) = 0;
+
+  DISABLE_COPY_AND_ASSIGN(NetOptimizationPass);
+};
+
+DECLARE_REGISTRY(NetOptimizationPassRegistry, NetOptimizationPass);
+#define REGISTER_NET_OPTIMIZATION_PASS(name, ...) \
+  REGISTER_CLASS(NetOptimizationPassRegistry, name, __VA_ARGS__)
+
+// Runs the registered passes of the given level or lower on a copy of the
+// network, and returns it. The passes run in the order of their names, and
+// since one pass may open up opportunities for another, the whole sequence is
+// repeated until nothing changes.
+NetDef OptimizeNet(const NetDef& net_def, int optimization_level);
+
+}  // namespace caffe2
+
+#endif  // CAFFE2_CORE_NET_OPTIMIZER_H_
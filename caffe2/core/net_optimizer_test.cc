@@ -0,0 +1,161 @@
+#include "caffe2/core/net_optimizer.h"
+#include "caffe2/core/workspace.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+namespace caffe2 {
+
+namespace {
+NetDef ParseNetDef(const char* net_def_string) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(net_def_string), &net_def));
+  return net_def;
+}
+
+// Returns the types of the operators of the network, separated by spaces.
+string OperatorTypes(const NetDef& net_def) {
+  string types;
+  for (const OperatorDef& op_def : net_def.op()) {
+    types += (types.size() ? " " : "") + op_def.type();
+  }
+  return types;
+}
+}  // namespace
+
+TEST(NetOptimizerTest, TestDeadOperatorElimination) {
+  NetDef net_def = ParseNetDef(
+      "  name: \"dead\""
+      "  op { input: \"data\" output: \"a\" type: \"Foo\" }"
+      "  op { input: \"a\" output: \"unused\" type: \"Bar\" }"
+      "  op { input: \"unused\" output: \"unused2\" type: \"Bar\" }"
+      "  op { input: \"a\" output: \"out\" type: \"Baz\" }"
+      "  op { input: \"out\" type: \"Print\" }"
+      // The parameter is read before it is updated, so the update persists.
+      "  op { input: \"param\" output: \"c\" type: \"Foo\" }"
+      "  op { input: \"param\" input: \"c\" output: \"param\" type: \"Update\" }"
+      "  external_output: \"out\"");
+  NetDef optimized_net_def = OptimizeNet(net_def, 1);
+  EXPECT_EQ(OperatorTypes(optimized_net_def), "Foo Baz Print Foo Update");
+  // Without declared external outputs, everything would be dead, so the pass
+  // does nothing.
+  net_def.clear_external_output();
+  EXPECT_EQ(OptimizeNet(net_def, 1).op_size(), net_def.op_size());
+}
+
+TEST(NetOptimizerTest, TestDeadOperatorEliminationKeepsSideEffects) {
+  NetDef net_def = ParseNetDef(
+      "  name: \"side_effects\""
+      "  op { input: \"data\" output: \"a\" type: \"Foo\" }"
+      "  op { input: \"a\" output: \"summary\" type: \"Summarize\""
+      "       arg { name: \"to_file\" i: 1 } }"
+      "  op { input: \"a\" output: \"a\" type: \"Free\" }"
+      "  op { input: \"data\" output: \"out\" type: \"Baz\" }"
+      "  external_output: \"out\"");
+  NetDef optimized_net_def = OptimizeNet(net_def, 1);
+  EXPECT_EQ(OperatorTypes(optimized_net_def), "Foo Summarize Free Baz");
+}
+
+TEST(NetOptimizerTest, TestCommonSubexpressionElimination) {
+  NetDef net_def = ParseNetDef(
+      "  name: \"cse\""
+      "  op { input: \"data\" output: \"a\" type: \"Foo\" }"
+      "  op { input: \"data\" output: \"b\" type: \"Foo\" name: \"other\" }"
+      "  op { input: \"data\" output: \"c\" type: \"Foo\""
+      "       arg { name: \"x\" i: 1 } }"
+      "  op { input: \"data\" output: \"d\" type: \"Dropout\" }"
+      "  op { input: \"data\" output: \"e\" type: \"Dropout\" }"
+      "  op { input: \"a\" input: \"b\" input: \"c\" input: \"d\" input: \"e\""
+      "       output: \"out\" type: \"Sum\" }"
+      "  external_output: \"out\"");
+  NetDef optimized_net_def = OptimizeNet(net_def, 1);
+  // The second Foo is a duplicate, but the one with a different argument and
+  // the random Dropouts are not.
+  EXPECT_EQ(OperatorTypes(optimized_net_def), "Foo Foo Dropout Dropout Sum");
+  const OperatorDef& sum_def = optimized_net_def.op(4);
+  EXPECT_EQ(sum_def.input(0), "a");
+  EXPECT_EQ(sum_def.input(1), "a");
+  EXPECT_EQ(sum_def.input(2), "c");
+}
+
+TEST(NetOptimizerTest, TestCommonSubexpressionEliminationKeepsRandomFills) {
+  NetDef net_def = ParseNetDef(
+      "  name: \"random_fills\""
+      "  op { input: \"x\" output: \"w1\" type: \"GaussianFill\" }"
+      "  op { input: \"x\" output: \"w2\" type: \"GaussianFill\" }"
+      "  op { input: \"w1\" input: \"w2\" output: \"out\" type: \"Sum\" }"
+      "  external_output: \"out\"");
+  // The two parameters must be initialized independently.
+  EXPECT_EQ(OperatorTypes(OptimizeNet(net_def, 1)),
+            "GaussianFill GaussianFill Sum");
+}
+
+TEST(NetOptimizerTest, TestNoExternalOutputsKeepsAllBlobs) {
+  NetDef net_def = ParseNetDef(
+      "  name: \"no_external_outputs\""
+      "  op { input: \"data\" output: \"a\" type: \"Foo\" }"
+      "  op { input: \"data\" output: \"b\" type: \"Foo\" }"
+      "  op { input: \"a\" output: \"alias\" type: \"Alias\" }"
+      "  op { input: \"alias\" output: \"s1\" output: \"s2\""
+      "       type: \"Split\" }"
+      "  op { input: \"s1\" output: \"flat\" type: \"Flatten\" }"
+      "  op { input: \"flat\" input: \"w\" input: \"bias\" output: \"fc\""
+      "       type: \"FC\" }");
+  // Other networks may read any of the blobs, so none of them is removed.
+  NetDef optimized_net_def = OptimizeNet(net_def, 1);
+  EXPECT_EQ(OperatorTypes(optimized_net_def), OperatorTypes(net_def));
+  for (int idx = 0; idx < net_def.op_size(); ++idx) {
+    EXPECT_EQ(optimized_net_def.op(idx).DebugString(),
+              net_def.op(idx).DebugString());
+  }
+}
+
+TEST(NetOptimizerTest, TestAliasFolding) {
+  NetDef net_def = ParseNetDef(
+      "  name: \"alias\""
+      "  op { input: \"data\" output: \"a\" type: \"Foo\" }"
+      "  op { input: \"a\" output: \"alias\" type: \"Alias\" }"
+      "  op { input: \"alias\" output: \"s1\" output: \"s2\""
+      "       type: \"Split\" }"
+      "  op { input: \"s1\" output: \"f1\" type: \"Flatten\" }"
+      "  op { input: \"f1\" output: \"f2\" type: \"Flatten\" }"
+      "  op { input: \"f2\" output: \"conv\" type: \"Conv\" }"
+      "  op { input: \"s2\" output: \"flat\" type: \"Flatten\" }"
+      "  op { input: \"flat\" input: \"w\" input: \"b\" output: \"fc\""
+      "       type: \"FC\" }"
+      "  external_output: \"conv\""
+      "  external_output: \"fc\"");
+  NetDef optimized_net_def = OptimizeNet(net_def, 1);
+  // The aliases are gone, the Flatten chain is a single Flatten, and the
+  // Flatten before the FC is gone.
+  EXPECT_EQ(OperatorTypes(optimized_net_def), "Foo Flatten Conv FC");
+  EXPECT_EQ(optimized_net_def.op(1).input(0), "a");
+  EXPECT_EQ(optimized_net_def.op(2).input(0), optimized_net_def.op(1).output(0));
+  EXPECT_EQ(optimized_net_def.op(3).input(0), "a");
+}
+
+TEST(NetOptimizerTest, TestOptimizationLevel) {
+  NetDef net_def = ParseNetDef(
+      "  name: \"level\""
+      "  op { input: \"data\" output: \"out\" type: \"Foo\" }"
+      "  op { input: \"data\" output: \"unused\" type: \"Foo\" }"
+      "  external_output: \"out\"");
+  EXPECT_EQ(OptimizeNet(net_def, 0).op_size(), 2);
+  EXPECT_EQ(OptimizeNet(net_def, 1).op_size(), 1);
+  // The workspace optimizes the network before it creates it. The dead
+  // operator is of a type that does not exist, so the creation would fail
+  // otherwise.
+  net_def.mutable_op(1)->set_type("NonExistingOperator");
+  net_def.mutable_op(0)->set_type("NonExistingOperator");
+  net_def.mutable_op(0)->clear_output();
+  net_def.mutable_op(0)->add_output("also_unused");
+  net_def.set_optimization_level(1);
+  net_def.clear_external_output();
+  net_def.add_external_output("data");
+  Workspace ws;
+  ws.CreateBlob("data");
+  EXPECT_TRUE(ws.CreateNet(net_def));
+  EXPECT_TRUE(ws.RunNet("level"));
+}
+
+}  // namespace caffe2
@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "caffe2/core/net_profiler.h"
+#include "caffe2/utils/proto_utils.h"
+#include "glog/logging.h"
+
+namespace caffe2 {
+
+void RunTimeStats::Add(float ms) {
+  ++count_;
+  total_ms_ += ms;
+  if (samples_.size() < kMaxSamples) {
+    samples_.push_back(ms);
+  } else {
+    // Reservoir sampling: the new run time replaces a random sample with
+    // probability kMaxSamples / count_, which keeps the samples uniform.
+    std::uniform_int_distribution<int64_t> dist(0, count_ - 1);
+    int64_t idx = dist(random_generator_);
+    if (idx < kMaxSamples) {
+      samples_[idx] = ms;
+    }
+  }
+}
+
+void RunTimeStats::ToProfile(OperatorProfile* profile) const {
+  profile->set_count(count_);
+  profile->set_total_ms(total_ms_);
+  if (count_ == 0) {
+    return;
+  }
+  profile->set_mean_ms(total_ms_ / count_);
+  vector<float> sorted_samples(samples_);
+  std::sort(sorted_samples.begin(), sorted_samples.end());
+  const int last = sorted_samples.size() - 1;
+  profile->set_p50_ms(sorted_samples[static_cast<int>(last * 0.5 + 0.5)]);
+  profile->set_p99_ms(sorted_samples[static_cast<int>(last * 0.99 + 0.5)]);
+}
+
+NetProfiler::NetProfiler(const NetDef& net_def)
+    : operator_stats_(net_def.op_size()) {
+  profile_template_.set_name(net_def.name());
+  profile_template_.mutable_net()->set_name(net_def.name());
+  profile_template_.mutable_net()->set_type("net");
+  for (const OperatorDef& op_def : net_def.op()) {
+    OperatorProfile* op_profile = profile_template_.add_op();
+    op_profile->set_name(op_def.name());
+    op_profile->set_type(op_def.type());
+  }
+}
+
+void NetProfiler::Reset() {
+  net_stats_ = RunTimeStats();
+  operator_stats_.assign(operator_stats_.size(), RunTimeStats());
+}
+
+NetProfile NetProfiler::GetProfile() const {
+  NetProfile profile(profile_template_);
+  net_stats_.ToProfile(profile.mutable_net());
+  for (int idx = 0; idx < operator_stats_.size(); ++idx) {
+    operator_stats_[idx].ToProfile(profile.mutable_op(idx));
+  }
+  return profile;
+}
+
+namespace {
+void WriteCSVLine(const OperatorProfile& profile, std::ostream* out) {
+  *out << profile.name() << "," << profile.type() << "," << profile.count()
+       << "," << profile.total_ms() << "," << profile.mean_ms() << ","
+       << profile.p50_ms() << "," << profile.p99_ms() << "\n";
+}
+}  // namespace
+
+string NetProfileToCSV(const NetProfile& profile) {
+  std::stringstream out;
+  out << "name,type,count,total_ms,mean_ms,p50_ms,p99_ms\n";
+  WriteCSVLine(profile.net(), &out);
+  for (const OperatorProfile& op_profile : profile.op()) {
+    WriteCSVLine(op_profile, &out);
+  }
+  return out.str();
+}
+
+void WriteNetProfile(const NetProfile& profile, const string& filename) {
+  const string csv_suffix = ".csv";
+  if (filename.size() >= csv_suffix.size() &&
+      filename.compare(filename.size() - csv_suffix.size(), csv_suffix.size(),
+                       csv_suffix) == 0) {
+    std::ofstream out(filename);
+    CHECK(out.good()) << "Cannot open " << filename << " for writing.";
+    out << NetProfileToCSV(profile);
+  } else {
+    WriteProtoToTextFile(profile, filename);
+  }
+}
+
+}  // namespace caffe2
@@ -0,0 +1,83 @@
+#ifndef CAFFE2_CORE_NET_PROFILER_H_
+#define CAFFE2_CORE_NET_PROFILER_H_
+
+#include <chrono>  // NOLINT
+#include <cstdint>
+#include <random>
+
+#include "caffe2/core/common.h"
+#include "caffe2/proto/caffe2.pb.h"
+
+namespace caffe2 {
+
+// A simple wall-clock timer.
+class Timer {
+ public:
+  Timer() { Start(); }
+  inline void Start() { start_time_ = clock::now(); }
+  // Returns the milliseconds elapsed since the last Start().
+  inline float MilliSeconds() const {
+    return std::chrono::duration<float, std::milli>(
+        clock::now() - start_time_).count();
+  }
+
+ private:
+  typedef std::chrono::steady_clock clock;
+  clock::time_point start_time_;
+};
+
+// RunTimeStats accumulates the run times of one thing, such as an operator,
+// over many runs. The count and the mean are exact, while the percentiles are
+// computed from a uniform sample of at most kMaxSamples run times, so the
+// memory stays bounded no matter how many times it runs.
+class RunTimeStats {
+ public:
+  RunTimeStats() : count_(0), total_ms_(0), random_generator_(0) {}
+  void Add(float ms);
+  // Fills in the statistics fields of the given profile.
+  void ToProfile(OperatorProfile* profile) const;
+
+  static const int kMaxSamples = 10000;
+
+ private:
+  int64_t count_;
+  double total_ms_;
+  vector<float> samples_;
+  std::mt19937 random_generator_;
+};
+
+// NetProfiler collects the run times of a network and of each of its
+// operators, which are identified by their index in the NetDef. Different
+// operators may be reported from different threads at the same time, but a
+// single operator must not be reported concurrently, which holds as long as a
+// network is not run concurrently with itself.
+class NetProfiler {
+ public:
+  explicit NetProfiler(const NetDef& net_def);
+  inline void AddOperatorTime(int idx, float ms) {
+    operator_stats_[idx].Add(ms);
+  }
+  inline void AddNetTime(float ms) { net_stats_.Add(ms); }
+  NetProfile GetProfile() const;
+  // Drops the run times collected so far, e.g. those of warmup runs. Must not
+  // be called while the network runs.
+  void Reset();
+
+ private:
+  NetProfile profile_template_;
+  RunTimeStats net_stats_;
+  vector<RunTimeStats> operator_stats_;
+
+  DISABLE_COPY_AND_ASSIGN(NetProfiler);
+};
+
+// Writes the profile as CSV, with one line per operator keyed by its name and
+// type, and a first line for the whole network.
+string NetProfileToCSV(const NetProfile& profile);
+// Writes the profile to the given file, as CSV if the file name ends with
+// ".csv", and as a text proto otherwise.
+void WriteNetProfile(const NetProfile& profile, const string& filename);
+
+}  // namespace caffe2
+
+#endif  // CAFFE2_CORE_NET_PROFILER_H_
@@ -87,6 +87,22 @@ bool OperatorBase::Verify() {
   return true;
 }
 
+bool OperatorBase::OutputHasOwnStorage(int idx) const {
+  return !OutputSharesInputStorage(operator_def_.type(), idx);
+}
+
+CaffeMap<string, std::set<int> >* SharedStorageOutputs() {
+  static CaffeMap<string, std::set<int> >* shared_storage_outputs =
+      new CaffeMap<string, std::set<int> >();
+  return shared_storage_outputs;
+}
+
+bool OutputSharesInputStorage(const string& type, int idx) {
+  auto it = SharedStorageOutputs()->find(type);
+  return it != SharedStorageOutputs()->end() &&
+         (it->second.empty() || it->second.count(idx));
+}
+
 OperatorBase* CreateOperator(const OperatorDef& operator_def, Workspace* ws) {
   const string& key = operator_def.type();
   switch (operator_def.device_option().device_type()) {
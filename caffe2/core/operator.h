@@ -3,6 +3,8 @@
 
 #include <climits>
 #include <cstddef>
+#include <cstdint>
+#include <set>
 #include <typeinfo>
 #include <vector>
 
@@ -15,6 +17,41 @@
 
 namespace caffe2 {
 
+// TensorShape is the shape and data type of a tensor that an operator will
+// produce, as computed by static shape inference before the network runs (see
+// caffe2/core/shape_inference.h).
+struct TensorShape {
+  TensorShape() : data_type(TensorProto::FLOAT) {}
+  TensorShape(const vector<int>& dims,
+              TensorProto::DataType data_type = TensorProto::FLOAT)
+      : dims(dims), data_type(data_type) {}
+
+  inline int size() const {
+    int size = 1;
+    for (int d : dims) {
+      size *= d;
+    }
+    return size;
+  }
+  // The number of bytes the content of the tensor takes, or 0 if it is not
+  // known from the shape alone, as for strings.
+  inline int64_t nbytes() const {
+    switch (data_type) {
+    case TensorProto::FLOAT:
+      return static_cast<int64_t>(size()) * sizeof(float);
+    case TensorProto::INT32:
+      return static_cast<int64_t>(size()) * sizeof(int);
+    case TensorProto::BYTE:
+      return size();
+    default:
+      return 0;
+    }
+  }
+
+  vector<int> dims;
+  TensorProto::DataType data_type;
+};
+
 class OperatorBase {
  public:
   // The constructor of the operator. Note that you should not do any
@@ -91,6 +128,25 @@ class OperatorBase {
 
   virtual bool Run() { NOT_IMPLEMENTED; return false; }
 
+  // Static shape inference. Given the shapes of the inputs, an operator that
+  // supports it fills in the shapes its outputs will have once it runs, and
+  // returns true. The default returns false, meaning that the output shapes
+  // cannot be known before running.
+  virtual bool InferOutputShapes(const vector<TensorShape>& input_shapes,
+                                 vector<TensorShape>* output_shapes) {
+    return false;
+  }
+  // Whether the idx-th output gets storage of its own when the operator runs.
+  // Outputs that share the data of an input instead, like the one of Alias,
+  // return false so that they are not preallocated. This is decided by
+  // REGISTER_SHARED_STORAGE_OUTPUTS below, which the memory planner reads too.
+  bool OutputHasOwnStorage(int idx) const;
+  // Allocates the storage of the idx-th output with the given shape ahead of
+  // the first run. Returns false if the operator does not know how to.
+  virtual bool PreallocateOutput(int idx, const TensorShape& shape) {
+    return false;
+  }
+
   inline const OperatorDef& def() { return operator_def_; }
 
  protected:
@@ -127,6 +183,17 @@ class OperatorBase {
   int MinOutput() override { return min_output; }                              \
   int MaxOutput() override { return max_output; }
 
+// OUTPUT_SHAPES_LIKE_INPUT makes static shape inference give all the outputs
+// the shape and data type of the first input, as is the case for elementwise
+// operators.
+#define OUTPUT_SHAPES_LIKE_INPUT                                               \
+ public:                                                                       \
+  bool InferOutputShapes(const vector<TensorShape>& input_shapes,              \
+                         vector<TensorShape>* output_shapes) override {        \
+    output_shapes->assign(OperatorBase::OutputSize(), input_shapes[0]);        \
+    return true;                                                               \
+  }
+
 // INPUT_TAGS and OUTPUT_TAGS are optional features to name the indices of the
 // operator's inputs and outputs, in order to avoid confusion. For example, for
 // a fully convolution layer that has input, weight and bias, you can define its
@@ -179,7 +246,30 @@ class Operator : public OperatorBase {
 
   virtual bool RunOnDevice() = 0;
 
+  // Preallocates float and int outputs as tensors of the operator's context.
+  // Operators with outputs of any other kind should override this.
+  bool PreallocateOutput(int idx, const TensorShape& shape) override {
+    switch (shape.data_type) {
+    case TensorProto::FLOAT:
+      return PreallocateTensorOutput<float>(idx, shape);
+    case TensorProto::INT32:
+      return PreallocateTensorOutput<int>(idx, shape);
+    default:
+      return false;
+    }
+  }
+
  protected:
+  template <typename T>
+  bool PreallocateTensorOutput(int idx, const TensorShape& shape) {
+    device_context_.SwitchToDevice();
+    auto* output =
+        OperatorBase::template Output<Tensor<T, DeviceContext> >(idx);
+    output->Reshape(shape.dims);
+    output->mutable_data();
+    return true;
+  }
+
   DeviceContext device_context_;
   DISABLE_COPY_AND_ASSIGN(Operator);
 };
@@ -228,6 +318,32 @@ DECLARE_REGISTRY(CUDNNOperatorRegistry, OperatorBase,
 #define REGISTER_CUDNN_OPERATOR(name, ...) \
   REGISTER_CLASS(CUDNNOperatorRegistry, name, __VA_ARGS__)
 
+// The outputs that share the data of an input instead of getting storage of
+// their own, by operator type, where an empty set stands for all the outputs.
+// An operator that calls ShareData() on an output must register it with
+// REGISTER_SHARED_STORAGE_OUTPUTS(type, output indices...), or with no indices
+// if all its outputs do, so that neither preallocation (see
+// OperatorBase::OutputHasOwnStorage()) nor memory planning (see
+// caffe2/core/memory_planner.h) gives the output storage of its own.
+CaffeMap<string, std::set<int> >* SharedStorageOutputs();
+// Whether the idx-th output of operators of the given type shares the data of
+// an input.
+bool OutputSharesInputStorage(const string& type, int idx);
+
+class SharedStorageOutputsRegisterer {
+ public:
+  SharedStorageOutputsRegisterer(const string& type,
+                                 const vector<int>& outputs) {
+    (*SharedStorageOutputs())[type].insert(outputs.begin(), outputs.end());
+  }
+};
+
+#define REGISTER_SHARED_STORAGE_OUTPUTS(name, ...)                           \
+  namespace {                                                                \
+  SharedStorageOutputsRegisterer g_SharedStorageOutputs_##name(              \
+      #name, vector<int>{__VA_ARGS__});                                      \
+  }  // namespace
+
 // Creates an operator with the given operator definition.
 OperatorBase* CreateOperator(const OperatorDef& operator_def, Workspace* ws);
 
@@ -28,6 +28,22 @@ TEST(OperatorTest, RegistryWorks) {
   CPUOperatorRegistry()->TEST_PrintRegisteredNames();
 }
 
+REGISTER_SHARED_STORAGE_OUTPUTS(JustTest, 1);
+
+TEST(OperatorTest, TestOutputHasOwnStorage) {
+  OperatorDef op_def;
+  Workspace ws;
+  op_def.set_type("JustTest");
+  op_def.add_output("own");
+  op_def.add_output("shared");
+  unique_ptr<OperatorBase> op(CreateOperator(op_def, &ws));
+  EXPECT_TRUE(op->OutputHasOwnStorage(0));
+  EXPECT_FALSE(op->OutputHasOwnStorage(1));
+  EXPECT_FALSE(OutputSharesInputStorage("JustTest", 0));
+  EXPECT_TRUE(OutputSharesInputStorage("JustTest", 1));
+  EXPECT_FALSE(OutputSharesInputStorage("NonExistingOperator", 0));
+}
+
 TEST(OperatorDeathTest, CannotUseUninitializedBlob) {
   Workspace ws;
   OperatorDef op_def;
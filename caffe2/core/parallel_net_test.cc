@@ -44,9 +44,59 @@ class SleepOp final : public OperatorBase {
   DISABLE_COPY_AND_ASSIGN(SleepOp);
 };
 
+// FailOp always fails, to test error handling.
+class FailOp final : public OperatorBase {
+ public:
+  FailOp(const OperatorDef& operator_def, Workspace* ws)
+      : OperatorBase(operator_def, ws) {}
+
+  bool Run() final { return false; }
+
+ private:
+  INPUT_OUTPUT_STATS(0, INT_MAX, 0, INT_MAX);
+  DISABLE_COPY_AND_ASSIGN(FailOp);
+};
+
+// CountOp outputs the number of times it has run before, as an int.
+class CountOp final : public OperatorBase {
+ public:
+  CountOp(const OperatorDef& operator_def, Workspace* ws)
+      : OperatorBase(operator_def, ws), count_(0) {}
+
+  bool Run() final {
+    *OperatorBase::Output<int>(0) = count_++;
+    return true;
+  }
+
+ private:
+  int count_;
+  INPUT_OUTPUT_STATS(0, 0, 1, 1);
+  DISABLE_COPY_AND_ASSIGN(CountOp);
+};
+
+// CollectOp appends its int input to its vector<int> output.
+class CollectOp final : public OperatorBase {
+ public:
+  CollectOp(const OperatorDef& operator_def, Workspace* ws)
+      : OperatorBase(operator_def, ws) {}
+
+  bool Run() final {
+    OperatorBase::Output<vector<int> >(0)->push_back(
+        OperatorBase::Input<int>(0));
+    return true;
+  }
+
+ private:
+  INPUT_OUTPUT_STATS(1, 1, 1, 1);
+  DISABLE_COPY_AND_ASSIGN(CollectOp);
+};
+
 namespace {
 REGISTER_CPU_OPERATOR(Sleep, SleepOp)
 REGISTER_CUDA_OPERATOR(Sleep, SleepOp)
+REGISTER_CPU_OPERATOR(Fail, FailOp)
+REGISTER_CPU_OPERATOR(Count, CountOp)
+REGISTER_CPU_OPERATOR(Collect, CollectOp)
 }  // namespace
 
 const char kSleepNetDefString[] =
@@ -104,6 +154,145 @@ TEST(ParallelNetTest, TestParallelNetTiming) {
   EXPECT_LT(milliseconds, 220);
 }
 
+// num_workers caps the number of operators of a parallel net that run at the
+// same time, even though the shared executor has more threads.
+TEST(ParallelNetTest, TestNumWorkersCapsConcurrency) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kSleepNetDefString), &net_def));
+  net_def.set_num_workers(1);
+  Workspace ws;
+  unique_ptr<NetBase> net(CreateNet(net_def, &ws));
+  EXPECT_NE(nullptr, net.get());
+  EXPECT_TRUE(net->Verify());
+  auto start_time = std::chrono::system_clock::now();
+  EXPECT_TRUE(net->Run());
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now() - start_time);
+  int milliseconds = duration.count();
+  // All three operators run one after the other, which takes 350 ms.
+  EXPECT_GT(milliseconds, 330);
+  EXPECT_LT(milliseconds, 400);
+}
+
+// Many parallel nets share the executor, and each of them runs correctly.
+TEST(ParallelNetTest, TestManyNetsShareExecutor) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kSleepNetDefString), &net_def));
+  for (int i = 0; i < 3; ++i) {
+    net_def.mutable_op(i)->mutable_arg(0)->set_i(1);
+  }
+  Workspace ws;
+  vector<unique_ptr<NetBase> > nets;
+  for (int i = 0; i < 50; ++i) {
+    nets.emplace_back(CreateNet(net_def, &ws));
+    EXPECT_TRUE(nets.back()->Verify());
+  }
+  for (int run = 0; run < 2; ++run) {
+    for (auto& net : nets) {
+      EXPECT_TRUE(net->Run());
+    }
+  }
+}
+
+// Two chains of three short operators, listed first, and a single long
+// operator. With 2 workers, running the short chains first takes 90 + 150 ms,
+// while starting the long operator right away takes 150 ms on one worker, and
+// 180 ms for the short chains on the other.
+const char kAsymmetricNetDefString[] =
+"  name: \"asymmetric\""
+"  net_type: \"parallel\""
+"  num_workers: 2"
+"  critical_path_scheduling: true"
+"  op { output: \"a1\" type: \"Sleep\" arg { name: \"ms\" i: 30 } }"
+"  op { input: \"a1\" output: \"a2\" type: \"Sleep\""
+"       arg { name: \"ms\" i: 30 } }"
+"  op { input: \"a2\" output: \"a3\" type: \"Sleep\""
+"       arg { name: \"ms\" i: 30 } }"
+"  op { output: \"b1\" type: \"Sleep\" arg { name: \"ms\" i: 30 } }"
+"  op { input: \"b1\" output: \"b2\" type: \"Sleep\""
+"       arg { name: \"ms\" i: 30 } }"
+"  op { input: \"b2\" output: \"b3\" type: \"Sleep\""
+"       arg { name: \"ms\" i: 30 } }"
+"  op { output: \"long\" type: \"Sleep\" arg { name: \"ms\" i: 150 } }";
+
+int RunTimeMilliSeconds(NetBase* net) {
+  auto start_time = std::chrono::system_clock::now();
+  EXPECT_TRUE(net->Run());
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now() - start_time);
+  return duration.count();
+}
+
+TEST(ParallelNetTest, TestCriticalPathSchedulingMeasuresCosts) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kAsymmetricNetDefString), &net_def));
+  Workspace ws;
+  unique_ptr<NetBase> net(CreateNet(net_def, &ws));
+  EXPECT_TRUE(net->Verify());
+  // Before any costs are measured, the longer chains of operators go first,
+  // so the long operator starts late.
+  int milliseconds = RunTimeMilliSeconds(net.get());
+  EXPECT_GT(milliseconds, 200);
+  EXPECT_LT(milliseconds, 270);
+  // Once they are, the long operator starts right away.
+  for (int i = 0; i < 2; ++i) {
+    milliseconds = RunTimeMilliSeconds(net.get());
+    EXPECT_GT(milliseconds, 170);
+    EXPECT_LT(milliseconds, 195);
+  }
+}
+
+TEST(ParallelNetTest, TestCriticalPathSchedulingUsesCostArguments) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kAsymmetricNetDefString), &net_def));
+  for (OperatorDef& op_def : *net_def.mutable_op()) {
+    Argument* arg = op_def.add_arg();
+    arg->set_name("cost");
+    arg->set_f(op_def.arg(0).i());
+  }
+  Workspace ws;
+  unique_ptr<NetBase> net(CreateNet(net_def, &ws));
+  EXPECT_TRUE(net->Verify());
+  int milliseconds = RunTimeMilliSeconds(net.get());
+  EXPECT_GT(milliseconds, 170);
+  EXPECT_LT(milliseconds, 195);
+  // Without critical path scheduling, the operators run in the order they
+  // become ready.
+  net_def.set_critical_path_scheduling(false);
+  net.reset(CreateNet(net_def, &ws));
+  EXPECT_TRUE(net->Verify());
+  milliseconds = RunTimeMilliSeconds(net.get());
+  EXPECT_GT(milliseconds, 230);
+  EXPECT_LT(milliseconds, 270);
+}
+
+// The work-stealing net should give the same timing as the parallel net.
+TEST(WorkStealingNetTest, TestWorkStealingNetTiming) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kSleepNetDefString), &net_def));
+  net_def.set_net_type("dag_ws");
+  Workspace ws;
+  unique_ptr<NetBase> net(CreateNet(net_def, &ws));
+  EXPECT_NE(nullptr, net.get());
+  EXPECT_TRUE(net->Verify());
+  // Run twice to make sure that the workers are properly reset between runs.
+  for (int i = 0; i < 2; ++i) {
+    auto start_time = std::chrono::system_clock::now();
+    EXPECT_TRUE(net->Run());
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now() - start_time);
+    int milliseconds = duration.count();
+    // We should be seeing 200 ms. This adds a little slack time.
+    EXPECT_GT(milliseconds, 180);
+    EXPECT_LT(milliseconds, 220);
+  }
+}
+
 // For sanity check, we also test the sequential time - it should take 0.35
 // seconds instead since everything has to be sequential.
 TEST(SimpleNetTest, TestSimpleNetTiming) {
@@ -128,7 +317,347 @@ TEST(SimpleNetTest, TestSimpleNetTiming) {
 }
 
 
-}  // namespace caffe2
+TEST(ProfileNetTest, TestProfileParallelNet) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kSleepNetDefString), &net_def));
+  net_def.set_net_type("profile");
+  net_def.set_profiled_net_type("parallel");
+  Workspace ws;
+  EXPECT_TRUE(ws.CreateNet(net_def));
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(ws.RunNet("sleepnet"));
+  }
+  ProfileNet* net = dynamic_cast<ProfileNet*>(ws.GetNet("sleepnet"));
+  ASSERT_NE(net, nullptr);
+  NetProfile profile = net->GetProfile();
+  EXPECT_EQ(profile.name(), "sleepnet");
+  EXPECT_EQ(profile.net().count(), 3);
+  EXPECT_GT(profile.net().mean_ms(), 180);
+  EXPECT_LT(profile.net().mean_ms(), 220);
+  ASSERT_EQ(profile.op_size(), 3);
+  const float expected_ms[] = {100, 100, 150};
+  for (int i = 0; i < 3; ++i) {
+    const OperatorProfile& op_profile = profile.op(i);
+    EXPECT_EQ(op_profile.name(), net_def.op(i).name());
+    EXPECT_EQ(op_profile.type(), "Sleep");
+    EXPECT_EQ(op_profile.count(), 3);
+    EXPECT_GT(op_profile.mean_ms(), expected_ms[i] - 5);
+    EXPECT_LT(op_profile.mean_ms(), expected_ms[i] + 15);
+    EXPECT_GE(op_profile.p99_ms(), op_profile.p50_ms());
+  }
+  string csv = NetProfileToCSV(profile);
+  EXPECT_EQ(csv.find("name,type,count,total_ms,mean_ms,p50_ms,p99_ms\n"), 0);
+  EXPECT_NE(csv.find("\nsleep3,Sleep,3,"), string::npos);
+}
+
+TEST(ProfileNetTest, TestResetProfile) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kSleepNetDefString), &net_def));
+  net_def.set_net_type("profile");
+  Workspace ws;
+  EXPECT_TRUE(ws.CreateNet(net_def));
+  EXPECT_TRUE(ws.RunNet("sleepnet"));
+  ProfileNet* net = dynamic_cast<ProfileNet*>(ws.GetNet("sleepnet"));
+  ASSERT_NE(net, nullptr);
+  net->ResetProfile();
+  EXPECT_EQ(net->GetProfile().net().count(), 0);
+  EXPECT_EQ(net->GetProfile().op(0).count(), 0);
+  EXPECT_TRUE(ws.RunNet("sleepnet"));
+  EXPECT_EQ(net->GetProfile().net().count(), 1);
+  EXPECT_EQ(net->GetProfile().op(2).count(), 1);
+}
+
+TEST(ProfileNetTest, TestRunTimeStats) {
+  RunTimeStats stats;
+  for (int i = 1; i <= 100000; ++i) {
+    stats.Add(i % 100);
+  }
+  OperatorProfile profile;
+  stats.ToProfile(&profile);
+  EXPECT_EQ(profile.count(), 100000);
+  EXPECT_FLOAT_EQ(profile.mean_ms(), 49.5);
+  // The percentiles come from a sample, so they are only approximate.
+  EXPECT_NEAR(profile.p50_ms(), 50, 3);
+  EXPECT_NEAR(profile.p99_ms(), 99, 1);
+}
+
+// Creates a simple net of a single Sleep operator with the given input and
+// output.
+static void CreateSleepNet(const string& name, const string& input,
+                           const string& output, Workspace* ws) {
+  NetDef net_def;
+  net_def.set_name(name);
+  OperatorDef* op_def = net_def.add_op();
+  op_def->set_type("Sleep");
+  op_def->add_input(input);
+  op_def->add_output(output);
+  Argument* arg = op_def->add_arg();
+  arg->set_name("ms");
+  arg->set_i(100);
+  ws->CreateBlob(input);
+  EXPECT_TRUE(ws->CreateNet(net_def));
+}
+
+TEST(WorkspaceAsyncTest, TestIndependentNetsRunConcurrently) {
+  Workspace ws;
+  // Both nets read the same blob, which is allowed.
+  CreateSleepNet("net1", "shared", "out1", &ws);
+  CreateSleepNet("net2", "shared", "out2", &ws);
+  auto start_time = std::chrono::system_clock::now();
+  std::future<bool> result1 = ws.RunNetAsync("net1");
+  std::future<bool> result2 = ws.RunNetAsync("net2");
+  EXPECT_TRUE(result1.get());
+  EXPECT_TRUE(result2.get());
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now() - start_time);
+  int milliseconds = duration.count();
+  // We should be seeing 100 ms. This adds a little slack time.
+  EXPECT_GT(milliseconds, 90);
+  EXPECT_LT(milliseconds, 150);
+}
+
+TEST(WorkspaceAsyncTest, TestConflictingRunsFail) {
+  Workspace ws;
+  CreateSleepNet("writer", "input", "data", &ws);
+  CreateSleepNet("reader", "data", "output", &ws);
+  CreateSleepNet("other_writer", "input", "data", &ws);
+  std::future<bool> result = ws.RunNetAsync("writer");
+  // Reading or writing a blob that a running net writes fails, and so does
+  // running the same net twice.
+  EXPECT_FALSE(ws.RunNetAsync("reader").get());
+  EXPECT_FALSE(ws.RunNetAsync("other_writer").get());
+  EXPECT_FALSE(ws.RunNetAsync("writer").get());
+  EXPECT_TRUE(result.get());
+  // Once the writer is done, the other nets can run.
+  EXPECT_TRUE(ws.RunNetAsync("reader").get());
+  EXPECT_TRUE(ws.RunNetAsync("other_writer").get());
+  // A net that does not exist fails too.
+  EXPECT_FALSE(ws.RunNetAsync("nonexisting").get());
+}
+
+const char kConcurrentPlanDefString[] =
+"  network {"
+"    name: \"sleep_a\""
+"    op {"
+"      output: \"a\""
+"      type: \"Sleep\""
+"      arg {"
+"        name: \"ms\""
+"        i: 100"
+"      }"
+"    }"
+"  }"
+"  network {"
+"    name: \"sleep_b\""
+"    op {"
+"      output: \"b\""
+"      type: \"Sleep\""
+"      arg {"
+"        name: \"ms\""
+"        i: 100"
+"      }"
+"    }"
+"  }"
+"  execution_step {"
+"    name: \"concurrent\""
+"    concurrent_substeps: true"
+"    num_iter: 2"
+"    substep {"
+"      name: \"a\""
+"      network: \"sleep_a\""
+"    }"
+"    substep {"
+"      name: \"b\""
+"      network: \"sleep_b\""
+"    }"
+"  }";
+
+TEST(ConcurrentSubstepsTest, TestConcurrentSubstepsTiming) {
+  PlanDef plan_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kConcurrentPlanDefString), &plan_def));
+  Workspace ws;
+  auto start_time = std::chrono::system_clock::now();
+  EXPECT_TRUE(ws.RunPlan(plan_def));
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now() - start_time);
+  int milliseconds = duration.count();
+  // We should be seeing 200 ms instead of 400 ms. This adds a little slack
+  // time.
+  EXPECT_GT(milliseconds, 180);
+  EXPECT_LT(milliseconds, 250);
+}
 
+TEST(ConcurrentSubstepsTest, TestFailureStopsOtherSubsteps) {
+  PlanDef plan_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kConcurrentPlanDefString), &plan_def));
+  // Substep b now loops for 10 seconds, unless it is stopped by the failure
+  // of substep a.
+  plan_def.mutable_execution_step(0)->mutable_substep(1)->set_num_iter(100);
+  NetDef* fail_net = plan_def.mutable_network(0);
+  fail_net->mutable_op(0)->set_type("Fail");
+  fail_net->mutable_op(0)->clear_arg();
+  Workspace ws;
+  auto start_time = std::chrono::system_clock::now();
+  EXPECT_FALSE(ws.RunPlan(plan_def));
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now() - start_time);
+  EXPECT_LT(duration.count(), 1000);
+}
+
+const char kPipelinedPlanDefString[] =
+"  network {"
+"    name: \"load\""
+"    op {"
+"      output: \"data\""
+"      type: \"Count\""
+"    }"
+"    op {"
+"      output: \"load_time\""
+"      type: \"Sleep\""
+"      arg {"
+"        name: \"ms\""
+"        i: 50"
+"      }"
+"    }"
+"  }"
+"  network {"
+"    name: \"compute\""
+"    op {"
+"      input: \"data\""
+"      output: \"collected\""
+"      type: \"Collect\""
+"    }"
+"    op {"
+"      output: \"compute_time\""
+"      type: \"Sleep\""
+"      arg {"
+"        name: \"ms\""
+"        i: 50"
+"      }"
+"    }"
+"  }"
+"  execution_step {"
+"    name: \"pipelined\""
+"    pipelined: true"
+"    num_iter: 8"
+"    network: \"load\""
+"    network: \"compute\""
+"  }";
+
+TEST(PipelinedStepTest, TestPipelinedStep) {
+  PlanDef plan_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kPipelinedPlanDefString), &plan_def));
+  Workspace ws;
+  auto start_time = std::chrono::system_clock::now();
+  EXPECT_TRUE(ws.RunPlan(plan_def));
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now() - start_time);
+  int milliseconds = duration.count();
+  // Loading overlaps with computing, so we should be seeing 450 ms instead of
+  // 800 ms. This adds a little slack time.
+  EXPECT_GT(milliseconds, 430);
+  EXPECT_LT(milliseconds, 550);
+  // Every iteration is handed over exactly once, in order.
+  const vector<int>& collected =
+      ws.GetBlob("collected")->Get<vector<int> >();
+  ASSERT_EQ(collected.size(), 8);
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(collected[i], i);
+  }
+}
+
+TEST(PipelinedStepTest, TestStagesKeepTheirStateAcrossRuns) {
+  PlanDef plan_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kPipelinedPlanDefString), &plan_def));
+  // The second stage counts its own runs.
+  OperatorDef* count_def = plan_def.mutable_network(1)->add_op();
+  count_def->set_type("Count");
+  count_def->add_output("compute_count");
+  // Run the pipelined step twice from an outer step.
+  ExecutionStep pipelined_step = plan_def.execution_step(0);
+  pipelined_step.set_num_iter(2);
+  plan_def.clear_execution_step();
+  ExecutionStep* outer_step = plan_def.add_execution_step();
+  outer_step->set_name("outer");
+  outer_step->set_num_iter(2);
+  *outer_step->add_substep() = pipelined_step;
+  Workspace ws;
+  EXPECT_TRUE(ws.RunPlan(plan_def));
+  // The stage is not created again for the second run of the step.
+  EXPECT_EQ(ws.GetBlob("compute_count")->Get<int>(), 3);
+  EXPECT_EQ(ws.GetBlob("collected")->Get<vector<int> >().size(), 4);
+}
+
+TEST(PipelinedStepTest, TestUnnamedStepFails) {
+  PlanDef plan_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kPipelinedPlanDefString), &plan_def));
+  plan_def.mutable_execution_step(0)->clear_name();
+  Workspace ws;
+  EXPECT_FALSE(ws.RunPlan(plan_def));
+}
+
+TEST(PipelinedStepTest, TestConcurrentPipelinedSteps) {
+  PlanDef plan_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kPipelinedPlanDefString), &plan_def));
+  // A second pipeline of copies of the networks, with blobs of its own.
+  for (int idx = 0; idx < 2; ++idx) {
+    NetDef* net_def = plan_def.add_network();
+    *net_def = plan_def.network(idx);
+    net_def->set_name(net_def->name() + "_2");
+    for (OperatorDef& op_def : *net_def->mutable_op()) {
+      for (string& input : *op_def.mutable_input()) {
+        input += "_2";
+      }
+      for (string& output : *op_def.mutable_output()) {
+        output += "_2";
+      }
+    }
+  }
+  ExecutionStep pipelined_step = plan_def.execution_step(0);
+  pipelined_step.set_num_iter(4);
+  plan_def.clear_execution_step();
+  ExecutionStep* outer_step = plan_def.add_execution_step();
+  outer_step->set_name("outer");
+  outer_step->set_concurrent_substeps(true);
+  outer_step->set_num_iter(2);
+  *outer_step->add_substep() = pipelined_step;
+  ExecutionStep* other_step = outer_step->add_substep();
+  *other_step = pipelined_step;
+  other_step->set_network(0, "load_2");
+  other_step->set_network(1, "compute_2");
+  {
+    // Pipelined steps that share a name must run the same networks.
+    Workspace ws;
+    EXPECT_FALSE(ws.RunPlan(plan_def));
+  }
+  other_step->set_name("pipelined_2");
+  Workspace ws;
+  EXPECT_TRUE(ws.RunPlan(plan_def));
+  for (const string& collected : {"collected", "collected_2"}) {
+    const vector<int>& values = ws.GetBlob(collected)->Get<vector<int> >();
+    ASSERT_EQ(values.size(), 8);
+    for (int i = 0; i < 8; ++i) {
+      EXPECT_EQ(values[i], i);
+    }
+  }
+}
 
+TEST(PipelinedStepTest, TestConflictingStagesFail) {
+  PlanDef plan_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kPipelinedPlanDefString), &plan_def));
+  // The second stage now writes a blob that the first stage writes too.
+  plan_def.mutable_network(1)->mutable_op(1)->set_output(0, "load_time");
+  Workspace ws;
+  EXPECT_FALSE(ws.RunPlan(plan_def));
+}
 
+}  // namespace caffe2
@@ -49,15 +49,21 @@ class Registry {
     return registry_[key](args...);
   }
 
-  // This function should only used in test code to inspect registered names.
-  // You should only call this function after google glog is initialized -
-  // do NOT call it in static initializations.
-  void TEST_PrintRegisteredNames() {
+  // Returns the registered keys in sorted order.
+  std::vector<SrcType> Keys() {
     std::vector<SrcType> keys;
     for (const auto& it : registry_) {
       keys.push_back(it.first);
     }
     std::sort(keys.begin(), keys.end());
+    return keys;
+  }
+
+  // This function should only used in test code to inspect registered names.
+  // You should only call this function after google glog is initialized -
+  // do NOT call it in static initializations.
+  void TEST_PrintRegisteredNames() {
+    std::vector<SrcType> keys = Keys();
     for (const SrcType& key : keys) {
       std::cout << "Registry key: " << key << std::endl;
     }
@@ -0,0 +1,125 @@
+#include <set>
+
+#include "caffe2/core/context.h"
+#include "caffe2/core/shape_inference.h"
+#include "glog/logging.h"
+
+namespace caffe2 {
+
+bool GetBlobTensorShape(const Blob& blob, TensorShape* shape) {
+  if (blob.IsType<Tensor<float, CPUContext> >()) {
+    *shape = TensorShape(blob.Get<Tensor<float, CPUContext> >().dims(),
+                         TensorProto::FLOAT);
+    return true;
+  } else if (blob.IsType<Tensor<int, CPUContext> >()) {
+    *shape = TensorShape(blob.Get<Tensor<int, CPUContext> >().dims(),
+                         TensorProto::INT32);
+    return true;
+  }
+  return false;
+}
+
+namespace {
+// Whether all the shapes are of nonempty tensors, which is the only kind that
+// can be allocated.
+bool AreValidShapes(const vector<TensorShape>& shapes) {
+  for (const TensorShape& shape : shapes) {
+    for (int d : shape.dims) {
+      if (d <= 0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+}  // namespace
+
+PreallocationPlan PlanPreallocation(const vector<OperatorBase*>& operators) {
+  PreallocationPlan plan;
+  plan.total_bytes = 0;
+  plan.num_unknown_outputs = 0;
+  // The shapes of the blobs written so far whose shapes are known. Blobs that
+  // have not been written by the operators yet keep the shape of the tensor
+  // they hold.
+  CaffeMap<const Blob*, TensorShape> shapes;
+  std::set<const Blob*> written;
+  // The blobs that were empty before the network was created, and their
+  // allocations in the plan.
+  std::set<const Blob*> empty;
+  CaffeMap<const Blob*, int> allocation_index;
+  for (OperatorBase* op : operators) {
+    for (const Blob* output : op->Outputs()) {
+      if (output->IsEmpty()) {
+        empty.insert(output);
+      }
+    }
+  }
+  for (OperatorBase* op : operators) {
+    vector<TensorShape> input_shapes(op->InputSize());
+    bool inputs_known = true;
+    for (int i = 0; i < op->InputSize(); ++i) {
+      const Blob* input = op->Inputs()[i];
+      if (written.count(input)) {
+        auto it = shapes.find(input);
+        inputs_known &= it != shapes.end();
+        if (it != shapes.end()) {
+          input_shapes[i] = it->second;
+        }
+      } else {
+        inputs_known &= GetBlobTensorShape(*input, &input_shapes[i]);
+      }
+    }
+    vector<TensorShape> output_shapes;
+    const bool outputs_known = inputs_known &&
+        op->InferOutputShapes(input_shapes, &output_shapes) &&
+        output_shapes.size() == op->OutputSize() &&
+        AreValidShapes(output_shapes);
+    if (!outputs_known) {
+      VLOG(1) << "Cannot infer the output shapes of operator "
+              << op->def().name() << "(" << op->def().type() << ").";
+      plan.num_unknown_outputs += op->OutputSize();
+    }
+    for (int i = 0; i < op->OutputSize(); ++i) {
+      Blob* output = op->Outputs()[i];
+      written.insert(output);
+      if (!outputs_known) {
+        shapes.erase(output);
+        continue;
+      }
+      const TensorShape& shape = output_shapes[i];
+      shapes[output] = shape;
+      if (!empty.count(output) || !op->OutputHasOwnStorage(i)) {
+        continue;
+      }
+      auto it = allocation_index.find(output);
+      if (it == allocation_index.end()) {
+        allocation_index[output] = plan.allocations.size();
+        plan.allocations.push_back(PreallocationPlan::Allocation{op, i, shape});
+        plan.total_bytes += shape.nbytes();
+      } else {
+        PreallocationPlan::Allocation& allocation =
+            plan.allocations[it->second];
+        if (shape.nbytes() > allocation.shape.nbytes()) {
+          plan.total_bytes += shape.nbytes() - allocation.shape.nbytes();
+          allocation = PreallocationPlan::Allocation{op, i, shape};
+        }
+      }
+    }
+  }
+  return plan;
+}
+
+bool ApplyPreallocationPlan(const PreallocationPlan& plan) {
+  for (const PreallocationPlan::Allocation& allocation : plan.allocations) {
+    if (!allocation.op->PreallocateOutput(allocation.output,
+                                          allocation.shape)) {
+      LOG(ERROR) << "Operator " << allocation.op->def().name() << "("
+                 << allocation.op->def().type() << ") cannot preallocate "
+                 << "its output " << allocation.output << ".";
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace caffe2
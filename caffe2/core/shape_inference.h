@@ -0,0 +1,51 @@
+#ifndef CAFFE2_CORE_SHAPE_INFERENCE_H_
+#define CAFFE2_CORE_SHAPE_INFERENCE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "caffe2/core/blob.h"
+#include "caffe2/core/common.h"
+#include "caffe2/core/operator.h"
+
+namespace caffe2 {
+
+// PreallocationPlan describes which outputs of a network can be allocated
+// before the network runs for the first time. Starting from the shapes of the
+// tensors that its input blobs already hold, the shapes of the outputs of each
+// operator are inferred with OperatorBase::InferOutputShapes(), in the order
+// the operators run. Every output blob that is still empty and whose shape is
+// known is then allocated with the largest shape it takes, so that running the
+// network does not allocate, and a network that would not fit in memory can
+// be rejected before it runs.
+struct PreallocationPlan {
+  struct Allocation {
+    OperatorBase* op;
+    int output;
+    TensorShape shape;
+  };
+  // One allocation per output blob to preallocate, in the order the blobs are
+  // first produced.
+  vector<Allocation> allocations;
+  // The number of bytes that the allocations take in total.
+  int64_t total_bytes;
+  // The number of operator outputs whose shapes could not be inferred. These
+  // are allocated by their operators when the network runs, as usual.
+  int num_unknown_outputs;
+};
+
+// Infers the output shapes of the given operators, which should be listed in
+// the order they run, and computes which outputs can be preallocated.
+PreallocationPlan PlanPreallocation(const vector<OperatorBase*>& operators);
+
+// Allocates the outputs of the given plan. Returns false if an operator failed
+// to preallocate its output.
+bool ApplyPreallocationPlan(const PreallocationPlan& plan);
+
+// Returns the shape of the tensor the blob holds, if it holds a CPU tensor of
+// a type shape inference knows about.
+bool GetBlobTensorShape(const Blob& blob, TensorShape* shape);
+
+}  // namespace caffe2
+
+#endif  // CAFFE2_CORE_SHAPE_INFERENCE_H_
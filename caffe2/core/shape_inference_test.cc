@@ -0,0 +1,155 @@
+#include "caffe2/core/context.h"
+#include "caffe2/core/net.h"
+#include "caffe2/core/operator.h"
+#include "caffe2/core/shape_inference.h"
+#include "caffe2/core/workspace.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+namespace caffe2 {
+
+// Stacks two copies of its input along the first dimension.
+class StackTwiceOp final : public Operator<float, CPUContext> {
+ public:
+  StackTwiceOp(const OperatorDef& operator_def, Workspace* ws)
+      : Operator<float, CPUContext>(operator_def, ws) {}
+
+  bool RunOnDevice() override {
+    auto& input = Input(0);
+    auto* output = Output(0);
+    vector<int> dims = input.dims();
+    dims[0] *= 2;
+    output->Reshape(dims);
+    float* output_data = output->mutable_data();
+    for (int copy = 0; copy < 2; ++copy) {
+      device_context_.Copy<float, CPUContext, CPUContext>(
+          input.size(), input.data(), output_data + copy * input.size());
+    }
+    return true;
+  }
+
+  bool InferOutputShapes(const vector<TensorShape>& input_shapes,
+                         vector<TensorShape>* output_shapes) override {
+    output_shapes->assign(1, input_shapes[0]);
+    (*output_shapes)[0].dims[0] *= 2;
+    return true;
+  }
+
+  INPUT_OUTPUT_STATS(1, 1, 1, 1);
+};
+
+// Copies its input, without knowing its output shape in advance.
+class OpaqueCopyOp final : public Operator<float, CPUContext> {
+ public:
+  OpaqueCopyOp(const OperatorDef& operator_def, Workspace* ws)
+      : Operator<float, CPUContext>(operator_def, ws) {}
+
+  bool RunOnDevice() override {
+    auto& input = Input(0);
+    auto* output = Output(0);
+    output->ReshapeLike(input);
+    device_context_.Copy<float, CPUContext, CPUContext>(
+        input.size(), input.data(), output->mutable_data());
+    return true;
+  }
+
+  INPUT_OUTPUT_STATS(1, 1, 1, 1);
+};
+
+namespace {
+REGISTER_CPU_OPERATOR(StackTwice, StackTwiceOp);
+REGISTER_CPU_OPERATOR(OpaqueCopy, OpaqueCopyOp);
+}  // namespace
+
+const char kShapeNetDefString[] =
+"  name: \"shapes\""
+"  op { input: \"in\" output: \"a\" type: \"StackTwice\" }"
+"  op { input: \"a\" output: \"b\" type: \"StackTwice\" }"
+"  op { input: \"b\" output: \"c\" type: \"OpaqueCopy\" }"
+"  op { input: \"c\" output: \"d\" type: \"StackTwice\" }";
+
+void FillInput(Workspace* ws) {
+  auto* input = ws->CreateBlob("in")->GetMutable<Tensor<float, CPUContext> >();
+  input->Reshape(vector<int>{4, 3});
+  for (int i = 0; i < input->size(); ++i) {
+    input->mutable_data()[i] = i;
+  }
+}
+
+const Tensor<float, CPUContext>& GetTensor(const Workspace& ws,
+                                           const string& name) {
+  return ws.GetBlob(name)->Get<Tensor<float, CPUContext> >();
+}
+
+TEST(ShapeInferenceTest, TestPlan) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kShapeNetDefString), &net_def));
+  Workspace ws;
+  FillInput(&ws);
+  unique_ptr<NetBase> net(CreateNet(net_def, &ws));
+  ASSERT_TRUE(net.get() != nullptr);
+  PreallocationPlan plan = PlanPreallocation(net->GetOperators());
+  // The shape of c is unknown, so only a and b can be preallocated.
+  ASSERT_EQ(plan.allocations.size(), 2);
+  EXPECT_EQ(plan.allocations[0].shape.dims, (vector<int>{8, 3}));
+  EXPECT_EQ(plan.allocations[1].shape.dims, (vector<int>{16, 3}));
+  EXPECT_EQ(plan.total_bytes, (24 + 48) * sizeof(float));
+  EXPECT_EQ(plan.num_unknown_outputs, 2);
+  EXPECT_TRUE(ApplyPreallocationPlan(plan));
+  EXPECT_EQ(GetTensor(ws, "a").dims(), (vector<int>{8, 3}));
+  EXPECT_EQ(GetTensor(ws, "b").capacity(), 48);
+  EXPECT_TRUE(ws.GetBlob("c")->IsEmpty());
+}
+
+TEST(ShapeInferenceTest, TestSharedBlobTakesLargestShape) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      "  name: \"shared\""
+      "  op { input: \"in\" output: \"a\" type: \"StackTwice\" }"
+      "  op { input: \"a\" output: \"b\" type: \"StackTwice\" }"
+      "  op { input: \"b\" output: \"a\" type: \"StackTwice\" }", &net_def));
+  Workspace ws;
+  FillInput(&ws);
+  unique_ptr<NetBase> net(CreateNet(net_def, &ws));
+  ASSERT_TRUE(net.get() != nullptr);
+  PreallocationPlan plan = PlanPreallocation(net->GetOperators());
+  // a is allocated once, with the larger of the two shapes it takes.
+  ASSERT_EQ(plan.allocations.size(), 2);
+  EXPECT_EQ(plan.allocations[0].shape.dims, (vector<int>{32, 3}));
+  EXPECT_EQ(plan.total_bytes, (96 + 48) * sizeof(float));
+}
+
+TEST(ShapeInferenceTest, TestCreateNetPreallocates) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kShapeNetDefString), &net_def));
+  net_def.set_preallocate_outputs(true);
+  Workspace ws;
+  FillInput(&ws);
+  EXPECT_TRUE(ws.CreateNet(net_def));
+  const float* b_data = GetTensor(ws, "b").data();
+  EXPECT_EQ(GetTensor(ws, "b").dims(), (vector<int>{16, 3}));
+  EXPECT_TRUE(ws.RunNet("shapes"));
+  // Running the network uses the preallocated storage.
+  EXPECT_EQ(GetTensor(ws, "b").data(), b_data);
+  EXPECT_EQ(GetTensor(ws, "d").dims(), (vector<int>{32, 3}));
+  EXPECT_EQ(GetTensor(ws, "d").data()[12], 0);
+}
+
+TEST(ShapeInferenceTest, TestCreateNetRejectsNetThatDoesNotFit) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kShapeNetDefString), &net_def));
+  net_def.set_preallocate_outputs(true);
+  net_def.set_max_preallocated_bytes(100);
+  Workspace ws;
+  FillInput(&ws);
+  EXPECT_FALSE(ws.CreateNet(net_def));
+  EXPECT_TRUE(ws.GetNet("shapes") == nullptr);
+  EXPECT_TRUE(ws.GetBlob("a")->IsEmpty());
+  net_def.set_max_preallocated_bytes((24 + 48) * sizeof(float));
+  EXPECT_TRUE(ws.CreateNet(net_def));
+}
+
+}  // namespace caffe2
@@ -0,0 +1,158 @@
+#include <unistd.h>
+
+#include <chrono>  // NOLINT
+#include <cstdio>
+#include <fstream>
+#include <mutex>  // NOLINT
+#include <sstream>
+
+#include "caffe2/core/tracing.h"
+#include "glog/logging.h"
+
+namespace caffe2 {
+namespace tracing {
+
+namespace internal {
+std::atomic<bool> enabled(false);
+}  // namespace internal
+
+namespace {
+
+// Each thread keeps at most this many events, and drops the rest.
+const int kMaxEventsPerThread = 1 << 20;
+
+struct TraceEvent {
+  string name;
+  const char* category;
+  int64_t start_us;
+  int64_t duration_us;
+};
+
+// The events of a single thread. The mutex is only contended while the trace
+// is being collected or cleared.
+struct ThreadBuffer {
+  int tid;
+  std::mutex mutex;
+  vector<TraceEvent> events;
+  int64_t num_dropped_events;
+};
+
+// All the thread buffers ever created. They are kept after their threads exit
+// so that their events still show up in the trace, and are intentionally
+// leaked since threads may record events during program exit.
+std::mutex& BuffersMutex() {
+  static std::mutex* mutex = new std::mutex();
+  return *mutex;
+}
+
+vector<ThreadBuffer*>& Buffers() {
+  static vector<ThreadBuffer*>* buffers = new vector<ThreadBuffer*>();
+  return *buffers;
+}
+
+ThreadBuffer* GetThreadBuffer() {
+  static thread_local ThreadBuffer* buffer = nullptr;
+  if (buffer == nullptr) {
+    buffer = new ThreadBuffer();
+    buffer->num_dropped_events = 0;
+    std::lock_guard<std::mutex> lock(BuffersMutex());
+    buffer->tid = Buffers().size();
+    Buffers().push_back(buffer);
+  }
+  return buffer;
+}
+
+int64_t NowInMicroseconds() {
+  static const auto origin = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - origin).count();
+}
+
+void WriteJSONString(const string& str, std::ostream* out) {
+  *out << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      *out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      *out << escaped;
+    } else {
+      *out << c;
+    }
+  }
+  *out << '"';
+}
+
+}  // namespace
+
+void StartTracing() {
+  {
+    std::lock_guard<std::mutex> lock(BuffersMutex());
+    for (ThreadBuffer* buffer : Buffers()) {
+      std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+      buffer->events.clear();
+      buffer->num_dropped_events = 0;
+    }
+  }
+  internal::enabled = true;
+}
+
+void StopTracing() {
+  internal::enabled = false;
+}
+
+string GetTraceJSON() {
+  const int pid = getpid();
+  std::stringstream out;
+  out << "{\"traceEvents\":[";
+  bool first = true;
+  std::lock_guard<std::mutex> lock(BuffersMutex());
+  for (ThreadBuffer* buffer : Buffers()) {
+    std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+    if (buffer->num_dropped_events) {
+      LOG(WARNING) << "Thread " << buffer->tid << " dropped "
+                   << buffer->num_dropped_events << " trace events.";
+    }
+    for (const TraceEvent& event : buffer->events) {
+      out << (first ? "\n" : ",\n");
+      first = false;
+      out << "{\"name\":";
+      WriteJSONString(event.name, &out);
+      out << ",\"cat\":";
+      WriteJSONString(event.category, &out);
+      out << ",\"ph\":\"X\",\"ts\":" << event.start_us
+          << ",\"dur\":" << event.duration_us
+          << ",\"pid\":" << pid << ",\"tid\":" << buffer->tid << "}";
+    }
+  }
+  out << "\n]}\n";
+  return out.str();
+}
+
+void WriteTrace(const string& filename) {
+  std::ofstream out(filename);
+  CHECK(out.good()) << "Cannot open " << filename << " for writing.";
+  out << GetTraceJSON();
+}
+
+void ScopedEvent::Begin(const char* category, const string& name) {
+  category_ = category;
+  name_ = name;
+  start_us_ = NowInMicroseconds();
+}
+
+void ScopedEvent::End() {
+  const int64_t end_us = NowInMicroseconds();
+  ThreadBuffer* buffer = GetThreadBuffer();
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+  if (buffer->events.size() >= kMaxEventsPerThread) {
+    ++buffer->num_dropped_events;
+    return;
+  }
+  buffer->events.push_back(
+      TraceEvent{name_, category_, start_us_, end_us - start_us_});
+}
+
+}  // namespace tracing
+}  // namespace caffe2
@@ -0,0 +1,78 @@
+#ifndef CAFFE2_CORE_TRACING_H_
+#define CAFFE2_CORE_TRACING_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "caffe2/core/common.h"
+
+namespace caffe2 {
+namespace tracing {
+
+// A minimal tracing facility that records timed events, such as operator runs
+// or database reads, and writes them out in the Chrome trace event format, so
+// they can be viewed in chrome://tracing. Each thread records its events to
+// its own buffer, so threads only contend when the trace is collected.
+//
+// Tracing is off by default. When it is off, a TRACE_EVENT costs a relaxed
+// atomic load and a branch.
+
+namespace internal {
+extern std::atomic<bool> enabled;
+}  // namespace internal
+
+inline bool IsEnabled() {
+  return internal::enabled.load(std::memory_order_relaxed);
+}
+
+// Clears all the events recorded so far and starts recording.
+void StartTracing();
+// Stops recording. The events recorded so far are kept.
+void StopTracing();
+// Returns the events recorded so far as a Chrome trace event JSON string.
+string GetTraceJSON();
+// Writes the output of GetTraceJSON() to the given file.
+void WriteTrace(const string& filename);
+
+// ScopedEvent records an event that spans its own lifetime. Use it through
+// the TRACE_EVENT macro below.
+class ScopedEvent {
+ public:
+  ScopedEvent(const char* category, const char* name)
+      : active_(IsEnabled()) {
+    if (active_) Begin(category, name);
+  }
+  ScopedEvent(const char* category, const string& name)
+      : active_(IsEnabled()) {
+    if (active_) Begin(category, name);
+  }
+  ~ScopedEvent() {
+    if (active_) End();
+  }
+
+ private:
+  void Begin(const char* category, const string& name);
+  void End();
+
+  const bool active_;
+  const char* category_;
+  string name_;
+  int64_t start_us_;
+
+  DISABLE_COPY_AND_ASSIGN(ScopedEvent);
+};
+
+}  // namespace tracing
+}  // namespace caffe2
+
+#define CAFFE2_TRACE_CONCAT_IMPL(x, y) x##y
+#define CAFFE2_TRACE_CONCAT(x, y) CAFFE2_TRACE_CONCAT_IMPL(x, y)
+
+// TRACE_EVENT records an event of the given category and name that lasts
+// until the end of the enclosing scope, for example:
+//     TRACE_EVENT("db", "Cursor::Next");
+#define TRACE_EVENT(category, name)                                            \
+  ::caffe2::tracing::ScopedEvent CAFFE2_TRACE_CONCAT(                          \
+      trace_event_, __LINE__)(category, name)
+
+#endif  // CAFFE2_CORE_TRACING_H_
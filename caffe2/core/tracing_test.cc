@@ -0,0 +1,71 @@
+#include <thread>  // NOLINT
+
+#include "caffe2/core/tracing.h"
+#include "gtest/gtest.h"
+
+namespace caffe2 {
+namespace tracing {
+
+namespace {
+int CountOccurrences(const string& str, const string& pattern) {
+  int count = 0;
+  for (size_t pos = str.find(pattern); pos != string::npos;
+       pos = str.find(pattern, pos + 1)) {
+    ++count;
+  }
+  return count;
+}
+}  // namespace
+
+TEST(TracingTest, TestDisabledByDefault) {
+  EXPECT_FALSE(IsEnabled());
+  {
+    TRACE_EVENT("test", "NotRecorded");
+  }
+  EXPECT_EQ(GetTraceJSON().find("NotRecorded"), string::npos);
+}
+
+TEST(TracingTest, TestEventsFromMultipleThreads) {
+  StartTracing();
+  EXPECT_TRUE(IsEnabled());
+  {
+    TRACE_EVENT("test", "MainThreadEvent");
+  }
+  std::thread thread([]() {
+    TRACE_EVENT("test", string("OtherThreadEvent"));
+  });
+  thread.join();
+  StopTracing();
+  {
+    TRACE_EVENT("test", "AfterStop");
+  }
+  string json = GetTraceJSON();
+  EXPECT_EQ(json.find("{\"traceEvents\":["), 0);
+  EXPECT_EQ(CountOccurrences(json, "\"MainThreadEvent\""), 1);
+  EXPECT_EQ(CountOccurrences(json, "\"OtherThreadEvent\""), 1);
+  EXPECT_EQ(CountOccurrences(json, "AfterStop"), 0);
+  EXPECT_EQ(CountOccurrences(json, "\"ph\":\"X\""), 2);
+  // The two events come from different threads.
+  size_t main_event = json.find("MainThreadEvent");
+  size_t other_event = json.find("OtherThreadEvent");
+  string main_tid = json.substr(json.find("\"tid\":", main_event), 8);
+  string other_tid = json.substr(json.find("\"tid\":", other_event), 8);
+  EXPECT_NE(main_tid, other_tid);
+  // Starting again clears the previous events.
+  StartTracing();
+  StopTracing();
+  EXPECT_EQ(GetTraceJSON().find("MainThreadEvent"), string::npos);
+}
+
+TEST(TracingTest, TestNamesAreEscaped) {
+  StartTracing();
+  {
+    TRACE_EVENT("test", "quote\"back\\slash\nnewline");
+  }
+  StopTracing();
+  EXPECT_NE(GetTraceJSON().find("\"quote\\\"back\\\\slash\\u000anewline\""),
+            string::npos);
+}
+
+}  // namespace tracing
+}  // namespace caffe2
@@ -1,51 +1,175 @@
 #include <algorithm>
+#include <chrono>  // NOLINT
+#include <condition_variable>  // NOLINT
 #include <ctime>
+#include <mutex>  // NOLINT
+#include <set>
+#include <thread>  // NOLINT
+#include <unordered_map>
+#include <utility>
 
+#include "caffe2/core/memory_planner.h"
 #include "caffe2/core/operator.h"
 #include "caffe2/core/net.h"
+#include "caffe2/core/net_optimizer.h"
+#include "caffe2/core/shape_inference.h"
 #include "caffe2/core/workspace.h"
 #include "caffe2/proto/caffe2.pb.h"
+#include "caffe2/utils/thread_pool.h"
 
 namespace caffe2 {
 
+struct Workspace::BlobStore {
+  std::unordered_map<string, int> ids;
+  vector<unique_ptr<Blob> > blobs;
+};
+
+// The bookkeeping of RunNetAsync(): the blobs each net reads and writes, and
+// how many running nets read and write each blob.
+struct Workspace::AsyncRunState {
+  struct NetBlobs {
+    // Blob ids. A blob that a net both reads and writes is only in writes.
+    vector<int> reads;
+    vector<int> writes;
+  };
+  std::mutex mutex;
+  std::condition_variable cv;
+  CaffeMap<string, NetBlobs> net_blobs;
+  std::set<string> running_nets;
+  // Indexed by blob id.
+  vector<int> num_readers;
+  vector<int> num_writers;
+};
+
+namespace {
+// The executor shared by all the workspaces for RunNetAsync(). It is
+// intentionally leaked, since its threads may still be running at exit.
+ThreadPool* AsyncNetExecutor() {
+  static ThreadPool* executor = new ThreadPool(
+      std::max(2, static_cast<int>(std::thread::hardware_concurrency())));
+  return executor;
+}
+}  // namespace
+
+Workspace::Workspace()
+    : blob_store_(new BlobStore()), async_state_(new AsyncRunState()),
+      root_folder_(".") {}
+
+Workspace::Workspace(const string& root_folder)
+    : blob_store_(new BlobStore()), async_state_(new AsyncRunState()),
+      net_map_(), root_folder_(root_folder) {}
+
+Workspace::~Workspace() {
+  // Wait for the async runs that are still going on.
+  std::unique_lock<std::mutex> lock(async_state_->mutex);
+  async_state_->cv.wait(lock, [this]() {
+    return async_state_->running_nets.empty();
+  });
+  lock.unlock();
+  // Nets may still refer to the blobs, so destroy them first.
+  net_map_.clear();
+}
+
+vector<string> Workspace::Blobs() const {
+  vector<string> names;
+  for (const auto& entry : blob_store_->ids) {
+    names.push_back(entry.first);
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+bool Workspace::HasBlob(const string& name) const {
+  return blob_store_->ids.count(name);
+}
+
 Blob* Workspace::CreateBlob(const string& name) {
-  if (HasBlob(name)) {
-    VLOG(1) << "Blob " << name << " already exists. Skipping.";
-  } else {
+  auto result = blob_store_->ids.emplace(name, blob_store_->blobs.size());
+  if (result.second) {
     VLOG(1) << "Creating blob " << name;
-    (*blob_map_)[name] = unique_ptr<Blob>(new Blob());
+    blob_store_->blobs.emplace_back(new Blob());
+  } else {
+    VLOG(1) << "Blob " << name << " already exists. Skipping.";
   }
-  return (*blob_map_)[name].get();
+  return blob_store_->blobs[result.first->second].get();
 }
 
 const Blob* Workspace::GetBlob(const string& name) const {
-  if (!HasBlob(name)) {
+  auto it = blob_store_->ids.find(name);
+  if (it == blob_store_->ids.end()) {
     LOG(WARNING) << "Blob " << name << " not in the workspace.";
     // TODO(Yangqing): do we want to always print out the list of blobs here?
     LOG(WARNING) << "Current blobs:";
-    for (const auto& entry : *blob_map_) {
-      LOG(WARNING) << entry.first;
+    for (const string& blob_name : Blobs()) {
+      LOG(WARNING) << blob_name;
     }
     return nullptr;
-  } else {
-    return (*blob_map_)[name].get();
   }
+  return blob_store_->blobs[it->second].get();
+}
+
+int Workspace::GetBlobId(const string& name) const {
+  auto it = blob_store_->ids.find(name);
+  return it == blob_store_->ids.end() ? -1 : it->second;
+}
+
+Blob* Workspace::GetBlobById(int id) {
+  DCHECK_GE(id, 0);
+  DCHECK_LT(id, blob_store_->blobs.size());
+  return blob_store_->blobs[id].get();
+}
+
+int Workspace::NumBlobs() const {
+  return blob_store_->blobs.size();
 }
 
 bool Workspace::CreateNet(const NetDef& net_def) {
   CHECK(net_def.has_name()) << "Net definition should have a name.";
+  if (net_def.optimization_level() > 0) {
+    NetDef optimized_net_def =
+        OptimizeNet(net_def, net_def.optimization_level());
+    optimized_net_def.clear_optimization_level();
+    return CreateNet(optimized_net_def);
+  }
   if (net_map_.count(net_def.name()) > 0) {
+    CHECK(!IsNetRunningAsync(net_def.name()))
+        << "Cannot overwrite network " << net_def.name()
+        << " while it is running.";
     LOG(WARNING) << "Overwriting existing network of the same name.";
     // Note(Yangqing): Why do we explicitly erase it here? Some components of
     // the old network, such as a opened LevelDB, may prevent us from creating a
     // new network before the old one is deleted. Thus we will need to first
     // erase the old one before the new one can be constructed.
     net_map_.erase(net_def.name());
+    net_def_map_.erase(net_def.name());
   }
   // Create a new net with its name.
   LOG(INFO) << "Initializing network " << net_def.name();
-  net_map_[net_def.name()] =
-      unique_ptr<NetBase>(caffe2::CreateNet(net_def, this));
+  // A profile net runs the operators just like the net it profiles.
+  const string& net_type = net_def.net_type() == "profile" ?
+      net_def.profiled_net_type() : net_def.net_type();
+  const NetDef* created_net_def = &net_def;
+  NetDef planned_net_def;
+  if (net_def.plan_memory() && (net_type.empty() || net_type == "simple")) {
+    planned_net_def.CopyFrom(net_def);
+    created_net_def = &planned_net_def;
+    MemoryPlan plan = PlanNetMemory(net_def, *this);
+    ApplyMemoryPlan(plan, &planned_net_def);
+    LOG(INFO) << "Memory planning mapped " << plan.shared_blob_names.size()
+              << " intermediate blobs onto " << plan.num_shared_blobs
+              << " shared blobs: at most " << plan.num_shared_blobs
+              << " intermediate buffers are alive at the same time, instead "
+              << "of " << plan.shared_blob_names.size() << ".";
+    net_map_[net_def.name()] =
+        unique_ptr<NetBase>(caffe2::CreateNet(planned_net_def, this));
+  } else {
+    if (net_def.plan_memory()) {
+      LOG(WARNING) << "Memory planning assumes sequential execution, so it is "
+                   << "skipped for network type " << net_type << ".";
+    }
+    net_map_[net_def.name()] =
+        unique_ptr<NetBase>(caffe2::CreateNet(net_def, this));
+  }
   if (net_map_[net_def.name()].get() == nullptr) {
     LOG(ERROR) << "Error when creating the network.";
     net_map_.erase(net_def.name());
@@ -55,15 +179,73 @@ bool Workspace::CreateNet(const NetDef& net_def) {
     LOG(ERROR) << "Error when setting up network " << net_def.name();
     return false;
   }
+  if (net_def.preallocate_outputs()) {
+    PreallocationPlan plan =
+        PlanPreallocation(net_map_[net_def.name()]->GetOperators());
+    LOG(INFO) << "Network " << net_def.name() << " preallocates "
+              << plan.allocations.size() << " output blobs, taking "
+              << plan.total_bytes << " bytes. " << plan.num_unknown_outputs
+              << " outputs have shapes that cannot be inferred, and are "
+              << "allocated when the network runs.";
+    if (net_def.max_preallocated_bytes() > 0 &&
+        plan.total_bytes > net_def.max_preallocated_bytes()) {
+      LOG(ERROR) << "Network " << net_def.name() << " needs "
+                 << plan.total_bytes << " bytes for its outputs, which is "
+                 << "more than max_preallocated_bytes ("
+                 << net_def.max_preallocated_bytes() << ").";
+      net_map_.erase(net_def.name());
+      return false;
+    }
+    if (!ApplyPreallocationPlan(plan)) {
+      LOG(ERROR) << "Error when preallocating network " << net_def.name();
+      net_map_.erase(net_def.name());
+      return false;
+    }
+  }
+  net_def_map_[net_def.name()] = *created_net_def;
+  // Record the blobs the net touches, for RunNetAsync().
+  std::set<int> reads, writes;
+  for (const OperatorDef& op_def : created_net_def->op()) {
+    for (const string& output : op_def.output()) {
+      writes.insert(GetBlobId(output));
+    }
+  }
+  for (const OperatorDef& op_def : created_net_def->op()) {
+    for (const string& input : op_def.input()) {
+      if (!writes.count(GetBlobId(input))) {
+        reads.insert(GetBlobId(input));
+      }
+    }
+  }
+  std::lock_guard<std::mutex> lock(async_state_->mutex);
+  AsyncRunState::NetBlobs& net_blobs =
+      async_state_->net_blobs[net_def.name()];
+  net_blobs.reads.assign(reads.begin(), reads.end());
+  net_blobs.writes.assign(writes.begin(), writes.end());
   return true;
 }
 
+bool Workspace::IsNetRunningAsync(const string& name) {
+  std::lock_guard<std::mutex> lock(async_state_->mutex);
+  return async_state_->running_nets.count(name);
+}
+
 void Workspace::DeleteNet(const string& name) {
   if (net_map_.count(name)) {
+    CHECK(!IsNetRunningAsync(name))
+        << "Cannot delete network " << name << " while it is running.";
     net_map_.erase(name);
+    net_def_map_.erase(name);
   }
 }
 
+NetBase* Workspace::GetNet(const string& name) {
+  if (!net_map_.count(name)) {
+    return nullptr;
+  }
+  return net_map_[name].get();
+}
+
 bool Workspace::RunNet(const string& name) {
   if (!net_map_.count(name)) {
     LOG(ERROR) << "Network " << name << " does not exist yet.";
@@ -72,6 +254,61 @@ bool Workspace::RunNet(const string& name) {
   return net_map_[name]->Run();
 }
 
+std::future<bool> Workspace::RunNetAsync(const string& name) {
+  std::promise<bool> failure;
+  failure.set_value(false);
+  if (!net_map_.count(name)) {
+    LOG(ERROR) << "Network " << name << " does not exist yet.";
+    return failure.get_future();
+  }
+  AsyncRunState& state = *async_state_;
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.running_nets.count(name)) {
+      LOG(ERROR) << "Network " << name << " is already running.";
+      return failure.get_future();
+    }
+    const AsyncRunState::NetBlobs& net_blobs = state.net_blobs[name];
+    state.num_readers.resize(NumBlobs(), 0);
+    state.num_writers.resize(NumBlobs(), 0);
+    for (int id : net_blobs.writes) {
+      if (state.num_readers[id] || state.num_writers[id]) {
+        LOG(ERROR) << "Network " << name << " writes a blob that a running "
+                   << "network reads or writes.";
+        return failure.get_future();
+      }
+    }
+    for (int id : net_blobs.reads) {
+      if (state.num_writers[id]) {
+        LOG(ERROR) << "Network " << name << " reads a blob that a running "
+                   << "network writes.";
+        return failure.get_future();
+      }
+    }
+    for (int id : net_blobs.writes) ++state.num_writers[id];
+    for (int id : net_blobs.reads) ++state.num_readers[id];
+    state.running_nets.insert(name);
+  }
+  NetBase* net = net_map_[name].get();
+  auto task = std::make_shared<std::packaged_task<bool()> >(
+      [this, net, name]() {
+        bool success = net->Run();
+        // Release the blobs before the future becomes ready, so that the
+        // caller can start a conflicting net as soon as it has waited.
+        AsyncRunState& state = *async_state_;
+        std::lock_guard<std::mutex> lock(state.mutex);
+        const AsyncRunState::NetBlobs& net_blobs = state.net_blobs[name];
+        for (int id : net_blobs.writes) --state.num_writers[id];
+        for (int id : net_blobs.reads) --state.num_readers[id];
+        state.running_nets.erase(name);
+        state.cv.notify_all();
+        return success;
+      });
+  std::future<bool> result = task->get_future();
+  AsyncNetExecutor()->RunTask([task]() { (*task)(); });
+  return result;
+}
+
 bool Workspace::RunOperatorOnce(const OperatorDef& op_def) {
   std::unique_ptr<OperatorBase> op(CreateOperator(op_def, this));
   if (!op->Verify()) {
@@ -115,7 +352,8 @@ bool Workspace::RunPlan(const PlanDef& plan) {
   clock_t start_time = clock();
   for (const ExecutionStep& step : plan.execution_step()) {
     clock_t step_start_time = clock();
-    if (!ExecuteStepRecursive(step)) {
+    std::atomic<bool> should_stop(false);
+    if (!ExecuteStepRecursive(step, &should_stop)) {
       LOG(ERROR) << "Failed initializing step " << step.name();
       return false;
     }
@@ -130,7 +368,8 @@ bool Workspace::RunPlan(const PlanDef& plan) {
   return true;
 }
 
-bool Workspace::ExecuteStepRecursive(const ExecutionStep& step) {
+bool Workspace::ExecuteStepRecursive(const ExecutionStep& step,
+                                     std::atomic<bool>* should_stop) {
   LOG(INFO) << "Running execution step " << step.name();
   if (!(step.substep_size() == 0 || step.network_size() == 0)) {
     LOG(ERROR) << "An ExecutionStep should either have substep or networks "
@@ -140,31 +379,62 @@ bool Workspace::ExecuteStepRecursive(const ExecutionStep& step) {
 
   int iterations = step.has_num_iter() ? step.num_iter() : 1;
   VLOG(1) << "Executing step for " << iterations << " iterations.";
-  if (step.substep_size()) {
+  if (step.substep_size() && step.concurrent_substeps()) {
+    // Setting up pipelined steps creates blobs and nets, which must not
+    // happen while the substeps run.
+    if (!SetUpPipelinedSteps(step)) {
+      return false;
+    }
+    for (int i = 0; i < iterations; ++i) {
+      // Each substep gets its own thread rather than a pool worker, since a
+      // substep may itself loop for a long time or wait on another substep.
+      std::atomic<bool> success(true);
+      vector<std::thread> threads;
+      for (const ExecutionStep& substep : step.substep()) {
+        threads.push_back(std::thread([this, &substep, &success,
+                                       should_stop]() {
+          if (!ExecuteStepRecursive(substep, should_stop)) {
+            success = false;
+            *should_stop = true;
+          }
+        }));
+      }
+      for (std::thread& thread : threads) {
+        thread.join();
+      }
+      if (!success || *should_stop) {
+        return false;
+      }
+    }
+    return true;
+  } else if (step.substep_size()) {
     for (int i = 0; i < iterations; ++i) {
       for (const ExecutionStep& substep : step.substep()) {
-        if (!ExecuteStepRecursive(substep)) {
+        if (*should_stop || !ExecuteStepRecursive(substep, should_stop)) {
           return false;
         }
       }
     }
     return true;
+  } else if (step.pipelined() && step.network_size() > 1) {
+    return ExecutePipelinedStep(step, should_stop);
   } else {
     // If this ExecutionStep just contains nets, we can directly run it.
     vector<NetBase*> networks;
     // Collect the networks to run.
     for (const string& network_name : step.network()) {
-      if (!net_map_.count(network_name)) {
+      auto it = net_map_.find(network_name);
+      if (it == net_map_.end()) {
         LOG(ERROR) << "Network " << network_name << " not found.";
         return false;
       }
       VLOG(1) << "Going to execute network " << network_name;
-      networks.push_back(net_map_[network_name].get());
+      networks.push_back(it->second.get());
     }
     for (int iter = 0; iter < iterations; ++iter) {
       VLOG(1) << "Executing network iteration " << iter;
       for (NetBase* network : networks) {
-        if (!network->Run()) {
+        if (*should_stop || !network->Run()) {
           return false;
         }
       }
@@ -173,4 +443,262 @@ bool Workspace::ExecuteStepRecursive(const ExecutionStep& step) {
   return true;
 }
 
+namespace {
+// The suffix of the blobs that a pipeline stage reads its hand-off blobs from.
+const char kPipelineStagedSuffix[] = "__pipeline_staged";
+
+// The hand-off from a pipeline stage to the next one. The producing stage
+// writes the hand-off blobs, and the consuming stage reads their staged
+// copies. Once the consumer is done with an iteration, the producer swaps the
+// blobs it has written for the next iteration into the staged copies.
+struct PipelineHandoff {
+  std::mutex mutex;
+  std::condition_variable cv;
+  // Whether the staged blobs hold an iteration that the consumer has not run.
+  bool full = false;
+  // Pairs of (blob, staged blob).
+  vector<std::pair<Blob*, Blob*> > blobs;
+};
+
+// Waits until the given condition holds, or should_stop is set, and returns
+// whether the condition holds. should_stop may be set without notifying the
+// condition variable, e.g. by a failing concurrent step, so it is polled.
+template <class Condition>
+bool WaitUntil(std::unique_lock<std::mutex>* lock, std::condition_variable* cv,
+               std::atomic<bool>* should_stop, Condition condition) {
+  while (!condition()) {
+    if (*should_stop) {
+      return false;
+    }
+    cv->wait_for(*lock, std::chrono::milliseconds(10));
+  }
+  return true;
+}
+
+// Adds the pipelined steps in the tree of the given step to steps.
+void CollectPipelinedSteps(const ExecutionStep& step,
+                           vector<const ExecutionStep*>* steps) {
+  if (step.pipelined() && step.network_size() > 1) {
+    steps->push_back(&step);
+  }
+  for (const ExecutionStep& substep : step.substep()) {
+    CollectPipelinedSteps(substep, steps);
+  }
+}
+}  // namespace
+
+bool Workspace::SetUpPipelinedSteps(const ExecutionStep& step) {
+  vector<const ExecutionStep*> pipelined_steps;
+  CollectPipelinedSteps(step, &pipelined_steps);
+  // The stage nets are named after their step, so steps with the same name
+  // must run the same networks.
+  CaffeMap<string, const ExecutionStep*> steps_by_name;
+  for (const ExecutionStep* pipelined_step : pipelined_steps) {
+    auto it = steps_by_name.emplace(pipelined_step->name(), pipelined_step);
+    const ExecutionStep* named_step = it.first->second;
+    if (!it.second &&
+        (pipelined_step->network_size() != named_step->network_size() ||
+         !std::equal(pipelined_step->network().begin(),
+                     pipelined_step->network().end(),
+                     named_step->network().begin()))) {
+      LOG(ERROR) << "Pipelined steps named " << pipelined_step->name()
+                 << " run different networks.";
+      return false;
+    }
+    vector<NetBase*> stages;
+    vector<vector<string> > handoff_names;
+    if (!SetUpPipelinedStep(*pipelined_step, &stages, &handoff_names)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Workspace::SetUpPipelinedStep(const ExecutionStep& step,
+                                   vector<NetBase*>* stages,
+                                   vector<vector<string> >* handoff_names) {
+  if (step.name().empty()) {
+    LOG(ERROR) << "A pipelined step must have a name, which its stage nets "
+               << "are named after.";
+    return false;
+  }
+  const int num_stages = step.network_size();
+  // Every stage but the first reads the blobs written by the previous stage
+  // from their staged copies, so it runs as a separate instance of its net
+  // unless it reads none.
+  vector<NetDef> stage_defs;
+  vector<std::set<string> > handoff_sets(num_stages);
+  for (int stage = 0; stage < num_stages; ++stage) {
+    const string& network_name = step.network(stage);
+    auto it = net_def_map_.find(network_name);
+    if (it == net_def_map_.end()) {
+      LOG(ERROR) << "Network " << network_name << " not found.";
+      return false;
+    }
+    stage_defs.push_back(it->second);
+    if (stage == 0) {
+      continue;
+    }
+    std::set<string> previous_outputs;
+    for (const OperatorDef& op_def : stage_defs[stage - 1].op()) {
+      previous_outputs.insert(op_def.output().begin(), op_def.output().end());
+    }
+    NetDef& stage_def = stage_defs[stage];
+    for (OperatorDef& op_def : *stage_def.mutable_op()) {
+      for (string& input : *op_def.mutable_input()) {
+        if (previous_outputs.count(input)) {
+          handoff_sets[stage].insert(input);
+          input += kPipelineStagedSuffix;
+        }
+      }
+      for (string& output : *op_def.mutable_output()) {
+        if (handoff_sets[stage].count(output)) {
+          output += kPipelineStagedSuffix;
+        }
+      }
+    }
+  }
+  // Apart from the hand-off blobs, the stages run at the same time on
+  // different iterations, so none of them may touch a blob another one
+  // writes.
+  for (int stage = 0; stage < num_stages; ++stage) {
+    std::set<string> outputs;
+    for (const OperatorDef& op_def : stage_defs[stage].op()) {
+      outputs.insert(op_def.output().begin(), op_def.output().end());
+    }
+    for (int other = 0; other < num_stages; ++other) {
+      if (other == stage) {
+        continue;
+      }
+      for (const OperatorDef& op_def : stage_defs[other].op()) {
+        for (const string& name : op_def.input()) {
+          if (outputs.count(name)) {
+            LOG(ERROR) << "Network " << step.network(other) << " reads blob "
+                       << name << " that network " << step.network(stage)
+                       << " writes, which only the next stage may read in a "
+                       << "pipelined step.";
+            return false;
+          }
+        }
+        for (const string& name : op_def.output()) {
+          if (outputs.count(name)) {
+            LOG(ERROR) << "Networks " << step.network(stage) << " and "
+                       << step.network(other) << " both write blob " << name
+                       << ", which is not allowed in a pipelined step.";
+            return false;
+          }
+        }
+      }
+    }
+  }
+
+  // Once a step is set up, setting it up again only reads the workspace, so
+  // that concurrently running steps that were set up beforehand do not race.
+  stages->assign(num_stages, nullptr);
+  handoff_names->assign(num_stages, vector<string>());
+  for (int stage = 0; stage < num_stages; ++stage) {
+    if (handoff_sets[stage].empty()) {
+      (*stages)[stage] = net_map_.find(step.network(stage))->second.get();
+      continue;
+    }
+    for (const string& name : handoff_sets[stage]) {
+      (*handoff_names)[stage].push_back(name);
+      for (const string& blob_name : {name, name + kPipelineStagedSuffix}) {
+        if (!HasBlob(blob_name)) {
+          CreateBlob(blob_name);
+        }
+      }
+    }
+    // The rewritten stage is created once, like any other net, and reused by
+    // later runs of the step, so that its operators keep their state. It is
+    // only created again if the networks of the step have changed.
+    const string stage_net_name = "__pipeline_" + step.name() + "_stage_" +
+        std::to_string(stage);
+    NetDef& stage_def = stage_defs[stage];
+    stage_def.set_name(stage_net_name);
+    const string serialized_stage_def = stage_def.SerializeAsString();
+    auto it = pipeline_stage_defs_.find(stage_net_name);
+    if (it == pipeline_stage_defs_.end() ||
+        it->second != serialized_stage_def ||
+        !net_map_.count(stage_net_name)) {
+      pipeline_stage_defs_.erase(stage_net_name);
+      if (!CreateNet(stage_def)) {
+        LOG(ERROR) << "Error when setting up pipeline stage "
+                   << step.network(stage);
+        return false;
+      }
+      pipeline_stage_defs_[stage_net_name] = serialized_stage_def;
+    }
+    (*stages)[stage] = net_map_.find(stage_net_name)->second.get();
+  }
+  return true;
+}
+
+bool Workspace::ExecutePipelinedStep(const ExecutionStep& step,
+                                     std::atomic<bool>* should_stop) {
+  const int iterations = step.has_num_iter() ? step.num_iter() : 1;
+  const int num_stages = step.network_size();
+  vector<NetBase*> stages;
+  vector<vector<string> > handoff_names;
+  if (!SetUpPipelinedStep(step, &stages, &handoff_names)) {
+    return false;
+  }
+  vector<unique_ptr<PipelineHandoff> > handoffs(num_stages);
+  for (int stage = 1; stage < num_stages; ++stage) {
+    handoffs[stage].reset(new PipelineHandoff());
+    for (const string& name : handoff_names[stage]) {
+      handoffs[stage]->blobs.emplace_back(
+          GetBlob(name), GetBlob(name + kPipelineStagedSuffix));
+    }
+  }
+
+  // Each stage runs on its own thread. handoffs[stage] is the hand-off into
+  // the stage, and handoffs[stage + 1] the one out of it.
+  vector<std::thread> threads;
+  for (int stage = 0; stage < num_stages; ++stage) {
+    threads.push_back(std::thread([&, stage]() {
+      PipelineHandoff* in = handoffs[stage].get();
+      PipelineHandoff* out =
+          stage + 1 < num_stages ? handoffs[stage + 1].get() : nullptr;
+      for (int iter = 0; iter < iterations; ++iter) {
+        if (in) {
+          std::unique_lock<std::mutex> lock(in->mutex);
+          if (!WaitUntil(&lock, &in->cv, should_stop,
+                         [in]() { return in->full; })) {
+            return;
+          }
+        }
+        VLOG(1) << "Running pipeline stage " << stage << " iteration " << iter;
+        if (!stages[stage]->Run()) {
+          LOG(ERROR) << "Pipeline stage " << step.network(stage)
+                     << " failed at iteration " << iter;
+          *should_stop = true;
+          return;
+        }
+        if (in) {
+          std::lock_guard<std::mutex> lock(in->mutex);
+          in->full = false;
+          in->cv.notify_all();
+        }
+        if (out) {
+          std::unique_lock<std::mutex> lock(out->mutex);
+          if (!WaitUntil(&lock, &out->cv, should_stop,
+                         [out]() { return !out->full; })) {
+            return;
+          }
+          for (auto& blob_pair : out->blobs) {
+            blob_pair.first->Swap(blob_pair.second);
+          }
+          out->full = true;
+          out->cv.notify_all();
+        }
+      }
+    }));
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  return !*should_stop;
+}
+
 }  // namespace caffe2
@@ -1,8 +1,10 @@
 #ifndef CAFFE2_CORE_WORKSPACE_H_
 #define CAFFE2_CORE_WORKSPACE_H_
 
+#include <atomic>
 #include <climits>
 #include <cstddef>
+#include <future>  // NOLINT
 #include <typeinfo>
 #include <vector>
 
@@ -17,43 +19,60 @@ class NetBase;
 
 // Workspace is a class that holds all the blobs in this run and also runs
 // the operators.
+//
+// Blobs are interned: when a blob is created, it gets a dense integer id that
+// stays valid for the lifetime of the workspace. Looking a blob up by name is a
+// hash table lookup, and code that looks up the same blobs over and over, such
+// as net construction, can use the id instead.
 class Workspace {
  public:
-  typedef CaffeMap<string, unique_ptr<Blob> > BlobMap;
   typedef CaffeMap<string, unique_ptr<NetBase> > NetMap;
   // Initializes an empty workspace.
-  Workspace() : blob_map_(new BlobMap()), root_folder_(".") {}
-  explicit Workspace(const string& root_folder)
-      : blob_map_(new BlobMap()), net_map_(), root_folder_(root_folder) {}
-  ~Workspace() {}
+  Workspace();
+  explicit Workspace(const string& root_folder);
+  ~Workspace();
 
-  // Return a list of blob names. This may be a bit slow since it will involve
-  // creation of multiple temp variables - if possible, use HasBlob() or
+  // Return a sorted list of blob names. This may be a bit slow since it will
+  // involve creation of multiple temp variables - if possible, use HasBlob() or
   // GetBlob() below with given names.
-  vector<string> Blobs() {
-    vector<string> names;
-    for (auto& entry : *blob_map_) {
-      names.push_back(entry.first);
-    }
-    return names;
-  }
+  vector<string> Blobs() const;
   // Return the root folder of the workspace.
   const string& RootFolder() { return root_folder_; }
-  inline bool HasBlob(const string& name) const {
-    return blob_map_->count(name);
-  }
+  bool HasBlob(const string& name) const;
   Blob* CreateBlob(const string& name);
   const Blob* GetBlob(const string& name) const;
   inline Blob* GetBlob(const string& name) {
     return const_cast<Blob*>(
         static_cast<const Workspace*>(this)->GetBlob(name));
   }
+  // Returns the id of the blob of the given name, or -1 if it does not exist.
+  int GetBlobId(const string& name) const;
+  // Returns the blob of the given id. Ids range from 0 to NumBlobs() - 1.
+  Blob* GetBlobById(int id);
+  int NumBlobs() const;
 
   // CreateNet creates a network in the current workspace. It can then
   // be referred to by RunNet().
   bool CreateNet(const NetDef& net_def);
   void DeleteNet(const string& net_name);
   bool RunNet(const string& net_name);
+  // RunNetAsync starts running the given net on an executor shared by all
+  // workspaces, and returns a future that becomes ready with the result of the
+  // run.
+  //
+  // Nets may run at the same time as long as no blob that one of them writes
+  // is read or written by another one; blobs that they only read, such as
+  // parameters, can be shared. RunNetAsync checks this against the other nets
+  // of this workspace that were started with RunNetAsync and are still
+  // running, and fails the run if it would conflict with one of them, or if
+  // the net itself is still running. It is up to the caller not to touch the
+  // blobs of a running net in any other way, e.g. through RunNet(), and not to
+  // create blobs or nets while nets are running. A net cannot be deleted or
+  // overwritten while it is running, and the workspace waits for all runs to
+  // finish when it is destroyed.
+  std::future<bool> RunNetAsync(const string& net_name);
+  // Returns the net of the given name, or nullptr if it does not exist.
+  NetBase* GetNet(const string& net_name);
   vector<string> Nets() {
     vector<string> names;
     for (auto& entry : net_map_) {
@@ -75,15 +94,39 @@ class Workspace {
 
 
  protected:
-  bool ExecuteStepRecursive(const ExecutionStep& execution);
+  // Runs the given step. The step gives up early, returning false, once
+  // should_stop is set, which happens when a concurrently running step fails.
+  bool ExecuteStepRecursive(const ExecutionStep& execution,
+                            std::atomic<bool>* should_stop);
+  // Runs the networks of a step with "pipelined" set as the stages of a
+  // pipeline. See ExecutionStep in caffe2.proto.
+  bool ExecutePipelinedStep(const ExecutionStep& execution,
+                            std::atomic<bool>* should_stop);
+  // Checks the networks of a pipelined step, and creates the hand-off blobs
+  // and the stage nets that read staged copies, unless an earlier call did.
+  // Fills in the net of each stage and the names of the blobs handed over to
+  // it.
+  bool SetUpPipelinedStep(const ExecutionStep& execution,
+                          vector<NetBase*>* stages,
+                          vector<vector<string> >* handoff_names);
+  // Sets up all the pipelined steps in the tree of the given step. Since this
+  // creates blobs and nets, it is done before concurrent substeps start.
+  bool SetUpPipelinedSteps(const ExecutionStep& execution);
+  bool IsNetRunningAsync(const string& net_name);
 
  private:
-  // If a workspace is shared with another one, the blob_map_ is going to be
-  // shared, but net_map_ will not be.
-  // TODO(Yangqing): Are we really going to share workspaces? If not, let's
-  // remove this unnecessity.
-  unique_ptr<BlobMap> blob_map_;
+  // The blob store is defined in workspace.cc, so that its hash table does not
+  // need to be compiled by NVCC (see the note on CaffeMap).
+  struct BlobStore;
+  unique_ptr<BlobStore> blob_store_;
+  struct AsyncRunState;
+  unique_ptr<AsyncRunState> async_state_;
   NetMap net_map_;
+  // The definitions the nets were created from, after memory planning.
+  CaffeMap<string, NetDef> net_def_map_;
+  // The serialized definitions of the stage nets that pipelined steps created,
+  // by the name of the stage net.
+  CaffeMap<string, string> pipeline_stage_defs_;
   string root_folder_;
   DISABLE_COPY_AND_ASSIGN(Workspace);
 };
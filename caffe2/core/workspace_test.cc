@@ -39,6 +39,27 @@ TEST(WorkspaceTest, BlobAccess) {
   EXPECT_NE(&blob->Get<int>(), nullptr);
 }
 
+TEST(WorkspaceTest, BlobIds) {
+  Workspace ws;
+  EXPECT_EQ(ws.NumBlobs(), 0);
+  EXPECT_EQ(ws.GetBlobId("a"), -1);
+  Blob* b = ws.CreateBlob("b");
+  Blob* a = ws.CreateBlob("a");
+  // Ids are dense, in the order of creation, and do not change when the blob
+  // is created again.
+  EXPECT_EQ(ws.GetBlobId("b"), 0);
+  EXPECT_EQ(ws.GetBlobId("a"), 1);
+  EXPECT_EQ(ws.CreateBlob("b"), b);
+  EXPECT_EQ(ws.NumBlobs(), 2);
+  EXPECT_EQ(ws.GetBlobById(0), b);
+  EXPECT_EQ(ws.GetBlobById(1), a);
+  // Blobs() is sorted by name.
+  vector<string> names = ws.Blobs();
+  ASSERT_EQ(names.size(), 2);
+  EXPECT_EQ(names[0], "a");
+  EXPECT_EQ(names[1], "b");
+}
+
 TEST(WorkspaceTest, RunEmptyPlan) {
   PlanDef plan_def;
   Workspace ws;
@@ -1,4 +1,5 @@
 #include "caffe2/core/db.h"
+#include "caffe2/core/tracing.h"
 #include "glog/logging.h"
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
@@ -12,7 +13,10 @@ class LevelDBCursor : public Cursor {
     : iter_(iter) { SeekToFirst(); }
   ~LevelDBCursor() { delete iter_; }
   void SeekToFirst() override { iter_->SeekToFirst(); }
-  void Next() override { iter_->Next(); }
+  void Next() override {
+    TRACE_EVENT("db", "Cursor::Next");
+    iter_->Next();
+  }
   string key() override { return iter_->key().ToString(); }
   string value() override { return iter_->value().ToString(); }
   bool Valid() override { return iter_->Valid(); }
@@ -32,6 +36,7 @@ class LevelDBTransaction : public Transaction {
     batch_->Put(key, value);
   }
   void Commit() override {
+    TRACE_EVENT("db", "Transaction::Commit");
     leveldb::Status status = db_->Write(leveldb::WriteOptions(), batch_.get());
     batch_.reset(new leveldb::WriteBatch());
     CHECK(status.ok()) << "Failed to write batch to leveldb "
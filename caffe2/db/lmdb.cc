@@ -1,6 +1,7 @@
 #include <sys/stat.h>
 
 #include "caffe2/core/db.h"
+#include "caffe2/core/tracing.h"
 #include "glog/logging.h"
 #include "lmdb.h"
 
@@ -28,7 +29,10 @@ class LMDBCursor : public Cursor {
     mdb_txn_abort(mdb_txn_);
   }
   void SeekToFirst() override { Seek(MDB_FIRST); }
-  void Next() override { Seek(MDB_NEXT); }
+  void Next() override {
+    TRACE_EVENT("db", "Cursor::Next");
+    Seek(MDB_NEXT);
+  }
   string key() override {
     return string(static_cast<const char*>(mdb_key_.mv_data), mdb_key_.mv_size);
   }
@@ -71,6 +75,7 @@ class LMDBTransaction final : public Transaction {
   }
   void Put(const string& key, const string& value) override;
   void Commit() override {
+    TRACE_EVENT("db", "Transaction::Commit");
     MDB_CHECK(mdb_txn_commit(mdb_txn_));
     mdb_dbi_close(mdb_env_, mdb_dbi_);
     mdb_txn_abort(mdb_txn_);
@@ -3,6 +3,7 @@
 #include <cstdint>
 
 #include "caffe2/core/db.h"
+#include "caffe2/core/tracing.h"
 #include "caffe2/utils/zmq.hpp"
 #include "glog/logging.h"
 
@@ -39,6 +40,7 @@ class ZmqDBCursor : public Cursor {
   }
 
   void Next() override {
+    TRACE_EVENT("db", "Cursor::Next");
     zmq::message_t content;
     ReceiveWithRetry(&content);
     key_.assign(static_cast<char*>(content.data()), content.size());
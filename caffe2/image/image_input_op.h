@@ -3,39 +3,64 @@
 
 #include <opencv2/opencv.hpp>
 
+#include <condition_variable>  // NOLINT
 #include <iostream>
+#include <mutex>  // NOLINT
+#include <random>
 
 #include "caffe/proto/caffe.pb.h"
 #include "caffe2/core/db.h"
+#include "caffe2/core/types.h"
 #include "caffe2/operators/prefetch_op.h"
+#include "caffe2/utils/thread_pool.h"
 
 namespace caffe2 {
 
+// ImageInputOp reads images and their labels from a db, and outputs batches of
+// them scaled, randomly cropped and mirrored, and normalized.
+//
+// The images are output in the given order (NHWC by default, or NCHW), so
+// that NCHW networks need no NHWC2NCHW op after the input. They are
+// normalized with the mean and std arguments, or per channel with the
+// mean_per_channel and std_per_channel arguments if these are given.
+//
+// The images are decoded and transformed by decode_threads (an argument, 1 by
+// default) random streams, seeded from the random seed of the device option.
+// Stream i handles the images i, i + decode_threads, ... of each batch, so for
+// a given seed and number of threads the batches are always the same. With
+// more than one stream, each of them runs on its own thread.
 template <class DeviceContext>
 class ImageInputOp final
     : public PrefetchOperator<DeviceContext> {
  public:
   using OperatorBase::OutputSize;
-  using PrefetchOperator<DeviceContext>::prefetch_thread_;
+  using PrefetchOperator<DeviceContext>::prefetch_depth_;
   explicit ImageInputOp(const OperatorDef& operator_def,
                                     Workspace* ws);
   ~ImageInputOp() {
-    if (prefetch_thread_.get() != nullptr) {
-      prefetch_thread_->join();
-    }
+    this->StopPrefetching();
   }
 
-  bool Prefetch() override;
-  bool CopyPrefetched() override;
+  bool Prefetch(int slot) override;
+  bool CopyPrefetched(int slot) override;
 
  private:
   bool GetImageAndLabelFromDBValue(
       const string& value, cv::Mat* img, int* label);
+  // Decodes the image and label of a record, and writes the transformed image
+  // to image_data. Can be called for different images at the same time.
+  void DecodeItem(const string& value, std::mt19937* random_generator,
+                  float* image_data, int* label);
+  // Crops the crop_ x crop_ window at the given offsets of the image, mirrors
+  // it if asked to, and writes it normalized to image_data in order_, all in
+  // one pass.
+  void CropMirrorNormalize(const cv::Mat& scaled_img, int height_offset,
+                           int width_offset, bool mirror, float* image_data);
   unique_ptr<db::DB> db_;
   unique_ptr<db::Cursor> cursor_;
-  CPUContext cpu_context_;
-  Tensor<float, CPUContext> prefetched_image_;
-  Tensor<int, CPUContext> prefetched_label_;
+  // The prefetched images and labels, one of each per prefetch slot.
+  vector<unique_ptr<Tensor<float, CPUContext> > > prefetched_image_;
+  vector<unique_ptr<Tensor<int, CPUContext> > > prefetched_label_;
   int batch_size_;
   string db_name_;
   string db_type_;
@@ -47,6 +72,19 @@ class ImageInputOp final
   int crop_;
   bool mirror_;
   bool use_caffe_datum_;
+  StorageOrder order_;
+  // The normalization of each channel, as value * scale + bias, and the same
+  // repeated for each pixel of a row of the crop, in NHWC order.
+  vector<float> channel_scale_;
+  vector<float> channel_bias_;
+  vector<float> row_scale_;
+  vector<float> row_bias_;
+  // The shape of the image batches.
+  vector<int> image_dims_;
+  int decode_threads_;
+  // The random stream of each decode thread.
+  vector<std::mt19937> random_generators_;
+  unique_ptr<ThreadPool> decode_pool_;
   INPUT_OUTPUT_STATS(0, 0, 2, 2);
   DISABLE_COPY_AND_ASSIGN(ImageInputOp);
 };
@@ -70,13 +108,51 @@ ImageInputOp<DeviceContext>::ImageInputOp(
         crop_(OperatorBase::template GetSingleArgument<int>("crop", -1)),
         mirror_(OperatorBase::template GetSingleArgument<int>("mirror", 0)),
         use_caffe_datum_(OperatorBase::template GetSingleArgument<int>(
-              "use_caffe_datum", 0)) {
+              "use_caffe_datum", 0)),
+        order_(StringToStorageOrder(OperatorBase::template
+            GetSingleArgument<string>("order", "NHWC"))),
+        decode_threads_(OperatorBase::template GetSingleArgument<int>(
+              "decode_threads", 1)) {
   CHECK_GT(batch_size_, 0) << "Batch size should be nonnegative.";
   CHECK_GT(db_name_.size(), 0) << "Must provide a leveldb name.";
   CHECK_GT(scale_, 0) << "Must provide the scaling factor.";
   CHECK_GT(crop_, 0) << "Must provide the cropping value.";
   CHECK_GE(scale_, crop_)
       << "The scale value must be no smaller than the crop value.";
+  CHECK_GT(decode_threads_, 0) << "Must have at least one decode thread.";
+  CHECK(order_ == StorageOrder::NHWC || order_ == StorageOrder::NCHW)
+      << "Unknown storage order.";
+  const int channels = color_ ? 3 : 1;
+  channel_scale_ = OperatorBase::template GetRepeatedArgument<float>(
+      "std_per_channel");
+  if (channel_scale_.empty()) {
+    channel_scale_.assign(channels, std_);
+  }
+  channel_bias_ = OperatorBase::template GetRepeatedArgument<float>(
+      "mean_per_channel");
+  if (channel_bias_.empty()) {
+    channel_bias_.assign(channels, mean_);
+  }
+  CHECK_EQ(channel_scale_.size(), channels)
+      << "Must provide one std per channel.";
+  CHECK_EQ(channel_bias_.size(), channels)
+      << "Must provide one mean per channel.";
+  // (value - mean) / std == value * (1 / std) - mean / std.
+  for (int c = 0; c < channels; ++c) {
+    channel_scale_[c] = 1.f / channel_scale_[c];
+    channel_bias_[c] *= -channel_scale_[c];
+  }
+  for (int w = 0; w < crop_; ++w) {
+    row_scale_.insert(row_scale_.end(), channel_scale_.begin(),
+                      channel_scale_.end());
+    row_bias_.insert(row_bias_.end(), channel_bias_.begin(),
+                     channel_bias_.end());
+  }
+  if (order_ == StorageOrder::NCHW) {
+    image_dims_ = vector<int>{batch_size_, channels, crop_, crop_};
+  } else {
+    image_dims_ = vector<int>{batch_size_, crop_, crop_, channels};
+  }
 
   DLOG(INFO) << "Creating an image input op with the following setting: ";
   DLOG(INFO) << "    Outputting in batches of " << batch_size_ << " images;";
@@ -87,13 +163,25 @@ ImageInputOp<DeviceContext>::ImageInputOp(
   DLOG(INFO) << "    Cropping image to " << crop_
              << (mirror_ ? " with " : " without ") << "random mirroring;";
   DLOG(INFO) << "    Subtract mean " << mean_ << " and divide by std " << std_
-             << ".";
+             << ";";
+  DLOG(INFO) << "    Outputting images in "
+             << (order_ == StorageOrder::NCHW ? "NCHW" : "NHWC") << " order;";
+  DLOG(INFO) << "    Decoding images with " << decode_threads_ << " threads.";
+  for (int i = 0; i < decode_threads_; ++i) {
+    random_generators_.emplace_back(
+        operator_def.device_option().random_seed() + i);
+  }
+  if (decode_threads_ > 1) {
+    decode_pool_.reset(new ThreadPool(decode_threads_));
+  }
   db_.reset(db::CreateDB(db_type_, db_name_, db::READ));
   cursor_.reset(db_->NewCursor());
   cursor_->SeekToFirst();
-  prefetched_image_.Reshape(
-      vector<int>{batch_size_, crop_, crop_, (color_ ? 3 : 1)});
-  prefetched_label_.Reshape(vector<int>(1, batch_size_));
+  for (int slot = 0; slot < prefetch_depth_; ++slot) {
+    prefetched_image_.emplace_back(new Tensor<float, CPUContext>(image_dims_));
+    prefetched_label_.emplace_back(
+        new Tensor<int, CPUContext>(vector<int>(1, batch_size_)));
+  }
 }
 
 template <class DeviceContext>
@@ -175,88 +263,148 @@ bool ImageInputOp<DeviceContext>::GetImageAndLabelFromDBValue(
 }
 
 template <class DeviceContext>
-bool ImageInputOp<DeviceContext>::Prefetch() {
+void ImageInputOp<DeviceContext>::DecodeItem(
+    const string& value, std::mt19937* random_generator, float* image_data,
+    int* label) {
   std::bernoulli_distribution mirror_this_image(0.5);
-  float* image_data = prefetched_image_.mutable_data();
-  int channels = color_ ? 3 : 1;
-  for (int item_id = 0; item_id < batch_size_; ++item_id) {
-    // LOG(INFO) << "Prefetching item " << item_id;
-    // process data
-    cv::Mat img;
-    int label;
-    cv::Mat scaled_img;
-    CHECK(GetImageAndLabelFromDBValue(cursor_->value(), &img, &label));
-    // deal with scaling.
-    int scaled_width, scaled_height;
-    if (warp_) {
-      scaled_width = scale_;
-      scaled_height = scale_;
-    } else if (img.rows > img.cols) {
-      scaled_width = scale_;
-      scaled_height = static_cast<float>(img.rows) * scale_ / img.cols;
-    } else {
-      scaled_height = scale_;
-      scaled_width = static_cast<float>(img.cols) * scale_ / img.rows;
-    }
-    cv::resize(img, scaled_img, cv::Size(scaled_width, scaled_height),
-               0, 0, cv::INTER_LINEAR);
-    // find the cropped region, and copy it to the destination matrix with
-    // mean subtraction and scaling.
-    int width_offset =
-        std::uniform_int_distribution<>(0, scaled_img.cols - crop_)(
-            cpu_context_.RandGenerator());
-    int height_offset =
-        std::uniform_int_distribution<>(0, scaled_img.rows - crop_)(
-            cpu_context_.RandGenerator());
-    // DVLOG(1) << "offset: " << height_offset << ", " << width_offset;
-    if (mirror_ && mirror_this_image(cpu_context_.RandGenerator())) {
-      // Copy mirrored image.
-      for (int h = height_offset; h < height_offset + crop_; ++h) {
-        for (int w = width_offset + crop_ - 1; w >= width_offset; --w) {
-          const cv::Vec3b& cv_data = scaled_img.at<cv::Vec3b>(h, w);
+  cv::Mat img;
+  cv::Mat scaled_img;
+  CHECK(GetImageAndLabelFromDBValue(value, &img, label));
+  // deal with scaling.
+  int scaled_width, scaled_height;
+  if (warp_) {
+    scaled_width = scale_;
+    scaled_height = scale_;
+  } else if (img.rows > img.cols) {
+    scaled_width = scale_;
+    scaled_height = static_cast<float>(img.rows) * scale_ / img.cols;
+  } else {
+    scaled_height = scale_;
+    scaled_width = static_cast<float>(img.cols) * scale_ / img.rows;
+  }
+  cv::resize(img, scaled_img, cv::Size(scaled_width, scaled_height),
+             0, 0, cv::INTER_LINEAR);
+  // find the cropped region, and copy it to the destination matrix with
+  // mean subtraction and scaling.
+  int width_offset =
+      std::uniform_int_distribution<>(0, scaled_img.cols - crop_)(
+          *random_generator);
+  int height_offset =
+      std::uniform_int_distribution<>(0, scaled_img.rows - crop_)(
+          *random_generator);
+  // DVLOG(1) << "offset: " << height_offset << ", " << width_offset;
+  const bool mirror = mirror_ && mirror_this_image(*random_generator);
+  CropMirrorNormalize(scaled_img, height_offset, width_offset, mirror,
+                      image_data);
+}
+
+template <class DeviceContext>
+void ImageInputOp<DeviceContext>::CropMirrorNormalize(
+    const cv::Mat& scaled_img, int height_offset, int width_offset,
+    bool mirror, float* image_data) {
+  const int channels = color_ ? 3 : 1;
+  const int row_size = crop_ * channels;
+  const float* row_scale = row_scale_.data();
+  const float* row_bias = row_bias_.data();
+  // The loops below read the rows of the image through plain pointers and
+  // have no dependencies between iterations, so that the compiler can
+  // vectorize them.
+  for (int h = 0; h < crop_; ++h) {
+    const uchar* src =
+        scaled_img.ptr<uchar>(height_offset + h) + width_offset * channels;
+    if (order_ == StorageOrder::NHWC) {
+      float* dst = image_data + h * row_size;
+      if (!mirror) {
+        for (int i = 0; i < row_size; ++i) {
+          dst[i] = src[i] * row_scale[i] + row_bias[i];
+        }
+      } else {
+        for (int w = 0; w < crop_; ++w) {
+          const uchar* src_pixel = src + (crop_ - 1 - w) * channels;
           for (int c = 0; c < channels; ++c) {
-            *(image_data++) =
-                (static_cast<uint8_t>(cv_data[c]) - mean_) / std_;
+            dst[w * channels + c] =
+                src_pixel[c] * channel_scale_[c] + channel_bias_[c];
           }
         }
       }
     } else {
-      // Copy normally.
-      for (int h = height_offset; h < height_offset + crop_; ++h) {
-        for (int w = width_offset; w < width_offset + crop_; ++w) {
-          const cv::Vec3b& cv_data = scaled_img.at<cv::Vec3b>(h, w);
-          for (int c = 0; c < channels; ++c) {
-            *(image_data++) =
-                (static_cast<uint8_t>(cv_data[c]) - mean_) / std_;
+      for (int c = 0; c < channels; ++c) {
+        float* dst = image_data + (c * crop_ + h) * crop_;
+        const float scale = channel_scale_[c];
+        const float bias = channel_bias_[c];
+        if (!mirror) {
+          for (int w = 0; w < crop_; ++w) {
+            dst[w] = src[w * channels + c] * scale + bias;
+          }
+        } else {
+          for (int w = 0; w < crop_; ++w) {
+            dst[w] = src[(crop_ - 1 - w) * channels + c] * scale + bias;
           }
         }
       }
     }
-    // Copy the label
-    prefetched_label_.mutable_data()[item_id] = label;
+  }
+}
+
+template <class DeviceContext>
+bool ImageInputOp<DeviceContext>::Prefetch(int slot) {
+  const int image_size = crop_ * crop_ * (color_ ? 3 : 1);
+  float* image_data =
+      MutablePrefetchData(image_dims_, prefetched_image_[slot].get());
+  int* label_data = MutablePrefetchData(
+      vector<int>(1, batch_size_), prefetched_label_[slot].get());
+  // The cursor is read on this thread, and the images are written straight
+  // to their place in the batch by the decode threads.
+  vector<string> values(batch_size_);
+  for (int item_id = 0; item_id < batch_size_; ++item_id) {
+    values[item_id] = cursor_->value();
     // Advance to the next item.
     cursor_->Next();
     if (!cursor_->Valid()) {
       cursor_->SeekToFirst();
     }
   }
+  auto decode_items = [&](int stream) {
+    for (int item_id = stream; item_id < batch_size_;
+         item_id += decode_threads_) {
+      DecodeItem(values[item_id], &random_generators_[stream],
+                 image_data + item_id * image_size, label_data + item_id);
+    }
+  };
+  if (decode_pool_ == nullptr) {
+    decode_items(0);
+    return true;
+  }
+  std::mutex decode_mutex;
+  std::condition_variable decode_cv;
+  int remaining_streams = decode_threads_;
+  for (int stream = 0; stream < decode_threads_; ++stream) {
+    decode_pool_->RunTask([&decode_items, stream, &decode_mutex, &decode_cv,
+                           &remaining_streams]() {
+      decode_items(stream);
+      std::lock_guard<std::mutex> lock(decode_mutex);
+      if (--remaining_streams == 0) {
+        decode_cv.notify_one();
+      }
+    });
+  }
+  std::unique_lock<std::mutex> lock(decode_mutex);
+  decode_cv.wait(lock, [&remaining_streams]() {
+    return remaining_streams == 0;
+  });
   return true;
 }
 
 template <class DeviceContext>
-bool ImageInputOp<DeviceContext>::CopyPrefetched() {
+bool ImageInputOp<DeviceContext>::CopyPrefetched(int slot) {
   // The first output is the image data.
-  auto* image_output = OperatorBase::Output<Tensor<float, DeviceContext> >(0);
-  image_output->ReshapeLike(prefetched_image_);
-  this->device_context_.template Copy<float, CPUContext, DeviceContext>(
-      prefetched_image_.size(), prefetched_image_.data(),
-      image_output->mutable_data());
+  HandOverPrefetched(prefetched_image_[slot].get(),
+                     OperatorBase::Output<Tensor<float, DeviceContext> >(0),
+                     &this->device_context_);
   // The second output is the label.
-  auto* label_output = OperatorBase::Output<Tensor<int, DeviceContext> >(1);
-  label_output->ReshapeLike(prefetched_label_);
-  this->device_context_.template Copy<int, CPUContext, DeviceContext>(
-      prefetched_label_.size(), prefetched_label_.data(),
-      label_output->mutable_data());
+  HandOverPrefetched(prefetched_label_[slot].get(),
+                     OperatorBase::Output<Tensor<int, DeviceContext> >(1),
+                     &this->device_context_);
   return true;
 }
 
@@ -0,0 +1,296 @@
+#include <unistd.h>
+
+#include <cmath>
+
+#include "caffe2/image/image_input_op.h"
+#include "gtest/gtest.h"
+
+namespace caffe2 {
+
+namespace {
+
+const int kNumRecords = 6;
+
+// The value of the channel c of the pixel (h, w) of the image of a record. It
+// differs between the columns, so that a mirrored crop is told apart from an
+// unmirrored one.
+uchar PixelValue(int record, int h, int w, int c) {
+  return (record * 37 + h * 11 + w * 5 + c * 3) % 256;
+}
+
+// Writes a minidb of kNumRecords encoded size x size images, labeled with the
+// index of their record, and returns its path.
+string WriteImageDB(const string& name, int size, int channels) {
+  const string db_path = "/tmp/image_input_op_test_" + name + "_" +
+      std::to_string(getpid());
+  unique_ptr<db::DB> test_db(db::CreateDB("minidb", db_path, db::NEW));
+  unique_ptr<db::Transaction> transaction(test_db->NewTransaction());
+  for (int record = 0; record < kNumRecords; ++record) {
+    cv::Mat img(size, size, channels == 3 ? CV_8UC3 : CV_8UC1);
+    for (int h = 0; h < size; ++h) {
+      for (int w = 0; w < size; ++w) {
+        for (int c = 0; c < channels; ++c) {
+          img.ptr<uchar>(h)[w * channels + c] = PixelValue(record, h, w, c);
+        }
+      }
+    }
+    std::vector<uchar> encoded;
+    CHECK(cv::imencode(".png", img, encoded));
+    TensorProtos protos;
+    TensorProto* image_proto = protos.add_protos();
+    image_proto->set_data_type(TensorProto::STRING);
+    image_proto->add_string_data(string(encoded.begin(), encoded.end()));
+    TensorProto* label_proto = protos.add_protos();
+    label_proto->set_data_type(TensorProto::INT32);
+    label_proto->add_int32_data(record);
+    string value;
+    protos.SerializeToString(&value);
+    transaction->Put(std::to_string(record), value);
+  }
+  transaction->Commit();
+  return db_path;
+}
+
+void AddArgument(const string& name, int value, OperatorDef* def) {
+  Argument* arg = def->add_arg();
+  arg->set_name(name);
+  arg->set_i(value);
+}
+
+void AddArgument(const string& name, const string& value, OperatorDef* def) {
+  Argument* arg = def->add_arg();
+  arg->set_name(name);
+  arg->set_s(value);
+}
+
+void AddArgument(const string& name, const vector<float>& values,
+                 OperatorDef* def) {
+  Argument* arg = def->add_arg();
+  arg->set_name(name);
+  for (float value : values) {
+    arg->add_floats(value);
+  }
+}
+
+// Returns an ImageInput definition that reads batches of batch_size images,
+// scaled to scale and cropped to crop, from the db.
+OperatorDef ImageInputDef(const string& db_path, int batch_size, int scale,
+                          int crop) {
+  OperatorDef def;
+  def.set_type("ImageInput");
+  def.add_output("data");
+  def.add_output("label");
+  AddArgument("batch_size", batch_size, &def);
+  AddArgument("db", db_path, &def);
+  AddArgument("db_type", string("minidb"), &def);
+  AddArgument("scale", scale, &def);
+  AddArgument("crop", crop, &def);
+  return def;
+}
+
+const Tensor<float, CPUContext>& GetImages(const Workspace& ws) {
+  return ws.GetBlob("data")->Get<Tensor<float, CPUContext> >();
+}
+
+const Tensor<int, CPUContext>& GetLabels(const Workspace& ws) {
+  return ws.GetBlob("label")->Get<Tensor<int, CPUContext> >();
+}
+
+// The value that the image of a record, cropped at the given offsets and
+// optionally mirrored, is expected to have at the channel c of (h, w) of the
+// crop.
+float ExpectedValue(int record, int crop, int height_offset, int width_offset,
+                    bool mirror, int h, int w, int c, float mean, float std) {
+  const int image_w = width_offset + (mirror ? crop - 1 - w : w);
+  return (PixelValue(record, height_offset + h, image_w, c) - mean) / std;
+}
+
+// Whether the item of the batch holds the crop of the record at the given
+// offsets, in the given order.
+bool ItemMatches(const Tensor<float, CPUContext>& images, int item,
+                 int channels, bool nchw, int record, int height_offset,
+                 int width_offset, bool mirror, const vector<float>& mean,
+                 const vector<float>& std) {
+  const int crop = nchw ? images.dim(2) : images.dim(1);
+  const float* item_data = images.data() + item * crop * crop * channels;
+  for (int h = 0; h < crop; ++h) {
+    for (int w = 0; w < crop; ++w) {
+      for (int c = 0; c < channels; ++c) {
+        const float value = nchw ? item_data[(c * crop + h) * crop + w]
+                                 : item_data[(h * crop + w) * channels + c];
+        const float expected = ExpectedValue(
+            record, crop, height_offset, width_offset, mirror, h, w, c,
+            mean[c], std[c]);
+        if (std::abs(value - expected) > 1e-4) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+// With the crop as large as the image, the output is the whole image, in the
+// requested order, normalized per channel.
+TEST(ImageInputTest, TestOrderAndNormalization) {
+  const int size = 5;
+  const int batch_size = 4;
+  const string db_path = WriteImageDB("order", size, 3);
+  const vector<float> mean{10, 100, 50};
+  const vector<float> std{2, 4, 0.5};
+  for (const string order : {"NHWC", "NCHW"}) {
+    const bool nchw = order == "NCHW";
+    Workspace ws;
+    OperatorDef def = ImageInputDef(db_path, batch_size, size, size);
+    AddArgument("order", order, &def);
+    AddArgument("mean_per_channel", mean, &def);
+    AddArgument("std_per_channel", std, &def);
+    unique_ptr<OperatorBase> op(CreateOperator(def, &ws));
+    ASSERT_TRUE(op.get() != nullptr);
+    for (int batch = 0; batch < 2; ++batch) {
+      ASSERT_TRUE(op->Run());
+      auto& images = GetImages(ws);
+      auto& labels = GetLabels(ws);
+      EXPECT_EQ(images.dims(), nchw
+                ? (vector<int>{batch_size, 3, size, size})
+                : (vector<int>{batch_size, size, size, 3}));
+      for (int item = 0; item < batch_size; ++item) {
+        const int record = (batch * batch_size + item) % kNumRecords;
+        EXPECT_EQ(labels.data()[item], record);
+        EXPECT_TRUE(ItemMatches(images, item, 3, nchw, record, 0, 0, false,
+                                mean, std)) << order << " item " << item;
+      }
+    }
+  }
+}
+
+// A single mean and std apply to every channel, and grayscale images have a
+// single channel in either order.
+TEST(ImageInputTest, TestGrayscaleWithScalarNormalization) {
+  const int size = 5;
+  const int batch_size = 3;
+  const string db_path = WriteImageDB("gray", size, 1);
+  for (const string order : {"NHWC", "NCHW"}) {
+    const bool nchw = order == "NCHW";
+    Workspace ws;
+    OperatorDef def = ImageInputDef(db_path, batch_size, size, size);
+    AddArgument("order", order, &def);
+    AddArgument("color", 0, &def);
+    Argument* arg = def.add_arg();
+    arg->set_name("mean");
+    arg->set_f(128);
+    arg = def.add_arg();
+    arg->set_name("std");
+    arg->set_f(64);
+    unique_ptr<OperatorBase> op(CreateOperator(def, &ws));
+    ASSERT_TRUE(op.get() != nullptr);
+    ASSERT_TRUE(op->Run());
+    auto& images = GetImages(ws);
+    EXPECT_EQ(images.dims(), nchw
+              ? (vector<int>{batch_size, 1, size, size})
+              : (vector<int>{batch_size, size, size, 1}));
+    for (int item = 0; item < batch_size; ++item) {
+      EXPECT_TRUE(ItemMatches(images, item, 1, nchw, item, 0, 0, false,
+                              vector<float>{128}, vector<float>{64}))
+          << order << " item " << item;
+    }
+  }
+}
+
+// With mirroring, each image is either the unmirrored or the mirrored crop,
+// and both occur.
+TEST(ImageInputTest, TestMirror) {
+  const int size = 5;
+  const int batch_size = 12;
+  for (int channels : {3, 1}) {
+    const string db_path = WriteImageDB(
+        "mirror" + std::to_string(channels), size, channels);
+    const vector<float> mean(channels, 0);
+    const vector<float> std(channels, 1);
+    for (const string order : {"NHWC", "NCHW"}) {
+      const bool nchw = order == "NCHW";
+      Workspace ws;
+      OperatorDef def = ImageInputDef(db_path, batch_size, size, size);
+      AddArgument("order", order, &def);
+      AddArgument("color", channels == 3 ? 1 : 0, &def);
+      AddArgument("mirror", 1, &def);
+      def.mutable_device_option()->set_random_seed(1701);
+      unique_ptr<OperatorBase> op(CreateOperator(def, &ws));
+      ASSERT_TRUE(op.get() != nullptr);
+      ASSERT_TRUE(op->Run());
+      auto& images = GetImages(ws);
+      int num_mirrored = 0;
+      for (int item = 0; item < batch_size; ++item) {
+        const int record = item % kNumRecords;
+        const bool unmirrored = ItemMatches(
+            images, item, channels, nchw, record, 0, 0, false, mean, std);
+        const bool mirrored = ItemMatches(
+            images, item, channels, nchw, record, 0, 0, true, mean, std);
+        EXPECT_NE(unmirrored, mirrored) << order << " item " << item;
+        num_mirrored += mirrored;
+      }
+      EXPECT_GT(num_mirrored, 0);
+      EXPECT_LT(num_mirrored, batch_size);
+    }
+  }
+}
+
+// Two operators with the same random seed and number of decode threads output
+// the same batches, and each image and label lands in the slot of its item.
+TEST(ImageInputTest, TestDecodeThreadsAreReproducible) {
+  const int size = 7;
+  const int crop = 4;
+  const int batch_size = 5;
+  const string db_path = WriteImageDB("threads", size, 3);
+  const vector<float> mean(3, 0);
+  const vector<float> std(3, 1);
+  for (int decode_threads : {1, 3}) {
+    Workspace ws, other_ws;
+    OperatorDef def = ImageInputDef(db_path, batch_size, size, crop);
+    AddArgument("mirror", 1, &def);
+    AddArgument("decode_threads", decode_threads, &def);
+    def.mutable_device_option()->set_random_seed(1701);
+    unique_ptr<OperatorBase> op(CreateOperator(def, &ws));
+    unique_ptr<OperatorBase> other_op(CreateOperator(def, &other_ws));
+    ASSERT_TRUE(op.get() != nullptr);
+    ASSERT_TRUE(other_op.get() != nullptr);
+    for (int batch = 0; batch < 3; ++batch) {
+      ASSERT_TRUE(op->Run());
+      ASSERT_TRUE(other_op->Run());
+      auto& images = GetImages(ws);
+      auto& other_images = GetImages(other_ws);
+      auto& labels = GetLabels(ws);
+      auto& other_labels = GetLabels(other_ws);
+      ASSERT_EQ(images.dims(), other_images.dims());
+      for (int i = 0; i < images.size(); ++i) {
+        EXPECT_EQ(images.data()[i], other_images.data()[i])
+            << decode_threads << " threads, batch " << batch << ", value "
+            << i;
+      }
+      for (int item = 0; item < batch_size; ++item) {
+        const int record = (batch * batch_size + item) % kNumRecords;
+        EXPECT_EQ(labels.data()[item], record);
+        EXPECT_EQ(other_labels.data()[item], record);
+        // The image is some crop of the image of its record.
+        bool found = false;
+        for (int height_offset = 0; height_offset <= size - crop;
+             ++height_offset) {
+          for (int width_offset = 0; width_offset <= size - crop;
+               ++width_offset) {
+            for (bool mirror : {false, true}) {
+              found |= ItemMatches(images, item, 3, false, record,
+                                   height_offset, width_offset, mirror, mean,
+                                   std);
+            }
+          }
+        }
+        EXPECT_TRUE(found) << decode_threads << " threads, batch " << batch
+                           << ", item " << item;
+      }
+    }
+  }
+}
+
+}  // namespace caffe2
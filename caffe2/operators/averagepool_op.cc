@@ -1,4 +1,5 @@
 #include "caffe2/operators/averagepool_op.h"
+#include "caffe2/utils/parallel_for.h"
 
 namespace caffe2 {
 
@@ -21,8 +22,12 @@ bool AveragePoolOp<float, CPUContext>::RunOnDeviceWithOrderNCHW() {
   int width = X.dim(3);
   int pooled_height = Y->dim(2);
   int pooled_width = Y->dim(3);
-  for (int n = 0; n < X.dim(0); ++n) {
-    for (int c = 0; c < channels; ++c) {
+  // The channels of all the images are pooled independently.
+  const int num_planes = X.dim(0) * channels;
+  ParallelFor<CPUContext>(num_planes, [&](int begin, int end, int worker) {
+    for (int plane = begin; plane < end; ++plane) {
+      const float* plane_Xdata = Xdata + plane * height * width;
+      float* plane_Ydata = Ydata + plane * pooled_height * pooled_width;
       for (int ph = 0; ph < pooled_height; ++ph) {
         for (int pw = 0; pw < pooled_width; ++pw) {
           int hstart = ph * stride_h_ - pad_t_;
@@ -35,17 +40,14 @@ bool AveragePoolOp<float, CPUContext>::RunOnDeviceWithOrderNCHW() {
           for (int h = hstart; h < hend; ++h) {
             for (int w = wstart; w < wend; ++w) {
               const int input_index = h * width + w;
-              Ydata[pool_index] += Xdata[input_index];
+              plane_Ydata[pool_index] += plane_Xdata[input_index];
             }
           }
-          Ydata[pool_index] /= (hend - hstart) * (wend - wstart);
+          plane_Ydata[pool_index] /= (hend - hstart) * (wend - wstart);
         }
       }
-      // Do offset.
-      Xdata += height * width;
-      Ydata += pooled_height * pooled_width;
     }
-  }
+  });
   return true;
 }
 
@@ -63,8 +65,15 @@ bool AveragePoolOp<float, CPUContext>::RunOnDeviceWithOrderNHWC() {
   // The main loop
   int pooled_height = Y->dim(1);
   int pooled_width = Y->dim(2);
-  for (int n = 0; n < X.dim(0); ++n) {
-    for (int ph = 0; ph < pooled_height; ++ph) {
+  const int input_offset = X.size() / X.dim(0);
+  const int output_offset = Y->size() / Y->dim(0);
+  // The rows of pooled outputs of all the images are computed independently.
+  const int num_rows = X.dim(0) * pooled_height;
+  ParallelFor<CPUContext>(num_rows, [&](int begin, int end, int worker) {
+    for (int row = begin; row < end; ++row) {
+      const int ph = row % pooled_height;
+      const float* image_Xdata = Xdata + (row / pooled_height) * input_offset;
+      float* image_Ydata = Ydata + (row / pooled_height) * output_offset;
       for (int pw = 0; pw < pooled_width; ++pw) {
         int hstart = ph * stride_h_ - pad_t_;
         int wstart = pw * stride_w_ - pad_l_;
@@ -77,20 +86,17 @@ bool AveragePoolOp<float, CPUContext>::RunOnDeviceWithOrderNHWC() {
           for (int w = wstart; w < wend; ++w) {
             const int input_index = (h * width + w) * channels;
             for (int c = 0; c < channels; ++c) {
-              Ydata[pool_index + c] += Xdata[input_index + c];
+              image_Ydata[pool_index + c] += image_Xdata[input_index + c];
             }
           }
         }
         float scale = 1. / (hend - hstart) / (wend - wstart);
         for (int c = 0; c < channels; ++c) {
-          Ydata[pool_index + c] *= scale;
+          image_Ydata[pool_index + c] *= scale;
         }
       }
     }
-    // Do offset.
-    Xdata += X.size() / X.dim(0);
-    Ydata += Y->size() / Y->dim(0);
-  }
+  });
   return true;
 }
 
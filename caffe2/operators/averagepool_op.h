@@ -20,6 +20,16 @@ class AveragePoolOp final : public ConvPoolOpBase<dtype, DeviceContext> {
   bool RunOnDeviceWithOrderNCHW() override;
   bool RunOnDeviceWithOrderNHWC() override;
 
+  bool InferOutputShapes(const vector<TensorShape>& input_shapes,
+                         vector<TensorShape>* output_shapes) override {
+    if (input_shapes[0].dims.size() != 4) {
+      return false;
+    }
+    output_shapes->resize(1);
+    return InferOutputShape(input_shapes[0], InputChannels(input_shapes[0]),
+                            &(*output_shapes)[0]);
+  }
+
   // Input: X
   // Output: Y
   INPUT_OUTPUT_STATS(1, 1, 1, 1);
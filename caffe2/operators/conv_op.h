@@ -19,6 +19,17 @@ class ConvOp final : public ConvPoolOpBase<dtype, DeviceContext> {
   bool RunOnDeviceWithOrderNCHW() override;
   bool RunOnDeviceWithOrderNHWC() override;
 
+  bool InferOutputShapes(const vector<TensorShape>& input_shapes,
+                         vector<TensorShape>* output_shapes) override {
+    if (input_shapes[FILTER].dims.size() != 4) {
+      return false;
+    }
+    output_shapes->resize(1);
+    return InferOutputShape(input_shapes[INPUT],
+                            input_shapes[FILTER].dims[0],
+                            &(*output_shapes)[0]);
+  }
+
  private:
   Tensor<dtype, DeviceContext> col_buffer_;
   Tensor<dtype, DeviceContext> bias_multiplier_;
@@ -46,6 +57,9 @@ class ConvGradientOp final : public ConvPoolOpBase<dtype, DeviceContext> {
  private:
   Tensor<dtype, DeviceContext> col_buffer_;
   Tensor<dtype, DeviceContext> bias_multiplier_;
+  // The filter and bias gradients accumulated by the workers of ParallelFor()
+  // other than the first one, which accumulates into the outputs directly.
+  Tensor<dtype, DeviceContext> worker_gradients_;
   Tensor<dtype, DeviceContext> kOne;
   Tensor<dtype, DeviceContext> kZero;
   // input: X, W, dY
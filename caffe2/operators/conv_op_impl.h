@@ -7,6 +7,7 @@
 #include "caffe2/operators/conv_op.h"
 #include "caffe2/operators/conv_pool_op_base.h"
 #include "caffe2/utils/math.h"
+#include "caffe2/utils/parallel_for.h"
 #include "glog/logging.h"
 
 namespace caffe2 {
@@ -35,9 +36,12 @@ bool ConvOp<dtype, DeviceContext>::RunOnDeviceWithOrderNCHW() {
   // The output image size is the spatial size of the output.
   const int output_image_size = Y->dim(2) * Y->dim(3);
   // The col buffer is stored in CHW order as well - kernel_dim, and the height
-  // and width.
+  // and width. The images are split across the workers of ParallelFor(), and
+  // each worker has a col buffer of its own.
+  const int num_workers = NumParallelForWorkers<DeviceContext>(N);
+  const int col_buffer_size = kernel_dim * output_image_size;
   col_buffer_.Reshape(std::vector<int>{
-      C, kernel_h_, kernel_w_, Y->dim(2), Y->dim(3)});
+      num_workers, C, kernel_h_, kernel_w_, Y->dim(2), Y->dim(3)});
   if (bias_multiplier_.size() != output_image_size) {
     // If the helper bias multiplier is not M, reshape and fill it with one.
     bias_multiplier_.Reshape(std::vector<int>(1, output_image_size));
@@ -49,24 +53,26 @@ bool ConvOp<dtype, DeviceContext>::RunOnDeviceWithOrderNCHW() {
   dtype* col_buffer_data = col_buffer_.mutable_data();
   dtype* Ydata = Y->mutable_data();
   // Im2col, followed by gemm.
-  for (int image_id = 0; image_id < N; ++image_id) {
-    math::Im2col<dtype, DeviceContext, StorageOrder::NCHW>(
-        Xdata, C, H, W, kernel_h_, kernel_w_,
-        pad_t_, pad_l_, pad_b_, pad_r_, stride_h_, stride_w_, col_buffer_data,
-        &device_context_);
-    // Weight term
-    math::Gemm<dtype, DeviceContext>(
-        CblasNoTrans, CblasNoTrans, M, output_image_size, kernel_dim,
-        kOne.data(), filter.data(), col_buffer_data, kZero.data(), Ydata,
-        &device_context_);
-    // Bias term
-    math::Gemm<dtype, DeviceContext>(
-        CblasNoTrans, CblasNoTrans, M, output_image_size, 1, kOne.data(),
-        bias.data(), bias_multiplier_.data(), kOne.data(), Ydata,
-        &device_context_);
-    Xdata += input_offset;
-    Ydata += output_offset;
-  }
+  ParallelFor<DeviceContext>(N, [&](int begin, int end, int worker) {
+    dtype* worker_col_buffer_data = col_buffer_data + worker * col_buffer_size;
+    for (int image_id = begin; image_id < end; ++image_id) {
+      dtype* image_Ydata = Ydata + image_id * output_offset;
+      math::Im2col<dtype, DeviceContext, StorageOrder::NCHW>(
+          Xdata + image_id * input_offset, C, H, W, kernel_h_, kernel_w_,
+          pad_t_, pad_l_, pad_b_, pad_r_, stride_h_, stride_w_,
+          worker_col_buffer_data, &device_context_);
+      // Weight term
+      math::Gemm<dtype, DeviceContext>(
+          CblasNoTrans, CblasNoTrans, M, output_image_size, kernel_dim,
+          kOne.data(), filter.data(), worker_col_buffer_data, kZero.data(),
+          image_Ydata, &device_context_);
+      // Bias term
+      math::Gemm<dtype, DeviceContext>(
+          CblasNoTrans, CblasNoTrans, M, output_image_size, 1, kOne.data(),
+          bias.data(), bias_multiplier_.data(), kOne.data(), image_Ydata,
+          &device_context_);
+    }
+  });
   return true;
 }
 
@@ -129,29 +135,34 @@ bool ConvOp<dtype, DeviceContext>::RunOnDeviceWithOrderNHWC() {
           output_image_size, static_cast<dtype>(1),
           bias_multiplier_.mutable_data(), &device_context_);
     }
+    // Each worker of ParallelFor() has a col buffer of its own.
+    const int num_workers = NumParallelForWorkers<DeviceContext>(N);
+    const int col_buffer_size = output_image_size * kernel_dim;
     col_buffer_.Reshape(std::vector<int>{
-        Y->dim(1), Y->dim(2), kernel_h_, kernel_w_, C});
+        num_workers, Y->dim(1), Y->dim(2), kernel_h_, kernel_w_, C});
     dtype* col_buffer_data = col_buffer_.mutable_data();
     // Im2col, followed by gemm.
-    for (int image_id = 0; image_id < N; ++image_id) {
-      math::Im2col<dtype, DeviceContext, StorageOrder::NHWC>(
-          Xdata, C, H, W, kernel_h_, kernel_w_,
-          pad_t_, pad_l_, pad_b_, pad_r_, stride_h_, stride_w_, col_buffer_data,
-          &device_context_);
-      // Weight term
-      // Wait, is this right....?
-      math::Gemm<dtype, DeviceContext>(
-          CblasNoTrans, CblasTrans, output_image_size, M, kernel_dim,
-          kOne.data(), col_buffer_data, filter.data(), kZero.data(), Ydata,
-          &device_context_);
-      // Bias term
-      math::Gemm<dtype, DeviceContext>(
-          CblasNoTrans, CblasNoTrans, output_image_size, M, 1, kOne.data(),
-          bias_multiplier_.data(), bias.data(), kOne.data(), Ydata,
-          &device_context_);
-      Xdata += input_offset;
-      Ydata += output_offset;
-    }
+    ParallelFor<DeviceContext>(N, [&](int begin, int end, int worker) {
+      dtype* worker_col_buffer_data =
+          col_buffer_data + worker * col_buffer_size;
+      for (int image_id = begin; image_id < end; ++image_id) {
+        dtype* image_Ydata = Ydata + image_id * output_offset;
+        math::Im2col<dtype, DeviceContext, StorageOrder::NHWC>(
+            Xdata + image_id * input_offset, C, H, W, kernel_h_, kernel_w_,
+            pad_t_, pad_l_, pad_b_, pad_r_, stride_h_, stride_w_,
+            worker_col_buffer_data, &device_context_);
+        // Weight term
+        math::Gemm<dtype, DeviceContext>(
+            CblasNoTrans, CblasTrans, output_image_size, M, kernel_dim,
+            kOne.data(), worker_col_buffer_data, filter.data(), kZero.data(),
+            image_Ydata, &device_context_);
+        // Bias term
+        math::Gemm<dtype, DeviceContext>(
+            CblasNoTrans, CblasNoTrans, output_image_size, M, 1, kOne.data(),
+            bias_multiplier_.data(), bias.data(), kOne.data(), image_Ydata,
+            &device_context_);
+      }
+    });
   }
   return true;
 }
@@ -181,8 +192,11 @@ bool ConvGradientOp<dtype, DeviceContext>::RunOnDeviceWithOrderNCHW() {
   // The output image size is the spatial size of the output.
   const int output_image_size = dY.dim(2) * dY.dim(3);
   // The col buffer is stored in CHW order as well - kernel_dim, and the height
-  // and width.
-  col_buffer_.Reshape(std::vector<int>{kernel_dim, output_image_size});
+  // and width. Each worker of ParallelFor() has a col buffer of its own.
+  const int num_workers = NumParallelForWorkers<DeviceContext>(N);
+  const int col_buffer_size = kernel_dim * output_image_size;
+  col_buffer_.Reshape(
+      std::vector<int>{num_workers, kernel_dim, output_image_size});
   if (bias_multiplier_.size() != output_image_size) {
     // If the helper bias multiplier is not M, reshape and fill it with one.
     bias_multiplier_.Reshape(std::vector<int>(1, output_image_size));
@@ -196,47 +210,76 @@ bool ConvGradientOp<dtype, DeviceContext>::RunOnDeviceWithOrderNCHW() {
   dtype* col_buffer_data = col_buffer_.mutable_data();
   dtype* dfilter_data = dfilter->mutable_data();
   dtype* dbias_data = dbias->mutable_data();
+  dtype* dXdata = nullptr;
+  if (OutputSize() == 3) {
+    auto *dX = Output(INPUT_GRAD);
+    dX->ReshapeLike(X);
+    dXdata = dX->mutable_data();
+  }
   // Pre-setting the gradients to zero.
+  const int gradient_size = dfilter->size() + M;
+  dtype* worker_gradients_data = nullptr;
   math::Set<dtype, DeviceContext>(dfilter->size(), 0, dfilter_data,
                                   &device_context_);
   math::Set<dtype, DeviceContext>(dbias->size(), 0, dbias_data,
                                   &device_context_);
-  for (int image_id = 0; image_id < N; ++image_id) {
-    // When we compute the gradient with respect to the filters, we need to do
-    // im2col to allow gemm-type computation.
-    math::Im2col<dtype, DeviceContext, StorageOrder::NCHW>(
-        Xdata, C, H, W, kernel_h_, kernel_w_,
-        pad_t_, pad_l_, pad_b_, pad_r_, stride_h_, stride_w_, col_buffer_data,
-        &device_context_);
-    // Gradient with respect to filter.
-    math::Gemm<dtype, DeviceContext>(
-        CblasNoTrans, CblasTrans, M, kernel_dim, output_image_size,
-        kOne.data(), dYdata + output_offset * image_id, col_buffer_data,
-        kOne.data(), dfilter_data, &device_context_);
-    // Gradient with respect to bias
-    math::Gemv<dtype, DeviceContext>(
-        CblasNoTrans, M, output_image_size, kOne.data(),
-        dYdata + output_offset * image_id, bias_multiplier_.data(),
-        kOne.data(), dbias_data, &device_context_);
-    Xdata += input_offset;
+  if (num_workers > 1) {
+    worker_gradients_.Reshape(
+        std::vector<int>{num_workers - 1, gradient_size});
+    worker_gradients_data = worker_gradients_.mutable_data();
+    math::Set<dtype, DeviceContext>(worker_gradients_.size(), 0,
+                                    worker_gradients_data, &device_context_);
   }
-  if (OutputSize() == 3) {
-    // Compute the gradient w.r.t. the input.
-    auto *dX = Output(INPUT_GRAD);
-    dX->ReshapeLike(X);
-    dtype* dXdata = dX->mutable_data();
-    for (int image_id = 0; image_id < N; ++image_id) {
-      // Compute gradient into col_buffer.
+  ParallelFor<DeviceContext>(N, [&](int begin, int end, int worker) {
+    dtype* worker_col_buffer_data = col_buffer_data + worker * col_buffer_size;
+    dtype* worker_dfilter_data = dfilter_data;
+    dtype* worker_dbias_data = dbias_data;
+    if (worker > 0) {
+      worker_dfilter_data =
+          worker_gradients_data + (worker - 1) * gradient_size;
+      worker_dbias_data = worker_dfilter_data + dfilter->size();
+    }
+    for (int image_id = begin; image_id < end; ++image_id) {
+      // When we compute the gradient with respect to the filters, we need to
+      // do im2col to allow gemm-type computation.
+      math::Im2col<dtype, DeviceContext, StorageOrder::NCHW>(
+          Xdata + input_offset * image_id, C, H, W, kernel_h_, kernel_w_,
+          pad_t_, pad_l_, pad_b_, pad_r_, stride_h_, stride_w_,
+          worker_col_buffer_data, &device_context_);
+      // Gradient with respect to filter.
       math::Gemm<dtype, DeviceContext>(
-          CblasTrans, CblasNoTrans, kernel_dim, output_image_size, M,
-          kOne.data(), filter_data, dYdata + output_offset * image_id,
-          kZero.data(), col_buffer_data, &device_context_);
-      math::Col2im<dtype, DeviceContext, StorageOrder::NCHW>(
-          col_buffer_data, C, H, W, kernel_h_, kernel_w_,
-          pad_t_, pad_l_, pad_b_, pad_r_,
-          stride_h_, stride_w_, dXdata, &device_context_);
-      dXdata += input_offset;
+          CblasNoTrans, CblasTrans, M, kernel_dim, output_image_size,
+          kOne.data(), dYdata + output_offset * image_id,
+          worker_col_buffer_data, kOne.data(), worker_dfilter_data,
+          &device_context_);
+      // Gradient with respect to bias
+      math::Gemv<dtype, DeviceContext>(
+          CblasNoTrans, M, output_image_size, kOne.data(),
+          dYdata + output_offset * image_id, bias_multiplier_.data(),
+          kOne.data(), worker_dbias_data, &device_context_);
+      if (dXdata) {
+        // Compute the gradient w.r.t. the input into col_buffer.
+        math::Gemm<dtype, DeviceContext>(
+            CblasTrans, CblasNoTrans, kernel_dim, output_image_size, M,
+            kOne.data(), filter_data, dYdata + output_offset * image_id,
+            kZero.data(), worker_col_buffer_data, &device_context_);
+        math::Col2im<dtype, DeviceContext, StorageOrder::NCHW>(
+            worker_col_buffer_data, C, H, W, kernel_h_, kernel_w_,
+            pad_t_, pad_l_, pad_b_, pad_r_, stride_h_, stride_w_,
+            dXdata + input_offset * image_id, &device_context_);
+      }
     }
+  });
+  // Sum up the gradients of the other workers.
+  for (int worker = 1; worker < num_workers; ++worker) {
+    const dtype* worker_dfilter_data =
+        worker_gradients_data + (worker - 1) * gradient_size;
+    math::Add<dtype, DeviceContext>(
+        dfilter->size(), dfilter_data, worker_dfilter_data, dfilter_data,
+        &device_context_);
+    math::Add<dtype, DeviceContext>(
+        M, dbias_data, worker_dfilter_data + dfilter->size(), dbias_data,
+        &device_context_);
   }
   return true;
 }
@@ -265,9 +308,12 @@ bool ConvGradientOp<dtype, DeviceContext>::RunOnDeviceWithOrderNHWC() {
   const int output_offset = dY.size() / dY.dim(0);
   // The output image size is the spatial size of the output.
   const int output_image_size = dY.dim(1) * dY.dim(2);
-  // The col buffer is stored in CHW order as well - kernel_dim, and the height
-  // and width.
-  col_buffer_.Reshape(std::vector<int>{output_image_size, kernel_dim});
+  // The col buffer is stored in HWC order as well - the height and width, and
+  // kernel_dim. Each worker of ParallelFor() has a col buffer of its own.
+  const int num_workers = NumParallelForWorkers<DeviceContext>(N);
+  const int col_buffer_size = output_image_size * kernel_dim;
+  col_buffer_.Reshape(
+      std::vector<int>{num_workers, output_image_size, kernel_dim});
   if (bias_multiplier_.size() != output_image_size) {
     // If the helper bias multiplier is not M, reshape and fill it with one.
     bias_multiplier_.Reshape(std::vector<int>(1, output_image_size));
@@ -281,47 +327,76 @@ bool ConvGradientOp<dtype, DeviceContext>::RunOnDeviceWithOrderNHWC() {
   dtype* col_buffer_data = col_buffer_.mutable_data();
   dtype* dfilter_data = dfilter->mutable_data();
   dtype* dbias_data = dbias->mutable_data();
+  dtype* dXdata = nullptr;
+  if (OutputSize() == 3) {
+    auto *dX = Output(INPUT_GRAD);
+    dX->ReshapeLike(X);
+    dXdata = dX->mutable_data();
+  }
   // Pre-setting the gradients to zero.
+  const int gradient_size = dfilter->size() + M;
+  dtype* worker_gradients_data = nullptr;
   math::Set<dtype, DeviceContext>(dfilter->size(), 0, dfilter_data,
                                   &device_context_);
   math::Set<dtype, DeviceContext>(dbias->size(), 0, dbias_data,
                                   &device_context_);
-  for (int image_id = 0; image_id < N; ++image_id) {
-    // When we compute the gradient with respect to the filters, we need to do
-    // im2col to allow gemm-type computation.
-    math::Im2col<dtype, DeviceContext, StorageOrder::NHWC>(
-        Xdata, C, H, W, kernel_h_, kernel_w_,
-        pad_t_, pad_l_, pad_b_, pad_r_, stride_h_, stride_w_, col_buffer_data,
-        &device_context_);
-    // Gradient with respect to filter.
-    math::Gemm<dtype, DeviceContext>(
-        CblasTrans, CblasNoTrans, M, kernel_dim, output_image_size,
-        kOne.data(), dYdata + output_offset * image_id, col_buffer_data,
-        kOne.data(), dfilter_data, &device_context_);
-    // Gradient with respect to bias
-    math::Gemv<dtype, DeviceContext>(
-        CblasTrans, output_image_size, M, kOne.data(),
-        dYdata + output_offset * image_id, bias_multiplier_.data(),
-        kOne.data(), dbias_data, &device_context_);
-    Xdata += input_offset;
+  if (num_workers > 1) {
+    worker_gradients_.Reshape(
+        std::vector<int>{num_workers - 1, gradient_size});
+    worker_gradients_data = worker_gradients_.mutable_data();
+    math::Set<dtype, DeviceContext>(worker_gradients_.size(), 0,
+                                    worker_gradients_data, &device_context_);
   }
-  if (OutputSize() == 3) {
-    // Compute the gradient w.r.t. the input.
-    auto *dX = Output(INPUT_GRAD);
-    dX->ReshapeLike(X);
-    dtype* dXdata = dX->mutable_data();
-    for (int image_id = 0; image_id < N; ++image_id) {
-      // Compute gradient into col_buffer.
+  ParallelFor<DeviceContext>(N, [&](int begin, int end, int worker) {
+    dtype* worker_col_buffer_data = col_buffer_data + worker * col_buffer_size;
+    dtype* worker_dfilter_data = dfilter_data;
+    dtype* worker_dbias_data = dbias_data;
+    if (worker > 0) {
+      worker_dfilter_data =
+          worker_gradients_data + (worker - 1) * gradient_size;
+      worker_dbias_data = worker_dfilter_data + dfilter->size();
+    }
+    for (int image_id = begin; image_id < end; ++image_id) {
+      // When we compute the gradient with respect to the filters, we need to
+      // do im2col to allow gemm-type computation.
+      math::Im2col<dtype, DeviceContext, StorageOrder::NHWC>(
+          Xdata + input_offset * image_id, C, H, W, kernel_h_, kernel_w_,
+          pad_t_, pad_l_, pad_b_, pad_r_, stride_h_, stride_w_,
+          worker_col_buffer_data, &device_context_);
+      // Gradient with respect to filter.
       math::Gemm<dtype, DeviceContext>(
-          CblasNoTrans, CblasNoTrans, output_image_size, kernel_dim, M,
-          kOne.data(), dYdata + output_offset * image_id, filter_data,
-          kZero.data(), col_buffer_data, &device_context_);
-      math::Col2im<dtype, DeviceContext, StorageOrder::NHWC>(
-          col_buffer_data, C, H, W, kernel_h_, kernel_w_,
-          pad_t_, pad_l_, pad_b_, pad_r_,
-          stride_h_, stride_w_, dXdata, &device_context_);
-      dXdata += input_offset;
+          CblasTrans, CblasNoTrans, M, kernel_dim, output_image_size,
+          kOne.data(), dYdata + output_offset * image_id,
+          worker_col_buffer_data, kOne.data(), worker_dfilter_data,
+          &device_context_);
+      // Gradient with respect to bias
+      math::Gemv<dtype, DeviceContext>(
+          CblasTrans, output_image_size, M, kOne.data(),
+          dYdata + output_offset * image_id, bias_multiplier_.data(),
+          kOne.data(), worker_dbias_data, &device_context_);
+      if (dXdata) {
+        // Compute the gradient w.r.t. the input into col_buffer.
+        math::Gemm<dtype, DeviceContext>(
+            CblasNoTrans, CblasNoTrans, output_image_size, kernel_dim, M,
+            kOne.data(), dYdata + output_offset * image_id, filter_data,
+            kZero.data(), worker_col_buffer_data, &device_context_);
+        math::Col2im<dtype, DeviceContext, StorageOrder::NHWC>(
+            worker_col_buffer_data, C, H, W, kernel_h_, kernel_w_,
+            pad_t_, pad_l_, pad_b_, pad_r_, stride_h_, stride_w_,
+            dXdata + input_offset * image_id, &device_context_);
+      }
     }
+  });
+  // Sum up the gradients of the other workers.
+  for (int worker = 1; worker < num_workers; ++worker) {
+    const dtype* worker_dfilter_data =
+        worker_gradients_data + (worker - 1) * gradient_size;
+    math::Add<dtype, DeviceContext>(
+        dfilter->size(), dfilter_data, worker_dfilter_data, dfilter_data,
+        &device_context_);
+    math::Add<dtype, DeviceContext>(
+        M, dbias_data, worker_dfilter_data + dfilter->size(), dbias_data,
+        &device_context_);
   }
   return true;
 }
@@ -0,0 +1,122 @@
+#include "caffe2/operators/conv_op.h"
+#include "caffe2/operators/test_util.h"
+#include "gtest/gtest.h"
+
+namespace caffe2 {
+
+namespace {
+
+const Tensor<float, CPUContext>& GetTensor(const Workspace& ws,
+                                           const string& name) {
+  return ws.GetBlob(name)->Get<Tensor<float, CPUContext> >();
+}
+
+// Copies the items [begin, end) of the first dimension of the blob in ws to
+// the blob with the same name in slice_ws.
+void CopySlice(const Workspace& ws, const string& name, const int begin,
+               const int end, Workspace* slice_ws) {
+  auto& tensor = GetTensor(ws, name);
+  const int item_size = tensor.size() / tensor.dim(0);
+  std::vector<int> dims = tensor.dims();
+  dims[0] = end - begin;
+  auto* slice =
+      slice_ws->CreateBlob(name)->GetMutable<Tensor<float, CPUContext> >();
+  slice->Reshape(dims);
+  for (int i = 0; i < slice->size(); ++i) {
+    slice->mutable_data()[i] = tensor.data()[begin * item_size + i];
+  }
+}
+
+OperatorDef ConvDef(const string& type, const string& order) {
+  OperatorDef def;
+  def.set_type(type);
+  Argument* arg = def.add_arg();
+  arg->set_name("kernel");
+  arg->set_i(3);
+  arg = def.add_arg();
+  arg->set_name("pad");
+  arg->set_i(1);
+  arg = def.add_arg();
+  arg->set_name("order");
+  arg->set_s(order);
+  return def;
+}
+
+void RunOperator(const OperatorDef& def, Workspace* ws) {
+  unique_ptr<OperatorBase> op(CreateOperator(def, ws));
+  ASSERT_TRUE(op.get() != nullptr);
+  ASSERT_TRUE(op->Run());
+}
+
+}  // namespace
+
+// The images of a batch are split across the threads of the CPU context, so
+// convolving a batch should give the same results as convolving its images
+// one at a time.
+TEST(ConvTest, TestBatchMatchesSingleImages) {
+  const int N = 7;
+  for (const string order : {"NCHW", "NHWC"}) {
+    const bool nchw = order == "NCHW";
+    Workspace ws;
+    AddRandomInput(nchw ? std::vector<int>{N, 3, 6, 5}
+                        : std::vector<int>{N, 6, 5, 3}, "X", &ws);
+    AddRandomInput(std::vector<int>{4, 3, 3, 3}, "W", &ws);
+    AddRandomInput(std::vector<int>{4}, "b", &ws);
+    AddRandomInput(nchw ? std::vector<int>{N, 4, 6, 5}
+                        : std::vector<int>{N, 6, 5, 4}, "dY", &ws);
+    OperatorDef conv_def = ConvDef("Conv", order);
+    conv_def.add_input("X");
+    conv_def.add_input("W");
+    conv_def.add_input("b");
+    conv_def.add_output("Y");
+    OperatorDef gradient_def = ConvDef("ConvGradient", order);
+    gradient_def.add_input("X");
+    gradient_def.add_input("W");
+    gradient_def.add_input("dY");
+    gradient_def.add_output("dW");
+    gradient_def.add_output("db");
+    gradient_def.add_output("dX");
+    RunOperator(conv_def, &ws);
+    RunOperator(gradient_def, &ws);
+
+    auto& Y = GetTensor(ws, "Y");
+    auto& dX = GetTensor(ws, "dX");
+    auto& dW = GetTensor(ws, "dW");
+    auto& db = GetTensor(ws, "db");
+    std::vector<float> summed_dW(dW.size(), 0);
+    std::vector<float> summed_db(db.size(), 0);
+    for (int image_id = 0; image_id < N; ++image_id) {
+      Workspace image_ws;
+      CopySlice(ws, "X", image_id, image_id + 1, &image_ws);
+      CopySlice(ws, "dY", image_id, image_id + 1, &image_ws);
+      CopySlice(ws, "W", 0, 4, &image_ws);
+      CopySlice(ws, "b", 0, 4, &image_ws);
+      RunOperator(conv_def, &image_ws);
+      RunOperator(gradient_def, &image_ws);
+      auto& image_Y = GetTensor(image_ws, "Y");
+      for (int i = 0; i < image_Y.size(); ++i) {
+        EXPECT_NEAR(image_Y.data()[i],
+                    Y.data()[image_id * image_Y.size() + i], 1e-4);
+      }
+      auto& image_dX = GetTensor(image_ws, "dX");
+      for (int i = 0; i < image_dX.size(); ++i) {
+        EXPECT_NEAR(image_dX.data()[i],
+                    dX.data()[image_id * image_dX.size() + i], 1e-4);
+      }
+      for (int i = 0; i < dW.size(); ++i) {
+        summed_dW[i] += GetTensor(image_ws, "dW").data()[i];
+      }
+      for (int i = 0; i < db.size(); ++i) {
+        summed_db[i] += GetTensor(image_ws, "db").data()[i];
+      }
+    }
+    for (int i = 0; i < dW.size(); ++i) {
+      EXPECT_NEAR(summed_dW[i], dW.data()[i], 1e-3);
+    }
+    for (int i = 0; i < db.size(); ++i) {
+      EXPECT_NEAR(summed_db[i], db.data()[i], 1e-3);
+    }
+  }
+}
+
+}  // namespace caffe2
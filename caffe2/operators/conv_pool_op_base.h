@@ -111,6 +111,39 @@ class ConvPoolOpBase : public Operator<dtype, DeviceContext> {
             << " W " << output_width;
   }
 
+  // Infers the shape of the output for an input of the given shape, the same
+  // way SetOutputSize() does, but without changing the padding. Returns false
+  // if the input is not a 4-dimensional tensor the kernel fits in.
+  bool InferOutputShape(const TensorShape& input, int output_channel,
+                        TensorShape* output) {
+    if (input.dims.size() != 4) {
+      return false;
+    }
+    const bool channel_first = order_ == StorageOrder::NCHW;
+    const int H = input.dims[channel_first ? 2 : 1];
+    const int W = input.dims[channel_first ? 3 : 2];
+    if (H < kernel_h_ || W < kernel_w_) {
+      return false;
+    }
+    int pad_t = pad_t_, pad_l = pad_l_, pad_b = pad_b_, pad_r = pad_r_;
+    int output_height, output_width;
+    ComputeSizeAndPad(H, stride_h_, kernel_h_, &pad_t, &pad_b, &output_height);
+    ComputeSizeAndPad(W, stride_w_, kernel_w_, &pad_l, &pad_r, &output_width);
+    const int N = input.dims[0];
+    *output = input;
+    if (channel_first) {
+      output->dims = {N, output_channel, output_height, output_width};
+    } else {
+      output->dims = {N, output_height, output_width, output_channel};
+    }
+    return true;
+  }
+
+  // The number of channels of a 4-dimensional input of the given shape.
+  inline int InputChannels(const TensorShape& input) {
+    return input.dims[order_ == StorageOrder::NCHW ? 1 : 3];
+  }
+
   // ComputePads could be used in backward functions to figure out the padding
   // values for the given input.
   void ComputePads(const int height, const int width) {
@@ -241,7 +274,9 @@ class ConvPoolOpBase : public Operator<dtype, DeviceContext> {
   using ConvPoolOpBase<dtype, DeviceContext>::kernel_w_;                       \
   using ConvPoolOpBase<dtype, DeviceContext>::stride_h_;                       \
   using ConvPoolOpBase<dtype, DeviceContext>::stride_w_;                       \
-  using ConvPoolOpBase<dtype, DeviceContext>::order_
+  using ConvPoolOpBase<dtype, DeviceContext>::order_;                          \
+  using ConvPoolOpBase<dtype, DeviceContext>::InferOutputShape;                \
+  using ConvPoolOpBase<dtype, DeviceContext>::InputChannels
 
 }  // namespace caffe2
 
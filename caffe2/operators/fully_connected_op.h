@@ -58,6 +58,17 @@ class FullyConnectedOp final : public Operator<dtype, DeviceContext> {
     return true;
   }
 
+  bool InferOutputShapes(const vector<TensorShape>& input_shapes,
+                         vector<TensorShape>* output_shapes) override {
+    if (input_shapes[0].dims.size() < 2 || input_shapes[1].dims.empty()) {
+      return false;
+    }
+    output_shapes->assign(1, TensorShape(
+        vector<int>{input_shapes[0].dims[0], input_shapes[1].dims[0]},
+        input_shapes[0].data_type));
+    return true;
+  }
+
  protected:
   Tensor<dtype, DeviceContext> bias_multiplier_;
   Tensor<dtype, DeviceContext> kOne;
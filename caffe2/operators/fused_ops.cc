@@ -0,0 +1,305 @@
+#include "caffe2/operators/fused_ops.h"
+#include "caffe2/utils/parallel_for.h"
+
+namespace caffe2 {
+
+using std::max;
+using std::min;
+
+namespace {
+
+// FCRelu computes its output in blocks of about this many bytes, which should
+// stay in the L2 cache between the GEMM and the bias and activation.
+const int kFCReluBlockBytes = 256 * 1024;
+
+// Adds the bias of each channel and applies Relu, in place, to an image of
+// channels x image_size values.
+void AddBiasReluChannelsFirst(const float* bias, const int channels,
+                              const int image_size, float* data) {
+  for (int c = 0; c < channels; ++c) {
+    const float channel_bias = bias[c];
+    for (int i = 0; i < image_size; ++i) {
+      data[i] = max(data[i] + channel_bias, 0.f);
+    }
+    data += image_size;
+  }
+}
+
+// Adds the bias of each channel and applies Relu, in place, to rows x channels
+// values.
+void AddBiasReluChannelsLast(const float* bias, const int rows,
+                             const int channels, float* data) {
+  for (int i = 0; i < rows; ++i) {
+    for (int c = 0; c < channels; ++c) {
+      data[c] = max(data[c] + bias[c], 0.f);
+    }
+    data += channels;
+  }
+}
+
+struct PoolParams {
+  int kernel_h;
+  int kernel_w;
+  int stride_h;
+  int stride_w;
+  int pad_t;
+  int pad_l;
+};
+
+// Max pools a single image in CHW order, the same way MaxPool does.
+void MaxPoolChannelsFirst(const float* X, const int channels, const int height,
+                          const int width, const int pooled_height,
+                          const int pooled_width, const PoolParams& pool,
+                          float* Y) {
+  for (int c = 0; c < channels; ++c) {
+    for (int ph = 0; ph < pooled_height; ++ph) {
+      for (int pw = 0; pw < pooled_width; ++pw) {
+        int hstart = ph * pool.stride_h - pool.pad_t;
+        int wstart = pw * pool.stride_w - pool.pad_l;
+        int hend = min(hstart + pool.kernel_h, height);
+        int wend = min(wstart + pool.kernel_w, width);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        float value = std::numeric_limits<float>::lowest();
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            value = max(value, X[h * width + w]);
+          }
+        }
+        Y[ph * pooled_width + pw] = value;
+      }
+    }
+    X += height * width;
+    Y += pooled_height * pooled_width;
+  }
+}
+
+// Max pools a single image in HWC order, the same way MaxPool does.
+void MaxPoolChannelsLast(const float* X, const int channels, const int height,
+                         const int width, const int pooled_height,
+                         const int pooled_width, const PoolParams& pool,
+                         float* Y) {
+  for (int ph = 0; ph < pooled_height; ++ph) {
+    for (int pw = 0; pw < pooled_width; ++pw) {
+      int hstart = ph * pool.stride_h - pool.pad_t;
+      int wstart = pw * pool.stride_w - pool.pad_l;
+      int hend = min(hstart + pool.kernel_h, height);
+      int wend = min(wstart + pool.kernel_w, width);
+      hstart = max(hstart, 0);
+      wstart = max(wstart, 0);
+      float* Ypool = Y + (ph * pooled_width + pw) * channels;
+      for (int c = 0; c < channels; ++c) {
+        Ypool[c] = std::numeric_limits<float>::lowest();
+      }
+      for (int h = hstart; h < hend; ++h) {
+        for (int w = wstart; w < wend; ++w) {
+          const float* Xpixel = X + (h * width + w) * channels;
+          for (int c = 0; c < channels; ++c) {
+            Ypool[c] = max(Ypool[c], Xpixel[c]);
+          }
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
+
+template <>
+bool ConvReluOp<float, CPUContext>::RunOnDeviceWithOrderNCHW() {
+  auto& X = Input(INPUT);
+  auto& filter = Input(FILTER);
+  auto& bias = Input(BIAS);
+  auto* Y = Output(0);
+  const int N = X.dim(0), C = X.dim(1), H = X.dim(2), W = X.dim(3);
+  DCHECK_EQ(filter.ndim(), 4);
+  const int M = filter.dim(0);
+  DCHECK_EQ(filter.dim(1), C);
+  DCHECK_EQ(filter.dim(2), kernel_h_);
+  DCHECK_EQ(filter.dim(3), kernel_w_);
+  DCHECK_EQ(bias.ndim(), 1);
+  DCHECK_EQ(bias.dim(0), M);
+  // When pooling, each image is convolved into the conv buffer and pooled from
+  // there into the output. The images are split across the workers of
+  // ParallelFor(), and each worker has a col buffer and a conv buffer of its
+  // own.
+  const bool pool = pool_kernel_h_ > 0;
+  auto* conv_output = pool ? &conv_buffer_ : Y;
+  ConvPoolOpBase::SetOutputSize(X, conv_output, M);
+  const int output_height = conv_output->dim(2);
+  const int output_width = conv_output->dim(3);
+  const int num_workers = NumParallelForWorkers<CPUContext>(N);
+  if (pool) {
+    conv_buffer_.Reshape(vector<int>{
+        num_workers, M, output_height, output_width});
+    Y->Reshape(vector<int>{
+        N, M,
+        PooledSize(output_height, pool_kernel_h_, pool_stride_h_, pool_pad_t_,
+                   pool_pad_b_),
+        PooledSize(output_width, pool_kernel_w_, pool_stride_w_, pool_pad_l_,
+                   pool_pad_r_)});
+  }
+  const PoolParams pool_params{pool_kernel_h_, pool_kernel_w_, pool_stride_h_,
+                               pool_stride_w_, pool_pad_t_, pool_pad_l_};
+  const int pooled_height = Y->dim(2);
+  const int pooled_width = Y->dim(3);
+  const int kernel_dim = C * kernel_h_ * kernel_w_;
+  const int input_offset = C * H * W;
+  const int output_offset = Y->size() / N;
+  const int output_image_size = output_height * output_width;
+  const int col_buffer_size = kernel_dim * output_image_size;
+  const int conv_buffer_size = M * output_image_size;
+  col_buffer_.Reshape(vector<int>{
+      num_workers, C, kernel_h_, kernel_w_, output_height, output_width});
+  const float* Xdata = X.data();
+  float* col_buffer_data = col_buffer_.mutable_data();
+  float* conv_buffer_data = pool ? conv_buffer_.mutable_data() : nullptr;
+  float* Ydata = Y->mutable_data();
+  ParallelFor<CPUContext>(N, [&](int begin, int end, int worker) {
+    float* worker_col_buffer_data = col_buffer_data + worker * col_buffer_size;
+    for (int image_id = begin; image_id < end; ++image_id) {
+      float* image_Ydata = Ydata + image_id * output_offset;
+      float* conv_data = pool
+          ? conv_buffer_data + worker * conv_buffer_size : image_Ydata;
+      math::Im2col<float, CPUContext, StorageOrder::NCHW>(
+          Xdata + image_id * input_offset, C, H, W, kernel_h_, kernel_w_,
+          pad_t_, pad_l_, pad_b_, pad_r_, stride_h_, stride_w_,
+          worker_col_buffer_data, &device_context_);
+      math::Gemm<float, CPUContext>(
+          CblasNoTrans, CblasNoTrans, M, output_image_size, kernel_dim,
+          kOne.data(), filter.data(), worker_col_buffer_data, kZero.data(),
+          conv_data, &device_context_);
+      AddBiasReluChannelsFirst(bias.data(), M, output_image_size, conv_data);
+      if (pool) {
+        MaxPoolChannelsFirst(conv_data, M, output_height, output_width,
+                             pooled_height, pooled_width, pool_params,
+                             image_Ydata);
+      }
+    }
+  });
+  return true;
+}
+
+template <>
+bool ConvReluOp<float, CPUContext>::RunOnDeviceWithOrderNHWC() {
+  auto& X = Input(INPUT);
+  auto& filter = Input(FILTER);
+  auto& bias = Input(BIAS);
+  auto* Y = Output(0);
+  const int N = X.dim(0), H = X.dim(1), W = X.dim(2), C = X.dim(3);
+  DCHECK_EQ(filter.ndim(), 4);
+  const int M = filter.dim(0);
+  DCHECK_EQ(filter.dim(1), kernel_h_);
+  DCHECK_EQ(filter.dim(2), kernel_w_);
+  DCHECK_EQ(filter.dim(3), C);
+  DCHECK_EQ(bias.ndim(), 1);
+  DCHECK_EQ(bias.dim(0), M);
+  const bool pool = pool_kernel_h_ > 0;
+  auto* conv_output = pool ? &conv_buffer_ : Y;
+  ConvPoolOpBase::SetOutputSize(X, conv_output, M);
+  const int output_height = conv_output->dim(1);
+  const int output_width = conv_output->dim(2);
+  // Each worker of ParallelFor() has a col buffer and a conv buffer of its own.
+  const int num_workers = NumParallelForWorkers<CPUContext>(N);
+  if (pool) {
+    conv_buffer_.Reshape(vector<int>{
+        num_workers, output_height, output_width, M});
+    Y->Reshape(vector<int>{
+        N,
+        PooledSize(output_height, pool_kernel_h_, pool_stride_h_, pool_pad_t_,
+                   pool_pad_b_),
+        PooledSize(output_width, pool_kernel_w_, pool_stride_w_, pool_pad_l_,
+                   pool_pad_r_),
+        M});
+  }
+  const PoolParams pool_params{pool_kernel_h_, pool_kernel_w_, pool_stride_h_,
+                               pool_stride_w_, pool_pad_t_, pool_pad_l_};
+  const int pooled_height = Y->dim(1);
+  const int pooled_width = Y->dim(2);
+  const int kernel_dim = kernel_h_ * kernel_w_ * C;
+  const int input_offset = H * W * C;
+  const int output_offset = Y->size() / N;
+  const int output_image_size = output_height * output_width;
+  const int col_buffer_size = output_image_size * kernel_dim;
+  const int conv_buffer_size = output_image_size * M;
+  // A 1x1 convolution multiplies the input directly, without im2col.
+  const bool one_by_one =
+      kernel_dim == C && output_height == H && output_width == W;
+  float* col_buffer_data = nullptr;
+  if (!one_by_one) {
+    col_buffer_.Reshape(vector<int>{
+        num_workers, output_height, output_width, kernel_h_, kernel_w_, C});
+    col_buffer_data = col_buffer_.mutable_data();
+  }
+  const float* Xdata = X.data();
+  float* conv_buffer_data = pool ? conv_buffer_.mutable_data() : nullptr;
+  float* Ydata = Y->mutable_data();
+  ParallelFor<CPUContext>(N, [&](int begin, int end, int worker) {
+    for (int image_id = begin; image_id < end; ++image_id) {
+      const float* image_Xdata = Xdata + image_id * input_offset;
+      float* image_Ydata = Ydata + image_id * output_offset;
+      float* conv_data = pool
+          ? conv_buffer_data + worker * conv_buffer_size : image_Ydata;
+      const float* gemm_input = image_Xdata;
+      if (!one_by_one) {
+        float* worker_col_buffer_data =
+            col_buffer_data + worker * col_buffer_size;
+        math::Im2col<float, CPUContext, StorageOrder::NHWC>(
+            image_Xdata, C, H, W, kernel_h_, kernel_w_,
+            pad_t_, pad_l_, pad_b_, pad_r_, stride_h_, stride_w_,
+            worker_col_buffer_data, &device_context_);
+        gemm_input = worker_col_buffer_data;
+      }
+      math::Gemm<float, CPUContext>(
+          CblasNoTrans, CblasTrans, output_image_size, M, kernel_dim,
+          kOne.data(), gemm_input, filter.data(), kZero.data(), conv_data,
+          &device_context_);
+      AddBiasReluChannelsLast(bias.data(), output_image_size, M, conv_data);
+      if (pool) {
+        MaxPoolChannelsLast(conv_data, M, output_height, output_width,
+                            pooled_height, pooled_width, pool_params,
+                            image_Ydata);
+      }
+    }
+  });
+  return true;
+}
+
+template <>
+bool FullyConnectedReluOp<float, CPUContext>::RunOnDevice() {
+  const auto& X = Input(0);
+  const auto& W = Input(1);
+  const auto& b = Input(2);
+  auto* Y = Output(0);
+  DCHECK_GE(X.ndim(), 2);
+  DCHECK_GE(W.ndim(), 2);
+  DCHECK_EQ(b.ndim(), 1);
+  // batch size
+  const int M = X.dim(0);
+  // Feature dimension
+  const int K = X.size() / X.dim(0);
+  // number of outputs.
+  const int N = W.dim(0);
+  DCHECK_EQ(K, W.size() / W.dim(0));
+  DCHECK_EQ(N, b.dim(0));
+  Y->Reshape(vector<int>{M, N});
+  const int block_rows =
+      max(1, kFCReluBlockBytes / static_cast<int>(N * sizeof(float)));
+  const float* Xdata = X.data();
+  float* Ydata = Y->mutable_data();
+  for (int row = 0; row < M; row += block_rows) {
+    const int rows = min(block_rows, M - row);
+    math::Gemm<float, CPUContext>(
+        CblasNoTrans, CblasTrans, rows, N, K, kOne.data(), Xdata + row * K,
+        W.data(), kZero.data(), Ydata + row * N, &device_context_);
+    AddBiasReluChannelsLast(b.data(), rows, N, Ydata + row * N);
+  }
+  return true;
+}
+
+namespace {
+REGISTER_CPU_OPERATOR(ConvRelu, ConvReluOp<float, CPUContext>)
+REGISTER_CPU_OPERATOR(ConvReluMaxPool, ConvReluOp<float, CPUContext>)
+REGISTER_CPU_OPERATOR(FCRelu, FullyConnectedReluOp<float, CPUContext>)
+}  // namespace
+}  // namespace caffe2
@@ -0,0 +1,139 @@
+#ifndef CAFFE2_OPERATORS_FUSED_OPS_H_
+#define CAFFE2_OPERATORS_FUSED_OPS_H_
+
+#include "caffe2/core/context.h"
+#include "caffe2/core/operator.h"
+#include "caffe2/operators/conv_pool_op_base.h"
+#include "caffe2/utils/math.h"
+#include "glog/logging.h"
+
+namespace caffe2 {
+
+// The fused operators below compute a chain of operators in one go, so that
+// the intermediate results are consumed while they are still in cache instead
+// of being written out in full and read back. They are not meant to be written
+// by hand: FuseOperators() in operator_fusion.h puts them in place of the
+// chains they replace. Only CPU implementations exist.
+
+// ConvRelu is Conv followed by Relu, and ConvReluMaxPool additionally max
+// pools the result, which never materializes the unpooled output. The pooling
+// takes explicit pool_kernel_{h,w}, pool_stride_{h,w} and pool_pad_{t,l,b,r}
+// arguments, and unlike MaxPool it does not output the max indices.
+template <typename dtype, class DeviceContext>
+class ConvReluOp final : public ConvPoolOpBase<dtype, DeviceContext> {
+ public:
+  USE_CONV_POOL_BASE_FUNCTIONS;
+  ConvReluOp(const OperatorDef& operator_def, Workspace* ws)
+      : ConvPoolOpBase<dtype, DeviceContext>(operator_def, ws),
+        pool_kernel_h_(OperatorBase::GetSingleArgument<int>(
+            "pool_kernel_h", 0)),
+        pool_kernel_w_(OperatorBase::GetSingleArgument<int>(
+            "pool_kernel_w", 0)),
+        pool_stride_h_(OperatorBase::GetSingleArgument<int>(
+            "pool_stride_h", 1)),
+        pool_stride_w_(OperatorBase::GetSingleArgument<int>(
+            "pool_stride_w", 1)),
+        pool_pad_t_(OperatorBase::GetSingleArgument<int>("pool_pad_t", 0)),
+        pool_pad_l_(OperatorBase::GetSingleArgument<int>("pool_pad_l", 0)),
+        pool_pad_b_(OperatorBase::GetSingleArgument<int>("pool_pad_b", 0)),
+        pool_pad_r_(OperatorBase::GetSingleArgument<int>("pool_pad_r", 0)),
+        kOne(1, &device_context_), kZero(0, &device_context_) {
+    if (operator_def.type() == "ConvReluMaxPool") {
+      CHECK_GT(pool_kernel_h_, 0);
+      CHECK_GT(pool_kernel_w_, 0);
+      CHECK_GT(pool_stride_h_, 0);
+      CHECK_GT(pool_stride_w_, 0);
+    }
+  }
+  ~ConvReluOp() {}
+
+  bool RunOnDeviceWithOrderNCHW() override;
+  bool RunOnDeviceWithOrderNHWC() override;
+
+  bool InferOutputShapes(const vector<TensorShape>& input_shapes,
+                         vector<TensorShape>* output_shapes) override {
+    if (input_shapes[FILTER].dims.size() != 4) {
+      return false;
+    }
+    output_shapes->resize(1);
+    TensorShape* output = &(*output_shapes)[0];
+    if (!InferOutputShape(input_shapes[INPUT], input_shapes[FILTER].dims[0],
+                          output)) {
+      return false;
+    }
+    if (pool_kernel_h_ > 0) {
+      const int h_axis = order_ == StorageOrder::NCHW ? 2 : 1;
+      output->dims[h_axis] = PooledSize(output->dims[h_axis], pool_kernel_h_,
+                                        pool_stride_h_, pool_pad_t_,
+                                        pool_pad_b_);
+      output->dims[h_axis + 1] = PooledSize(
+          output->dims[h_axis + 1], pool_kernel_w_, pool_stride_w_,
+          pool_pad_l_, pool_pad_r_);
+    }
+    return true;
+  }
+
+ private:
+  // Computes the pooled size of a conv output of the given size.
+  inline int PooledSize(int size, int kernel, int stride, int pad_head,
+                        int pad_tail) {
+    return (size + pad_head + pad_tail - kernel) / stride + 1;
+  }
+
+  int pool_kernel_h_;
+  int pool_kernel_w_;
+  int pool_stride_h_;
+  int pool_stride_w_;
+  int pool_pad_t_;
+  int pool_pad_l_;
+  int pool_pad_b_;
+  int pool_pad_r_;
+  // The col buffers and, when pooling, the convolution outputs of the images
+  // that the workers of ParallelFor() are working on, one per worker.
+  Tensor<dtype, DeviceContext> col_buffer_;
+  Tensor<dtype, DeviceContext> conv_buffer_;
+  Tensor<dtype, DeviceContext> kOne;
+  Tensor<dtype, DeviceContext> kZero;
+  // Input: X, W, b
+  // Output: Y
+  INPUT_TAGS(INPUT, FILTER, BIAS);
+  INPUT_OUTPUT_STATS(3, 3, 1, 1);
+  DISABLE_COPY_AND_ASSIGN(ConvReluOp);
+};
+
+// FCRelu is FC followed by Relu. The output is computed in blocks of rows,
+// and the bias and the activation are applied to each block right after its
+// GEMM.
+template <typename dtype, class DeviceContext>
+class FullyConnectedReluOp final : public Operator<dtype, DeviceContext> {
+ public:
+  USE_OPERATOR_BASE_FUNCTIONS;
+  FullyConnectedReluOp(const OperatorDef& operator_def, Workspace* ws)
+      : Operator<dtype, DeviceContext>(operator_def, ws),
+        kOne(static_cast<dtype>(1), &device_context_),
+        kZero(static_cast<dtype>(0), &device_context_) {}
+  ~FullyConnectedReluOp() {}
+
+  bool RunOnDevice() override;
+
+  bool InferOutputShapes(const vector<TensorShape>& input_shapes,
+                         vector<TensorShape>* output_shapes) override {
+    if (input_shapes[0].dims.size() < 2 || input_shapes[1].dims.empty()) {
+      return false;
+    }
+    output_shapes->assign(1, TensorShape(
+        vector<int>{input_shapes[0].dims[0], input_shapes[1].dims[0]},
+        input_shapes[0].data_type));
+    return true;
+  }
+
+ protected:
+  Tensor<dtype, DeviceContext> kOne;
+  Tensor<dtype, DeviceContext> kZero;
+  INPUT_OUTPUT_STATS(3, 3, 1, 1);
+  DISABLE_COPY_AND_ASSIGN(FullyConnectedReluOp);
+};
+
+}  // namespace caffe2
+
+#endif  // CAFFE2_OPERATORS_FUSED_OPS_H_
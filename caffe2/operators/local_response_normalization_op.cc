@@ -1,4 +1,5 @@
 #include "caffe2/operators/local_response_normalization_op.h"
+#include "caffe2/utils/parallel_for.h"
 
 namespace caffe2 {
 
@@ -20,44 +21,56 @@ bool LRNOp<float, CPUContext>::RunOnDeviceWithOrderNCHW() {
   float* Ydata = Y->mutable_data();
   float* scale_data = scale->mutable_data();
   math::Set<float, CPUContext>(X.size(), bias_, scale_data, &device_context_);
+  // The images are split across the workers of ParallelFor(), and each worker
+  // has a padded square of its own.
+  const int num_workers = NumParallelForWorkers<CPUContext>(N);
+  const int padded_square_size = (C + size_ - 1) * H * W;
   Tensor<float, CPUContext> padded_square(
-      std::vector<int>{C + size_ - 1, H, W});
+      std::vector<int>{num_workers, C + size_ - 1, H, W});
   float* padded_square_data = padded_square.mutable_data();
   math::Set<float, CPUContext>(padded_square.size(), 0., padded_square_data,
                                &device_context_);
   const float alpha_over_size = alpha_ / size_;
   // go through the images
-  for (int n = 0; n < N; ++n) {
-    // compute the padded square
-    math::Sqr<float, CPUContext>(image_size, Xdata + image_size * n,
-                                 padded_square_data + pre_pad_ * H * W,
-                                 &device_context_);
-    // Create the first channel scale
-    for (int c = 0; c < size_; ++c) {
-      math::Axpy<float, CPUContext>(
-          H * W, &alpha_over_size, padded_square_data + c * H * W,
-          scale_data + image_size * n, &device_context_);
-    }
-    for (int c = 1; c < C; ++c) {
-      float* this_scale_slice = scale_data + n * image_size + c * H * W;
-      // copy previous scale
-      device_context_.Copy<float, CPUContext, CPUContext>(
-          H * W, this_scale_slice - H * W, this_scale_slice);
-      // add head
-      math::Axpy<float, CPUContext>(
-          H * W, &alpha_over_size, padded_square_data + (c + size_ - 1) * H * W,
-          this_scale_slice, &device_context_);
-      // subtract tail
-      // negative_aos is in order to cope with math::Axpy's requirement.
-      const float negative_aos = -alpha_over_size;
-      math::Axpy<float, CPUContext>(
-          H * W, &negative_aos, padded_square_data + (c - 1) * H * W,
-          this_scale_slice, &device_context_);
+  ParallelFor<CPUContext>(N, [&](int begin, int end, int worker) {
+    float* worker_padded_square_data =
+        padded_square_data + worker * padded_square_size;
+    for (int n = begin; n < end; ++n) {
+      // compute the padded square
+      math::Sqr<float, CPUContext>(image_size, Xdata + image_size * n,
+                                   worker_padded_square_data + pre_pad_ * H * W,
+                                   &device_context_);
+      // Create the first channel scale
+      for (int c = 0; c < size_; ++c) {
+        math::Axpy<float, CPUContext>(
+            H * W, &alpha_over_size, worker_padded_square_data + c * H * W,
+            scale_data + image_size * n, &device_context_);
+      }
+      for (int c = 1; c < C; ++c) {
+        float* this_scale_slice = scale_data + n * image_size + c * H * W;
+        // copy previous scale
+        device_context_.Copy<float, CPUContext, CPUContext>(
+            H * W, this_scale_slice - H * W, this_scale_slice);
+        // add head
+        math::Axpy<float, CPUContext>(
+            H * W, &alpha_over_size,
+            worker_padded_square_data + (c + size_ - 1) * H * W,
+            this_scale_slice, &device_context_);
+        // subtract tail
+        // negative_aos is in order to cope with math::Axpy's requirement.
+        const float negative_aos = -alpha_over_size;
+        math::Axpy<float, CPUContext>(
+            H * W, &negative_aos, worker_padded_square_data + (c - 1) * H * W,
+            this_scale_slice, &device_context_);
+      }
+      math::Powx<float, CPUContext>(
+          image_size, scale_data + image_size * n, -beta_,
+          Ydata + image_size * n, &device_context_);
+      math::Mul<float, CPUContext>(
+          image_size, Ydata + image_size * n, Xdata + image_size * n,
+          Ydata + image_size * n, &device_context_);
     }
-  }
-  math::Powx<float, CPUContext>(
-      X.size(), scale_data, -beta_, Ydata, &device_context_);
-  math::Mul<float, CPUContext>(X.size(), Ydata, Xdata, Ydata, &device_context_);
+  });
   return true;
 }
 
@@ -80,30 +93,42 @@ bool LRNOp<float, CPUContext>::RunOnDeviceWithOrderNHWC() {
   float* Ydata = Y->mutable_data();
   float* scale_data = scale->mutable_data();
 
-  Tensor<float, CPUContext> padded_square(std::vector<int>(1, C + size_ - 1));
+  // The rows are split across the workers of ParallelFor(), and each worker
+  // has a padded square of its own.
+  const int num_workers = NumParallelForWorkers<CPUContext>(num_rows);
+  const int padded_square_size = C + size_ - 1;
+  Tensor<float, CPUContext> padded_square(
+      std::vector<int>{num_workers, padded_square_size});
   float* padded_square_data = padded_square.mutable_data();
   math::Set<float, CPUContext>(padded_square.size(), 0., padded_square_data,
                                &device_context_);
   const float alpha_over_size = alpha_ / size_;
 
-  for (int n = 0; n < num_rows; ++n) {
-    for (int c = 0; c < C; ++c) {
-      padded_square_data[c + pre_pad_] =
-          Xdata[n * C + c] * Xdata[n * C + c] * alpha_over_size;
-    }
-    float accum_scale = 0.;
-    for (int i = 0; i < size_ - 1; ++i) {
-      accum_scale += padded_square_data[i];
-    }
-    for (int c = 0; c < C; ++c) {
-      accum_scale += padded_square_data[c + size_ - 1];
-      scale_data[n * C + c] = bias_ + accum_scale;
-      accum_scale -= padded_square_data[c];
+  ParallelFor<CPUContext>(num_rows, [&](int begin, int end, int worker) {
+    float* worker_padded_square_data =
+        padded_square_data + worker * padded_square_size;
+    for (int n = begin; n < end; ++n) {
+      for (int c = 0; c < C; ++c) {
+        worker_padded_square_data[c + pre_pad_] =
+            Xdata[n * C + c] * Xdata[n * C + c] * alpha_over_size;
+      }
+      float accum_scale = 0.;
+      for (int i = 0; i < size_ - 1; ++i) {
+        accum_scale += worker_padded_square_data[i];
+      }
+      for (int c = 0; c < C; ++c) {
+        accum_scale += worker_padded_square_data[c + size_ - 1];
+        scale_data[n * C + c] = bias_ + accum_scale;
+        accum_scale -= worker_padded_square_data[c];
+      }
     }
-  }
-  math::Powx<float, CPUContext>(
-      X.size(), scale_data, -beta_, Ydata, &device_context_);
-  math::Mul<float, CPUContext>(X.size(), Ydata, Xdata, Ydata, &device_context_);
+    math::Powx<float, CPUContext>(
+        (end - begin) * C, scale_data + begin * C, -beta_,
+        Ydata + begin * C, &device_context_);
+    math::Mul<float, CPUContext>(
+        (end - begin) * C, Ydata + begin * C, Xdata + begin * C,
+        Ydata + begin * C, &device_context_);
+  });
   return true;
 }
 
@@ -64,6 +64,7 @@ class LRNOp final : public LRNOpBase<dtype, DeviceContext> {
 
   bool RunOnDeviceWithOrderNCHW() override;
   bool RunOnDeviceWithOrderNHWC() override;
+  OUTPUT_SHAPES_LIKE_INPUT;
 
  protected:
   // Input: X; Output: Y, scale.
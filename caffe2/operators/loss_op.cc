@@ -5,6 +5,8 @@ namespace {
 
 REGISTER_CPU_OPERATOR(AveragedLoss, AveragedLoss<float, CPUContext>)
 REGISTER_CPU_OPERATOR(WeightedSumLoss, WeightedSumLoss<float, CPUContext>)
+// The gradient shares the data of the weights.
+REGISTER_SHARED_STORAGE_OUTPUTS(WeightedSumLoss, 1)
 
 }  // namespace
 }  // namespace caffe2
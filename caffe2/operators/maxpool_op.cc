@@ -1,4 +1,5 @@
 #include "caffe2/operators/maxpool_op.h"
+#include "caffe2/utils/parallel_for.h"
 
 namespace caffe2 {
 
@@ -25,8 +26,15 @@ bool MaxPoolOp<float, CPUContext>::RunOnDeviceWithOrderNCHW() {
   int width = X.dim(3);
   int pooled_height = Y->dim(2);
   int pooled_width = Y->dim(3);
-  for (int n = 0; n < X.dim(0); ++n) {
-    for (int c = 0; c < channels; ++c) {
+  // The channels of all the images are pooled independently.
+  const int num_planes = X.dim(0) * channels;
+  ParallelFor<CPUContext>(num_planes, [&](int begin, int end, int worker) {
+    for (int plane = begin; plane < end; ++plane) {
+      const int c = plane % channels;
+      const float* plane_Xdata = Xdata + plane * height * width;
+      float* plane_Ydata = Ydata + plane * pooled_height * pooled_width;
+      int* plane_index_data =
+          index_data + plane * pooled_height * pooled_width;
       for (int ph = 0; ph < pooled_height; ++ph) {
         for (int pw = 0; pw < pooled_width; ++pw) {
           int hstart = ph * stride_h_ - pad_t_;
@@ -39,20 +47,17 @@ bool MaxPoolOp<float, CPUContext>::RunOnDeviceWithOrderNCHW() {
           for (int h = hstart; h < hend; ++h) {
             for (int w = wstart; w < wend; ++w) {
               const int input_index = h * width + w;
-              if (Xdata[input_index] > Ydata[pool_index]) {
-                Ydata[pool_index] = Xdata[input_index];
-                index_data[pool_index] = c * height * width + h * width + w;
+              if (plane_Xdata[input_index] > plane_Ydata[pool_index]) {
+                plane_Ydata[pool_index] = plane_Xdata[input_index];
+                plane_index_data[pool_index] =
+                    c * height * width + h * width + w;
               }
             }
           }
         }
       }
-      // Do offset.
-      Xdata += height * width;
-      Ydata += pooled_height * pooled_width;
-      index_data += pooled_height * pooled_width;
     }
-  }
+  });
   return true;
 }
 
@@ -76,8 +81,17 @@ bool MaxPoolOp<float, CPUContext>::RunOnDeviceWithOrderNHWC() {
   // The main loop
   int pooled_height = Y->dim(1);
   int pooled_width = Y->dim(2);
-  for (int n = 0; n < X.dim(0); ++n) {
-    for (int ph = 0; ph < pooled_height; ++ph) {
+  const int input_offset = X.size() / X.dim(0);
+  const int output_offset = Y->size() / Y->dim(0);
+  // The rows of pooled outputs of all the images are computed independently.
+  const int num_rows = X.dim(0) * pooled_height;
+  ParallelFor<CPUContext>(num_rows, [&](int begin, int end, int worker) {
+    for (int row = begin; row < end; ++row) {
+      const int n = row / pooled_height;
+      const int ph = row % pooled_height;
+      const float* image_Xdata = Xdata + n * input_offset;
+      float* image_Ydata = Ydata + n * output_offset;
+      int* image_index_data = index_data + n * output_offset;
       for (int pw = 0; pw < pooled_width; ++pw) {
         int hstart = ph * stride_h_ - pad_t_;
         int wstart = pw * stride_w_ - pad_l_;
@@ -91,20 +105,17 @@ bool MaxPoolOp<float, CPUContext>::RunOnDeviceWithOrderNHWC() {
           for (int w = wstart; w < wend; ++w) {
             const int input_index = (h * width + w) * channels;
             for (int c = 0; c < channels; ++c) {
-              if (Xdata[input_index + c] > Ydata[pool_index + c]) {
-                Ydata[pool_index + c] = Xdata[input_index + c];
-                index_data[pool_index + c] = input_index + c;
+              if (image_Xdata[input_index + c] >
+                  image_Ydata[pool_index + c]) {
+                image_Ydata[pool_index + c] = image_Xdata[input_index + c];
+                image_index_data[pool_index + c] = input_index + c;
               }
             }
           }
         }
       }
     }
-    // Do offset.
-    Xdata += X.size() / X.dim(0);
-    Ydata += Y->size() / Y->dim(0);
-    index_data += Y->size() / Y->dim(0);
-  }
+  });
   return true;
 }
 
@@ -24,6 +24,21 @@ class MaxPoolOp final : public ConvPoolOpBase<dtype, DeviceContext> {
   bool RunOnDeviceWithOrderNCHW() override;
   bool RunOnDeviceWithOrderNHWC() override;
 
+  bool InferOutputShapes(const vector<TensorShape>& input_shapes,
+                         vector<TensorShape>* output_shapes) override {
+    if (input_shapes[0].dims.size() != 4) {
+      return false;
+    }
+    output_shapes->resize(2);
+    if (!InferOutputShape(input_shapes[0], InputChannels(input_shapes[0]),
+                          &(*output_shapes)[0])) {
+      return false;
+    }
+    (*output_shapes)[1] =
+        TensorShape((*output_shapes)[0].dims, TensorProto::INT32);
+    return true;
+  }
+
   // Input: X
   // Output: Y, index
   INPUT_OUTPUT_STATS(1, 1, 2, 2);
@@ -0,0 +1,217 @@
+#include <set>
+
+#include "caffe2/core/net_optimizer.h"
+#include "caffe2/operators/operator_fusion.h"
+#include "caffe2/utils/proto_utils.h"
+#include "glog/logging.h"
+
+namespace caffe2 {
+
+namespace {
+
+// Whether the operator runs on the CPU. An operator without a device option of
+// its own gets the one of the network when the network is created.
+bool IsCPUOperator(const NetDef& net_def, const OperatorDef& op_def) {
+  const DeviceOption& device_option = op_def.has_device_option()
+      ? op_def.device_option() : net_def.device_option();
+  return device_option.device_type() == CPU;
+}
+
+bool HasArgument(const OperatorDef& op_def, const string& name) {
+  for (const Argument& arg : op_def.arg()) {
+    if (arg.name() == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int GetIntArgument(const OperatorDef& op_def, const string& name,
+                   int default_value) {
+  return HasArgument(op_def, name) ? GetArgument(op_def, name).i()
+                                   : default_value;
+}
+
+string GetStringArgument(const OperatorDef& op_def, const string& name,
+                         const string& default_value) {
+  return HasArgument(op_def, name) ? GetArgument(op_def, name).s()
+                                   : default_value;
+}
+
+// Returns the operators that read the value that the given operator writes to
+// the given blob, i.e. the operators after it that read the blob, up to the
+// one that overwrites it. Sets *escapes if the value is not overwritten and
+// the blob is an external output of the network.
+vector<int> ValueReaders(const NetDef& net_def, const int producer,
+                         const string& blob, bool* escapes) {
+  vector<int> readers;
+  for (int idx = producer + 1; idx < net_def.op_size(); ++idx) {
+    const OperatorDef& op_def = net_def.op(idx);
+    for (const string& input : op_def.input()) {
+      if (input == blob) {
+        readers.push_back(idx);
+        break;
+      }
+    }
+    for (const string& output : op_def.output()) {
+      if (output == blob) {
+        *escapes = false;
+        return readers;
+      }
+    }
+  }
+  *escapes = false;
+  for (const string& output : net_def.external_output()) {
+    if (output == blob) {
+      *escapes = true;
+    }
+  }
+  return readers;
+}
+
+// Returns the only operator that reads the value that the given operator
+// writes to its output with the given index, or -1 if there is no such
+// operator.
+int SoleValueReader(const NetDef& net_def, const int producer,
+                    const int output_idx) {
+  bool escapes;
+  vector<int> readers = ValueReaders(
+      net_def, producer, net_def.op(producer).output(output_idx), &escapes);
+  return (readers.size() == 1 && !escapes) ? readers[0] : -1;
+}
+
+// Whether any operator strictly between begin and end writes an input of the
+// given operator, in which case the operator cannot be moved to end.
+bool InputsWrittenBetween(const NetDef& net_def, const OperatorDef& op_def,
+                          const int begin, const int end) {
+  std::set<string> inputs(op_def.input().begin(), op_def.input().end());
+  for (int idx = begin + 1; idx < end; ++idx) {
+    for (const string& output : net_def.op(idx).output()) {
+      if (inputs.count(output)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Adds the pooling arguments of the given MaxPool to the fused operator, as
+// explicit values. Returns false if the pooling cannot be fused.
+bool AddPoolArguments(const OperatorDef& conv_def, const OperatorDef& pool_def,
+                      OperatorDef* fused_def) {
+  // The legacy padding schemes depend on the input size, so they are left
+  // alone.
+  if (HasArgument(pool_def, "legacy_pad") ||
+      GetStringArgument(pool_def, "order", "NHWC") !=
+      GetStringArgument(conv_def, "order", "NHWC")) {
+    return false;
+  }
+  const int kernel = GetIntArgument(pool_def, "kernel", 0);
+  const int stride = GetIntArgument(pool_def, "stride", 1);
+  const int pad = GetIntArgument(pool_def, "pad", 0);
+  const std::pair<string, int> pool_args[] = {
+      {"pool_kernel_h", GetIntArgument(pool_def, "kernel_h", kernel)},
+      {"pool_kernel_w", GetIntArgument(pool_def, "kernel_w", kernel)},
+      {"pool_stride_h", GetIntArgument(pool_def, "stride_h", stride)},
+      {"pool_stride_w", GetIntArgument(pool_def, "stride_w", stride)},
+      {"pool_pad_t", GetIntArgument(pool_def, "pad_t", pad)},
+      {"pool_pad_l", GetIntArgument(pool_def, "pad_l", pad)},
+      {"pool_pad_b", GetIntArgument(pool_def, "pad_b", pad)},
+      {"pool_pad_r", GetIntArgument(pool_def, "pad_r", pad)},
+  };
+  for (const auto& pool_arg : pool_args) {
+    GetMutableArgument(pool_arg.first, true, fused_def)->set_i(
+        pool_arg.second);
+  }
+  return true;
+}
+
+}  // namespace
+
+NetDef FuseOperators(const NetDef& net_def) {
+  const int num_ops = net_def.op_size();
+  // The operators that are fused away, and the fused operators that replace
+  // the last operator of each chain.
+  vector<bool> removed(num_ops, false);
+  CaffeMap<int, OperatorDef> fused_ops;
+  for (int idx = 0; idx < num_ops; ++idx) {
+    const OperatorDef& op_def = net_def.op(idx);
+    if ((op_def.type() != "Conv" && op_def.type() != "FC") ||
+        !IsCPUOperator(net_def, op_def) || op_def.output_size() != 1) {
+      continue;
+    }
+    const int relu_idx = SoleValueReader(net_def, idx, 0);
+    if (relu_idx < 0) {
+      continue;
+    }
+    const OperatorDef& relu_def = net_def.op(relu_idx);
+    if (relu_def.type() != "Relu" || !IsCPUOperator(net_def, relu_def) ||
+        InputsWrittenBetween(net_def, op_def, idx, relu_idx)) {
+      continue;
+    }
+    OperatorDef fused_def(op_def);
+    fused_def.set_type(op_def.type() == "Conv" ? "ConvRelu" : "FCRelu");
+    fused_def.set_output(0, relu_def.output(0));
+    int last_idx = relu_idx;
+    if (op_def.type() == "Conv") {
+      const int pool_idx = SoleValueReader(net_def, relu_idx, 0);
+      if (pool_idx >= 0) {
+        const OperatorDef& pool_def = net_def.op(pool_idx);
+        bool index_escapes;
+        if (pool_def.type() == "MaxPool" && IsCPUOperator(net_def, pool_def) &&
+            pool_def.output_size() == 2 &&
+            ValueReaders(net_def, pool_idx, pool_def.output(1),
+                         &index_escapes).empty() && !index_escapes &&
+            !InputsWrittenBetween(net_def, op_def, idx, pool_idx)) {
+          OperatorDef pooled_def(fused_def);
+          if (AddPoolArguments(op_def, pool_def, &pooled_def)) {
+            pooled_def.set_type("ConvReluMaxPool");
+            pooled_def.set_output(0, pool_def.output(0));
+            fused_def = pooled_def;
+            removed[relu_idx] = true;
+            last_idx = pool_idx;
+          }
+        }
+      }
+    }
+    LOG(INFO) << "Operator fusion: fused operator " << idx << " ("
+              << op_def.type() << ") and its followers up to operator "
+              << last_idx << " into a " << fused_def.type() << ".";
+    removed[idx] = true;
+    fused_ops[last_idx] = fused_def;
+  }
+
+  NetDef fused_net_def(net_def);
+  fused_net_def.clear_op();
+  for (int idx = 0; idx < num_ops; ++idx) {
+    if (removed[idx]) {
+      continue;
+    }
+    if (fused_ops.count(idx)) {
+      *fused_net_def.add_op() = fused_ops[idx];
+    } else {
+      *fused_net_def.add_op() = net_def.op(idx);
+    }
+  }
+  return fused_net_def;
+}
+
+namespace {
+// Operator fusion drops the MaxPool indices, so it only runs at level 2.
+class OperatorFusionPass final : public NetOptimizationPass {
+ public:
+  int level() const override { return 2; }
+  bool Run(NetDef* net_def) override {
+    NetDef fused_net_def = FuseOperators(*net_def);
+    if (fused_net_def.op_size() == net_def->op_size()) {
+      return false;
+    }
+    net_def->Swap(&fused_net_def);
+    return true;
+  }
+};
+
+REGISTER_NET_OPTIMIZATION_PASS(OperatorFusion, OperatorFusionPass);
+}  // namespace
+
+}  // namespace caffe2
@@ -0,0 +1,24 @@
+#ifndef CAFFE2_OPERATORS_OPERATOR_FUSION_H_
+#define CAFFE2_OPERATORS_OPERATOR_FUSION_H_
+
+#include "caffe2/core/common.h"
+#include "caffe2/proto/caffe2.pb.h"
+
+namespace caffe2 {
+
+// FuseOperators returns a copy of the given network where chains of CPU
+// operators are replaced by the fused operators of fused_ops.h:
+//     Conv -> Relu            becomes ConvRelu,
+//     Conv -> Relu -> MaxPool becomes ConvReluMaxPool,
+//     FC -> Relu              becomes FCRelu.
+// A chain is only fused if its intermediate results are read by nothing but
+// the next operator of the chain, and are not external outputs of the network.
+// Like memory planning, this assumes that the blobs that are not listed as
+// external outputs are not read from outside of the network. The MaxPool max
+// indices should not be read at all, so this is meant for inference networks.
+// The fused operator takes the place of the last operator of the chain.
+NetDef FuseOperators(const NetDef& net_def);
+
+}  // namespace caffe2
+
+#endif  // CAFFE2_OPERATORS_OPERATOR_FUSION_H_
@@ -0,0 +1,159 @@
+#include "caffe2/core/operator.h"
+#include "caffe2/operators/operator_fusion.h"
+#include "caffe2/operators/test_util.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+namespace caffe2 {
+
+namespace {
+
+// Creates the network with its outputs preallocated and runs it, checking
+// that shape inference preallocated the output with the shape it has after
+// the run.
+void RunPreallocated(NetDef net_def, const string& output, Workspace* ws) {
+  net_def.set_name("preallocated");
+  net_def.set_preallocate_outputs(true);
+  ASSERT_TRUE(ws->CreateNet(net_def));
+  auto& Y = ws->GetBlob(output)->Get<Tensor<float, CPUContext> >();
+  const std::vector<int> preallocated_dims = Y.dims();
+  const float* preallocated_data = Y.data();
+  ASSERT_TRUE(ws->RunNet(net_def.name()));
+  EXPECT_EQ(Y.dims(), preallocated_dims);
+  EXPECT_EQ(Y.data(), preallocated_data);
+}
+
+// Runs the network and its fused version on the same random inputs, and
+// checks that they produce the same output.
+void ExpectSameOutput(const NetDef& net_def, const NetDef& fused_net_def,
+                      const std::vector<int>& input_shape,
+                      const std::vector<int>& filter_shape,
+                      const string& output) {
+  Workspace ws, fused_ws;
+  for (Workspace* workspace : {&ws, &fused_ws}) {
+    AddRandomInput(input_shape, "X", workspace);
+    AddRandomInput(filter_shape, "W", workspace);
+    AddRandomInput(std::vector<int>{filter_shape[0]}, "b", workspace);
+  }
+  RunPreallocated(net_def, output, &ws);
+  RunPreallocated(fused_net_def, output, &fused_ws);
+  auto& Y = ws.GetBlob(output)->Get<Tensor<float, CPUContext> >();
+  auto& fused_Y = fused_ws.GetBlob(output)->Get<Tensor<float, CPUContext> >();
+  ASSERT_EQ(Y.dims(), fused_Y.dims());
+  for (int i = 0; i < Y.size(); ++i) {
+    EXPECT_NEAR(Y.data()[i], fused_Y.data()[i], 1e-4);
+  }
+}
+
+const char kConvNetDefString[] =
+"  name: \"conv\""
+"  op {"
+"    input: \"X\""
+"    input: \"W\""
+"    input: \"b\""
+"    output: \"conv\""
+"    type: \"Conv\""
+"    arg { name: \"kernel\" i: 3 }"
+"    arg { name: \"pad\" i: 1 }"
+"  }"
+"  op {"
+"    input: \"conv\""
+"    output: \"relu\""
+"    type: \"Relu\""
+"  }"
+"  op {"
+"    input: \"relu\""
+"    output: \"pool\""
+"    output: \"pool_index\""
+"    type: \"MaxPool\""
+"    arg { name: \"kernel\" i: 3 }"
+"    arg { name: \"stride\" i: 2 }"
+"  }"
+"  external_output: \"pool\"";
+
+}  // namespace
+
+TEST(OperatorFusionTest, TestConvReluMaxPool) {
+  for (const string order : {"NCHW", "NHWC"}) {
+    NetDef net_def;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        string(kConvNetDefString), &net_def));
+    for (int idx : {0, 2}) {
+      Argument* arg = net_def.mutable_op(idx)->add_arg();
+      arg->set_name("order");
+      arg->set_s(order);
+    }
+    NetDef fused_net_def = FuseOperators(net_def);
+    ASSERT_EQ(fused_net_def.op_size(), 1);
+    const OperatorDef& fused_def = fused_net_def.op(0);
+    EXPECT_EQ(fused_def.type(), "ConvReluMaxPool");
+    ASSERT_EQ(fused_def.output_size(), 1);
+    EXPECT_EQ(fused_def.output(0), "pool");
+    // The images of the batch are split across the workers of ParallelFor(),
+    // each of which convolves into a buffer of its own.
+    const bool nchw = order == "NCHW";
+    ExpectSameOutput(
+        net_def, fused_net_def,
+        nchw ? std::vector<int>{7, 3, 9, 9} : std::vector<int>{7, 9, 9, 3},
+        nchw ? std::vector<int>{4, 3, 3, 3} : std::vector<int>{4, 3, 3, 3},
+        "pool");
+  }
+}
+
+TEST(OperatorFusionTest, TestConvReluWithoutMaxPool) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kConvNetDefString), &net_def));
+  // The relu output is needed outside of the network, so only the conv and the
+  // relu are fused.
+  net_def.add_external_output("relu");
+  NetDef fused_net_def = FuseOperators(net_def);
+  ASSERT_EQ(fused_net_def.op_size(), 2);
+  EXPECT_EQ(fused_net_def.op(0).type(), "ConvRelu");
+  EXPECT_EQ(fused_net_def.op(0).output(0), "relu");
+  EXPECT_EQ(fused_net_def.op(1).type(), "MaxPool");
+  ExpectSameOutput(net_def, fused_net_def, std::vector<int>{2, 9, 9, 3},
+                   std::vector<int>{4, 3, 3, 3}, "relu");
+  // The conv output is needed too, so nothing is fused.
+  net_def.add_external_output("conv");
+  EXPECT_EQ(FuseOperators(net_def).op_size(), 3);
+}
+
+TEST(OperatorFusionTest, TestNetDeviceOption) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kConvNetDefString), &net_def));
+  // The operators get the CUDA device option of the network, and there are no
+  // CUDA implementations of the fused operators.
+  net_def.mutable_device_option()->set_device_type(CUDA);
+  EXPECT_EQ(FuseOperators(net_def).op_size(), 3);
+  // Operators that explicitly run on the CPU are still fused.
+  for (OperatorDef& op_def : *net_def.mutable_op()) {
+    op_def.mutable_device_option()->set_device_type(CPU);
+  }
+  NetDef fused_net_def = FuseOperators(net_def);
+  ASSERT_EQ(fused_net_def.op_size(), 1);
+  EXPECT_EQ(fused_net_def.op(0).type(), "ConvReluMaxPool");
+}
+
+TEST(OperatorFusionTest, TestFCRelu) {
+  NetDef net_def;
+  OperatorDef* fc_def = net_def.add_op();
+  fc_def->set_type("FC");
+  fc_def->add_input("X");
+  fc_def->add_input("W");
+  fc_def->add_input("b");
+  fc_def->add_output("fc");
+  OperatorDef* relu_def = net_def.add_op();
+  relu_def->set_type("Relu");
+  relu_def->add_input("fc");
+  relu_def->add_output("fc");
+  net_def.add_external_output("fc");
+  NetDef fused_net_def = FuseOperators(net_def);
+  ASSERT_EQ(fused_net_def.op_size(), 1);
+  EXPECT_EQ(fused_net_def.op(0).type(), "FCRelu");
+  ExpectSameOutput(net_def, fused_net_def, std::vector<int>{70, 20},
+                   std::vector<int>{1000, 20}, "fc");
+}
+
+}  // namespace caffe2
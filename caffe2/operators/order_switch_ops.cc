@@ -1,4 +1,5 @@
 #include "caffe2/operators/order_switch_ops.h"
+#include "caffe2/utils/parallel_for.h"
 
 namespace caffe2 {
 
@@ -11,15 +12,18 @@ bool NHWC2NCHWOp<float, CPUContext>::RunOnDevice() {
   Y->Reshape(std::vector<int>{N, C, H, W});
   const float* Xdata = X.data();
   float* Ydata = Y->mutable_data();
-  for (int n = 0; n < N; ++n) {
-    for (int h = 0; h < H; ++h) {
-      for (int w = 0; w < W; ++w) {
-        for (int c = 0; c < C; ++c) {
-          Ydata[((n * C + c) * H + h) * W + w] = *(Xdata++);
+  ParallelFor<CPUContext>(N, [&](int begin, int end, int worker) {
+    const float* image_Xdata = Xdata + begin * H * W * C;
+    for (int n = begin; n < end; ++n) {
+      for (int h = 0; h < H; ++h) {
+        for (int w = 0; w < W; ++w) {
+          for (int c = 0; c < C; ++c) {
+            Ydata[((n * C + c) * H + h) * W + w] = *(image_Xdata++);
+          }
         }
       }
     }
-  }
+  });
   return true;
 }
 
@@ -16,6 +16,18 @@ class NHWC2NCHWOp final : public Operator<dtype, DeviceContext> {
   USE_OPERATOR_BASE_FUNCTIONS;
   bool RunOnDevice() override;
 
+  bool InferOutputShapes(const vector<TensorShape>& input_shapes,
+                         vector<TensorShape>* output_shapes) override {
+    const vector<int>& dims = input_shapes[0].dims;
+    if (dims.size() != 4) {
+      return false;
+    }
+    output_shapes->assign(1, TensorShape(
+        vector<int>{dims[0], dims[3], dims[1], dims[2]},
+        input_shapes[0].data_type));
+    return true;
+  }
+
  protected:
   INPUT_OUTPUT_STATS(1, 1, 1, 1);
   DISABLE_COPY_AND_ASSIGN(NHWC2NCHWOp);
@@ -28,6 +40,18 @@ class NCHW2NHWCOp final : public Operator<dtype, DeviceContext> {
   USE_OPERATOR_BASE_FUNCTIONS;
   bool RunOnDevice() override;
 
+  bool InferOutputShapes(const vector<TensorShape>& input_shapes,
+                         vector<TensorShape>* output_shapes) override {
+    const vector<int>& dims = input_shapes[0].dims;
+    if (dims.size() != 4) {
+      return false;
+    }
+    output_shapes->assign(1, TensorShape(
+        vector<int>{dims[0], dims[2], dims[3], dims[1]},
+        input_shapes[0].data_type));
+    return true;
+  }
+
  protected:
   INPUT_OUTPUT_STATS(1, 1, 1, 1);
   DISABLE_COPY_AND_ASSIGN(NCHW2NHWCOp);
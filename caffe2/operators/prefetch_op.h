@@ -1,78 +1,210 @@
 #ifndef CAFFE2_OPERATORS_PREFETCH_OP_H_
 #define CAFFE2_OPERATORS_PREFETCH_OP_H_
 
+#include <condition_variable>  // NOLINT
+#include <cstdint>
+#include <mutex>  // NOLINT
 #include <thread>  // NOLINT
 
 #include "caffe2/core/context.h"
+#include "caffe2/core/net_profiler.h"
 #include "caffe2/core/operator.h"
+#include "caffe2/core/tracing.h"
 
 namespace caffe2 {
 
-template <class DeviceContext>
-class PrefetchOperator;
+// Hands a prefetched batch over to an output of the operator. The batch is
+// copied to the device of the output, except on the CPU, where the output
+// takes the storage of the prefetched tensor and gives its own, which holds
+// the batch before, back to the slot.
+template <typename T, class DeviceContext>
+void HandOverPrefetched(Tensor<T, CPUContext>* prefetched,
+                        Tensor<T, DeviceContext>* output,
+                        DeviceContext* context) {
+  output->ReshapeLike(*prefetched);
+  context->template Copy<T, CPUContext, DeviceContext>(
+      prefetched->size(), prefetched->data(), output->mutable_data());
+}
 
-namespace internal {
-// We define a prefetch function so that the prefetch function can call virtual
-// member functions of the prefetch operator.
-template <class DeviceContext>
-void PrefetchFunc(PrefetchOperator<DeviceContext>* op) {
-  op->prefetch_success_ = op->Prefetch();
+template <typename T>
+void HandOverPrefetched(Tensor<T, CPUContext>* prefetched,
+                        Tensor<T, CPUContext>* output, CPUContext* context) {
+  output->Swap(prefetched);
 }
+
+// Reshapes the tensor of a slot to the shape of a batch, and returns the data
+// to prefetch the batch into. If the storage that HandOverPrefetched() gave
+// back to the slot is still used elsewhere, for instance by a tensor that
+// shares the data of the output, the batch goes to a new storage instead.
+template <typename T>
+T* MutablePrefetchData(const vector<int>& dims,
+                       Tensor<T, CPUContext>* prefetched) {
+  prefetched->Reshape(dims);
+  if (prefetched->shares_data()) {
+    prefetched->Allocate();
+  }
+  return prefetched->mutable_data();
 }
 
-// PrefetchOperator is an operator that prefetches the next batch. It should
+// PrefetchOperator is an operator that prefetches the next batches. It should
 // almost always be used to read things from disk, so I am setting the input to
 // zero blobs.
+//
+// The batches are prefetched by a worker thread that lives as long as the
+// operator, into prefetch_depth slots (an argument, 1 by default) that are
+// used in turn, so that up to prefetch_depth batches are ready ahead of Run().
+// A slow read then only stalls the network once all of them are used up. The
+// worker starts with the first Run(), and stops after a failed Prefetch(), in
+// which case Run() fails once the batches prefetched before have been used.
 template <class DeviceContext>
 class PrefetchOperator : public OperatorBase {
  public:
   PrefetchOperator(const OperatorDef& operator_def, Workspace* ws)
       : OperatorBase(operator_def, ws),
         device_context_(operator_def.device_option()),
-        prefetch_success_(false) {
+        prefetch_depth_(OperatorBase::GetSingleArgument<int>(
+            "prefetch_depth", 1)),
+        num_prefetched_(0), num_consumed_(0), num_waits_(0),
+        total_wait_ms_(0), prefetch_failed_(false), stop_prefetching_(false) {
+    CHECK_GT(prefetch_depth_, 0) << "Prefetch depth should be positive.";
     device_context_.SwitchToDevice();
   }
-  virtual ~PrefetchOperator() {}
+  virtual ~PrefetchOperator() {
+    StopPrefetching();
+    if (num_consumed_ > 0) {
+      LOG(INFO) << "Prefetching operator " << def().name() << ": Run() waited "
+                << num_waits_ << " times for " << num_consumed_
+                << " batches, " << total_wait_ms_ << " ms in total.";
+    }
+  }
 
   bool Run() final {
     device_context_.SwitchToDevice();
     if (prefetch_thread_ == nullptr) {
-      VLOG(1) << "Starting a new prefetch thread.";
+      VLOG(1) << "Starting the prefetch thread.";
       prefetch_thread_.reset(
-          new std::thread(
-              internal::PrefetchFunc<DeviceContext>, this));
+          new std::thread(&PrefetchOperator::PrefetchWorker, this));
     }
-    // Join the last prefetch thread.
-    VLOG(1) << "Waiting for the prefetch thread.";
-    prefetch_thread_->join();
-
-    if (!prefetch_success_) {
-      LOG(ERROR) << "Prefetching failed.";
-      return false;
+    int slot;
+    {
+      std::unique_lock<std::mutex> lock(prefetch_mutex_);
+      if (num_prefetched_ == num_consumed_ && !prefetch_failed_) {
+        VLOG(1) << "Waiting for the prefetch thread.";
+        TRACE_EVENT("prefetch", "PrefetchWait");
+        Timer timer;
+        prefetch_cv_.wait(lock, [this]() {
+          return num_prefetched_ > num_consumed_ || prefetch_failed_;
+        });
+        ++num_waits_;
+        total_wait_ms_ += timer.MilliSeconds();
+      }
+      if (num_prefetched_ == num_consumed_) {
+        LOG(ERROR) << "Prefetching failed.";
+        return false;
+      }
+      slot = num_consumed_ % prefetch_depth_;
     }
     VLOG(1) << "Copy prefetched result.";
-    if (!CopyPrefetched()) {
-      LOG(ERROR) << "Error when copying prefetched data.";
-      return false;
+    {
+      TRACE_EVENT("prefetch", "CopyPrefetched");
+      if (!CopyPrefetched(slot)) {
+        LOG(ERROR) << "Error when copying prefetched data.";
+        return false;
+      }
     }
-    prefetch_success_ = false;
-    VLOG(1) << "Starting a new prefetch thread.";
-    prefetch_thread_.reset(
-        new std::thread(
-            internal::PrefetchFunc<DeviceContext>, this));
-    return device_context_.FinishDeviceComputation();
+    // The copy may still read the slot until the device computation finishes,
+    // so the slot is only handed back to the worker after that.
+    const bool success = device_context_.FinishDeviceComputation();
+    std::lock_guard<std::mutex> lock(prefetch_mutex_);
+    ++num_consumed_;
+    prefetch_cv_.notify_all();
+    return success;
   }
 
-  // You will need to implement this instead of the Run function.
-  virtual bool Prefetch() = 0;
-  virtual bool CopyPrefetched() = 0;
-  friend void internal::PrefetchFunc<DeviceContext>(
-      PrefetchOperator*);
+  // You will need to implement this instead of the Run function. Prefetch()
+  // fills the given slot with the next batch, and CopyPrefetched() hands the
+  // batch in the given slot over to the outputs (see HandOverPrefetched()).
+  // Both are called with slots in turn, from 0 to prefetch_depth_ - 1.
+  virtual bool Prefetch(int slot) = 0;
+  virtual bool CopyPrefetched(int slot) = 0;
+
+  // How many batches Run() has copied to the outputs so far, and how many
+  // times and for how long in total it had to wait for the prefetch thread.
+  int64_t num_batches() {
+    std::lock_guard<std::mutex> lock(prefetch_mutex_);
+    return num_consumed_;
+  }
+  int64_t num_waits() {
+    std::lock_guard<std::mutex> lock(prefetch_mutex_);
+    return num_waits_;
+  }
+  double total_wait_ms() {
+    std::lock_guard<std::mutex> lock(prefetch_mutex_);
+    return total_wait_ms_;
+  }
 
  protected:
+  // Stops the prefetch thread once it has finished the batch it is working
+  // on. The destructors of derived operators should call this before they
+  // destroy anything Prefetch() uses.
+  void StopPrefetching() {
+    if (prefetch_thread_ == nullptr) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(prefetch_mutex_);
+      stop_prefetching_ = true;
+      prefetch_cv_.notify_all();
+    }
+    prefetch_thread_->join();
+    prefetch_thread_.reset();
+  }
+
   DeviceContext device_context_;
+  // The number of slots to prefetch batches into.
+  const int prefetch_depth_;
+
+ private:
+  void PrefetchWorker() {
+    std::unique_lock<std::mutex> lock(prefetch_mutex_);
+    while (true) {
+      prefetch_cv_.wait(lock, [this]() {
+        return stop_prefetching_ ||
+            num_prefetched_ - num_consumed_ < prefetch_depth_;
+      });
+      if (stop_prefetching_) {
+        return;
+      }
+      const int slot = num_prefetched_ % prefetch_depth_;
+      lock.unlock();
+      bool success;
+      {
+        TRACE_EVENT("prefetch", "Prefetch");
+        success = Prefetch(slot);
+      }
+      lock.lock();
+      if (!success) {
+        prefetch_failed_ = true;
+        prefetch_cv_.notify_all();
+        return;
+      }
+      ++num_prefetched_;
+      prefetch_cv_.notify_all();
+    }
+  }
+
   unique_ptr<std::thread> prefetch_thread_;
-  bool prefetch_success_;
+  // The state shared with the prefetch thread, protected by prefetch_mutex_.
+  // Slot i % prefetch_depth_ holds the i-th batch, which is ready once
+  // num_prefetched_ > i, and can be refilled once num_consumed_ > i.
+  std::mutex prefetch_mutex_;
+  std::condition_variable prefetch_cv_;
+  int64_t num_prefetched_;
+  int64_t num_consumed_;
+  int64_t num_waits_;
+  double total_wait_ms_;
+  bool prefetch_failed_;
+  bool stop_prefetching_;
 
   INPUT_OUTPUT_STATS(0, 0, 1, INT_MAX);
   DISABLE_COPY_AND_ASSIGN(PrefetchOperator);
@@ -0,0 +1,122 @@
+#include <chrono>  // NOLINT
+#include <thread>  // NOLINT
+
+#include "caffe2/operators/prefetch_op.h"
+#include "gtest/gtest.h"
+
+namespace caffe2 {
+
+// CountPrefetchOp outputs 0, 1, 2, ... as its batches. Each prefetch takes
+// prefetch_ms, and the prefetch of batch fail_at fails.
+class CountPrefetchOp final : public PrefetchOperator<CPUContext> {
+ public:
+  CountPrefetchOp(const OperatorDef& operator_def, Workspace* ws)
+      : PrefetchOperator<CPUContext>(operator_def, ws),
+        prefetch_ms_(OperatorBase::GetSingleArgument<int>("prefetch_ms", 0)),
+        fail_at_(OperatorBase::GetSingleArgument<int>("fail_at", -1)),
+        next_batch_(0), slot_batches_(prefetch_depth_, -1) {}
+  ~CountPrefetchOp() {
+    StopPrefetching();
+  }
+
+  bool Prefetch(int slot) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(prefetch_ms_));
+    if (next_batch_ == fail_at_) {
+      return false;
+    }
+    slot_batches_[slot] = next_batch_++;
+    return true;
+  }
+
+  bool CopyPrefetched(int slot) override {
+    *OperatorBase::Output<int>(0) = slot_batches_[slot];
+    // Mark the slot as used, to check that it is refilled before it comes
+    // around again.
+    slot_batches_[slot] = -1;
+    return true;
+  }
+
+ private:
+  int prefetch_ms_;
+  int fail_at_;
+  int next_batch_;
+  vector<int> slot_batches_;
+  DISABLE_COPY_AND_ASSIGN(CountPrefetchOp);
+};
+
+namespace {
+REGISTER_CPU_OPERATOR(CountPrefetch, CountPrefetchOp);
+
+unique_ptr<CountPrefetchOp> CreateCountPrefetchOp(
+    int prefetch_depth, int prefetch_ms, int fail_at, Workspace* ws) {
+  OperatorDef def;
+  def.set_type("CountPrefetch");
+  def.add_output("batch");
+  Argument* arg = def.add_arg();
+  arg->set_name("prefetch_depth");
+  arg->set_i(prefetch_depth);
+  arg = def.add_arg();
+  arg->set_name("prefetch_ms");
+  arg->set_i(prefetch_ms);
+  arg = def.add_arg();
+  arg->set_name("fail_at");
+  arg->set_i(fail_at);
+  return unique_ptr<CountPrefetchOp>(
+      static_cast<CountPrefetchOp*>(CreateOperator(def, ws)));
+}
+}  // namespace
+
+TEST(PrefetchOperatorTest, TestBatchesInOrder) {
+  for (int prefetch_depth : {1, 3}) {
+    Workspace ws;
+    auto op = CreateCountPrefetchOp(prefetch_depth, 0, -1, &ws);
+    ASSERT_TRUE(op.get() != nullptr);
+    for (int i = 0; i < 20; ++i) {
+      ASSERT_TRUE(op->Run());
+      EXPECT_EQ(ws.GetBlob("batch")->Get<int>(), i);
+    }
+    EXPECT_EQ(op->num_batches(), 20);
+  }
+}
+
+TEST(PrefetchOperatorTest, TestDeepQueueAbsorbsSlowBatches) {
+  Workspace ws;
+  auto op = CreateCountPrefetchOp(4, 10, -1, &ws);
+  ASSERT_TRUE(op.get() != nullptr);
+  ASSERT_TRUE(op->Run());
+  EXPECT_EQ(op->num_waits(), 1);
+  // Give the prefetch thread the time to fill the queue.
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  for (int i = 1; i <= 4; ++i) {
+    ASSERT_TRUE(op->Run());
+    EXPECT_EQ(ws.GetBlob("batch")->Get<int>(), i);
+  }
+  // The batches were ready, so Run() did not wait for them.
+  EXPECT_EQ(op->num_waits(), 1);
+  ASSERT_TRUE(op->Run());
+  EXPECT_EQ(op->num_waits(), 2);
+  EXPECT_GT(op->total_wait_ms(), 10);
+}
+
+TEST(PrefetchOperatorTest, TestFailureAfterPrefetchedBatches) {
+  Workspace ws;
+  auto op = CreateCountPrefetchOp(3, 0, 2, &ws);
+  ASSERT_TRUE(op.get() != nullptr);
+  // The batches prefetched before the failure are still handed out.
+  EXPECT_TRUE(op->Run());
+  EXPECT_TRUE(op->Run());
+  EXPECT_FALSE(op->Run());
+  EXPECT_FALSE(op->Run());
+  EXPECT_EQ(op->num_batches(), 2);
+}
+
+TEST(PrefetchOperatorTest, TestDestroyWhilePrefetching) {
+  Workspace ws;
+  auto op = CreateCountPrefetchOp(2, 20, -1, &ws);
+  ASSERT_TRUE(op.get() != nullptr);
+  EXPECT_TRUE(op->Run());
+  // Destroying the operator waits for the batch being prefetched.
+  op.reset();
+}
+
+}  // namespace caffe2
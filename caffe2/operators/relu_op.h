@@ -15,6 +15,7 @@ class ReluOp final : public Operator<dtype, DeviceContext> {
   USE_OPERATOR_BASE_FUNCTIONS;
 
   bool RunOnDevice();
+  OUTPUT_SHAPES_LIKE_INPUT;
 
  protected:
   INPUT_OUTPUT_STATS(1, 1, 1, 1);
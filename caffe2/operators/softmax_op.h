@@ -14,6 +14,7 @@ class SoftmaxOp final : public Operator<dtype, DeviceContext> {
   USE_SIMPLE_CTOR_DTOR(SoftmaxOp);
   USE_OPERATOR_BASE_FUNCTIONS;
   bool RunOnDevice() override;
+  OUTPUT_SHAPES_LIKE_INPUT;
 
  protected:
   Tensor<dtype, DeviceContext> scale_;
@@ -1,10 +1,14 @@
 #ifndef CAFFE2_OPERATORS_TENSOR_PROTOS_DB_INPUT_H_
 #define CAFFE2_OPERATORS_TENSOR_PROTOS_DB_INPUT_H_
 
+#include <condition_variable>  // NOLINT
 #include <iostream>
+#include <memory>
+#include <mutex>  // NOLINT
 
 #include "caffe2/core/db.h"
 #include "caffe2/operators/prefetch_op.h"
+#include "caffe2/utils/thread_pool.h"
 
 namespace caffe2 {
 
@@ -12,31 +16,46 @@ namespace caffe2 {
 // things from a db where each key-value pair stores a TensorProtos object.
 // These tensorprotos should have the same size, and they will be grouped into
 // batches of the given size. The output will simply be tensors of float data.
+//
+// If the decode_threads argument is above 1, the records are parsed by a pool
+// of that many threads while the prefetch thread keeps reading the next ones
+// from the db. Each record is written to its own place in the batch, so the
+// batches are the same as with a single thread.
 template <class DeviceContext>
 class TensorProtosDBInput final
     : public PrefetchOperator<DeviceContext> {
  public:
   using OperatorBase::OutputSize;
-  using PrefetchOperator<DeviceContext>::prefetch_thread_;
+  using PrefetchOperator<DeviceContext>::prefetch_depth_;
   explicit TensorProtosDBInput(const OperatorDef& operator_def, Workspace* ws);
   ~TensorProtosDBInput() {
-    if (prefetch_thread_.get() != nullptr) {
-      prefetch_thread_->join();
-    }
+    this->StopPrefetching();
   }
 
-  bool Prefetch() override;
-  bool CopyPrefetched() override;
+  bool Prefetch(int slot) override;
+  bool CopyPrefetched(int slot) override;
 
  private:
+  // Parses the record and writes it as item item_id of the batch, whose output
+  // tensors have the given data. Can be called for different items at the same
+  // time.
+  bool DecodeItem(const string& value, const vector<void*>& batch_data,
+                  int item_id);
+
   unique_ptr<db::DB> db_;
   unique_ptr<db::Cursor> cursor_;
-  // Prefetch will always just happen on the CPU side.
-  vector<unique_ptr<Blob> > prefetched_blobs_;
+  // Prefetch will always just happen on the CPU side. There is one blob per
+  // output for each prefetch slot.
+  vector<vector<unique_ptr<Blob> > > prefetched_blobs_;
   vector<TensorProto::DataType> data_types_;
+  // The shape of the batches of each output, and the number of values that
+  // each record holds for it.
+  vector<vector<int> > batch_dims_;
+  vector<int> item_sizes_;
   int batch_size_;
   string db_name_;
   string db_type_;
+  unique_ptr<ThreadPool> decode_pool_;
   DISABLE_COPY_AND_ASSIGN(TensorProtosDBInput);
 };
 
@@ -52,6 +71,12 @@ TensorProtosDBInput<DeviceContext>::TensorProtosDBInput(
             "db_type", "leveldb")) {
   CHECK_GT(batch_size_, 0) << "Batch size should be nonnegative.";
   CHECK_GT(db_name_.size(), 0) << "Must provide a leveldb name.";
+  const int decode_threads =
+      OperatorBase::template GetSingleArgument<int>("decode_threads", 1);
+  CHECK_GT(decode_threads, 0) << "Must have at least one decode thread.";
+  if (decode_threads > 1) {
+    decode_pool_.reset(new ThreadPool(decode_threads));
+  }
 
   db_.reset(db::CreateDB(db_type_, db_name_, db::READ));
   cursor_.reset(db_->NewCursor());
@@ -61,125 +86,181 @@ TensorProtosDBInput<DeviceContext>::TensorProtosDBInput(
   TensorProtos protos;
   protos.ParseFromString(cursor_->value());
   CHECK_EQ(protos.protos_size(), OutputSize());
-  prefetched_blobs_.resize(protos.protos_size());
+  prefetched_blobs_.resize(prefetch_depth_);
+  for (auto& slot_blobs : prefetched_blobs_) {
+    slot_blobs.resize(protos.protos_size());
+  }
   data_types_.resize(protos.protos_size());
+  batch_dims_.resize(protos.protos_size());
+  item_sizes_.resize(protos.protos_size());
   VLOG(1) << "Figuring data types.";
   for (int i = 0; i < protos.protos_size(); ++i) {
     vector<int> dims;
     for (const int dim : protos.protos(i).dims()) {
       dims.push_back(dim);
     }
+    item_sizes_[i] = 1;
+    for (int d = 1; d < dims.size(); ++d) {
+      item_sizes_[i] *= dims[d];
+    }
     dims[0] = batch_size_;
-    prefetched_blobs_[i].reset(new Blob());
-    Blob* blob = prefetched_blobs_[i].get();
+    batch_dims_[i] = dims;
     data_types_[i] = protos.protos(i).data_type();
-    switch (data_types_[i]) {
+    for (auto& slot_blobs : prefetched_blobs_) {
+      slot_blobs[i].reset(new Blob());
+      Blob* blob = slot_blobs[i].get();
+      switch (data_types_[i]) {
+      case TensorProto::FLOAT:
+        VLOG(1) << "Output " << i << ": float";
+        blob->GetMutable<Tensor<float, CPUContext> >()->Reshape(dims);
+        break;
+      case TensorProto::INT32:
+        VLOG(1) << "Output " << i << ": int";
+        blob->GetMutable<Tensor<int, CPUContext> >()->Reshape(dims);
+        break;
+      case TensorProto::BYTE:
+        VLOG(1) << "Output " << i << ": byte -> float";
+        // TODO(Yangqing): What type should I use here? Float?
+        blob->GetMutable<Tensor<float, CPUContext> >()->Reshape(dims);
+        break;
+      case TensorProto::STRING:
+        LOG(FATAL) << "Not expecting string.";
+      }
+    }
+  }
+  cursor_->SeekToFirst();
+}
+
+template <class DeviceContext>
+bool TensorProtosDBInput<DeviceContext>::DecodeItem(
+    const string& value, const vector<void*>& batch_data, int item_id) {
+  TensorProtos protos;
+  if (!protos.ParseFromString(value) ||
+      protos.protos_size() != data_types_.size()) {
+    LOG(ERROR) << "Cannot parse the record of item " << item_id << ".";
+    return false;
+  }
+  // TODO(Yangqing): do we want to do anything to sanity check the data?
+  for (int i = 0; i < protos.protos_size(); ++i) {
+    const TensorProto& proto = protos.protos(i);
+    if (proto.data_type() != data_types_[i]) {
+      LOG(ERROR) << "Unexpected input data type: " << proto.data_type();
+      return false;
+    }
+    const int single_size = item_sizes_[i];
+    switch (proto.data_type()) {
     case TensorProto::FLOAT:
-      VLOG(1) << "Output " << i << ": float";
-      blob->GetMutable<Tensor<float, CPUContext> >()->Reshape(dims);
+    {
+      CHECK_EQ(proto.float_data_size(), single_size);
+      float* dst_pointer =
+          static_cast<float*>(batch_data[i]) + single_size * item_id;
+      memcpy(dst_pointer, proto.float_data().data(),
+             single_size * sizeof(float));
       break;
+    }
     case TensorProto::INT32:
-      VLOG(1) << "Output " << i << ": int";
-      blob->GetMutable<Tensor<int, CPUContext> >()->Reshape(dims);
+    {
+      CHECK_EQ(proto.int32_data_size(), single_size);
+      int* dst_pointer =
+          static_cast<int*>(batch_data[i]) + single_size * item_id;
+      for (int j = 0; j < single_size; ++j) {
+        dst_pointer[j] = proto.int32_data(j);
+      }
       break;
+    }
     case TensorProto::BYTE:
-      VLOG(1) << "Output " << i << ": byte -> float";
-      // TODO(Yangqing): What type should I use here? Float?
-      blob->GetMutable<Tensor<float, CPUContext> >()->Reshape(dims);
+    {
+      const string& src_data = proto.byte_data();
+      CHECK_EQ(src_data.size(), single_size);
+      float* dst_pointer =
+          static_cast<float*>(batch_data[i]) + single_size * item_id;
+      for (int j = 0; j < single_size; ++j) {
+        dst_pointer[j] =
+            static_cast<float>(static_cast<uint8_t>(src_data[j])) / 256.f;
+      }
       break;
-    case TensorProto::STRING:
-      LOG(FATAL) << "Not expecting string.";
+    }
+    default:
+      LOG(ERROR) << "Unknown input data type: " << proto.data_type();
+      return false;
     }
   }
-  cursor_->SeekToFirst();
+  return true;
 }
 
 template <class DeviceContext>
-bool TensorProtosDBInput<DeviceContext>::Prefetch() {
-  for (int item_id = 0; item_id < batch_size_; ++item_id) {
-    // LOG(INFO) << "Prefetching item " << item_id;
-    // process data
-    TensorProtos protos;
-    protos.ParseFromString(cursor_->value());
-    // TODO(Yangqing): do we want to do anything to sanity check the data?
-    for (int i = 0; i < protos.protos_size(); ++i) {
-      const TensorProto& proto = protos.protos(i);
-      Blob* blob = prefetched_blobs_[i].get();
-      switch (proto.data_type()) {
-      case TensorProto::FLOAT:
-      {
-        DCHECK((blob->IsType<Tensor<float, CPUContext> >()));
-        auto* tensor = blob->GetMutable<Tensor<float, CPUContext> >();
-        int single_size = proto.float_data_size();
-        CHECK_EQ(single_size * batch_size_, tensor->size());
-        memcpy(tensor->mutable_data() + single_size * item_id,
-               proto.float_data().data(), single_size * sizeof(float));
-        break;
-      }
-      case TensorProto::INT32:
-      {
-        DCHECK((blob->IsType<Tensor<int, CPUContext> >()));
-        auto* tensor = blob->GetMutable<Tensor<int, CPUContext> >();
-        int single_size = proto.int32_data_size();
-        CHECK_EQ(single_size * batch_size_, tensor->size());
-        int* dst_pointer = tensor->mutable_data() + single_size * item_id;
-        for (int i = 0; i < single_size; ++i) {
-          dst_pointer[i] = proto.int32_data(i);
-        }
-        break;
-      }
-      case TensorProto::BYTE:
-      {
-        DCHECK((blob->IsType<Tensor<float, CPUContext> >()));
-        auto* tensor = blob->GetMutable<Tensor<float, CPUContext> >();
-        const string& src_data = proto.byte_data();
-        int single_size = src_data.size();
-        CHECK_EQ(single_size * batch_size_, tensor->size());
-        float* dst_pointer = tensor->mutable_data() + single_size * item_id;
-        for (int i = 0; i < single_size; ++i) {
-          dst_pointer[i] =
-              static_cast<float>(static_cast<uint8_t>(src_data[i])) / 256.f;
-        }
-        break;
-      }
-      default:
-        LOG(ERROR) << "Unknown input data type: " << proto.data_type();
+bool TensorProtosDBInput<DeviceContext>::Prefetch(int slot) {
+  // Get the data of the output tensors here, so that the decode threads only
+  // ever write to them.
+  vector<void*> batch_data(data_types_.size());
+  for (int i = 0; i < data_types_.size(); ++i) {
+    Blob* blob = prefetched_blobs_[slot][i].get();
+    if (data_types_[i] == TensorProto::INT32) {
+      batch_data[i] = MutablePrefetchData(
+          batch_dims_[i], blob->GetMutable<Tensor<int, CPUContext> >());
+    } else {
+      batch_data[i] = MutablePrefetchData(
+          batch_dims_[i], blob->GetMutable<Tensor<float, CPUContext> >());
+    }
+  }
+  if (decode_pool_ == nullptr) {
+    for (int item_id = 0; item_id < batch_size_; ++item_id) {
+      if (!DecodeItem(cursor_->value(), batch_data, item_id)) {
         return false;
       }
+      cursor_->Next();
+      if (!cursor_->Valid()) {
+        cursor_->SeekToFirst();
+      }
     }
+    return true;
+  }
+  // Hand each record to the decode threads as soon as it is read, and wait
+  // for all of them to be written.
+  std::mutex mutex;
+  std::condition_variable cv;
+  int remaining_items = batch_size_;
+  bool success = true;
+  for (int item_id = 0; item_id < batch_size_; ++item_id) {
+    auto value = std::make_shared<string>(cursor_->value());
+    decode_pool_->RunTask([this, value, &batch_data, item_id, &mutex, &cv,
+                           &remaining_items, &success]() {
+      const bool item_success = DecodeItem(*value, batch_data, item_id);
+      std::lock_guard<std::mutex> lock(mutex);
+      success &= item_success;
+      if (--remaining_items == 0) {
+        cv.notify_one();
+      }
+    });
     cursor_->Next();
     if (!cursor_->Valid()) {
       cursor_->SeekToFirst();
     }
   }
-  return true;
+  std::unique_lock<std::mutex> lock(mutex);
+  cv.wait(lock, [&remaining_items]() { return remaining_items == 0; });
+  return success;
 }
 
 template <class DeviceContext>
-bool TensorProtosDBInput<DeviceContext>::CopyPrefetched() {
+bool TensorProtosDBInput<DeviceContext>::CopyPrefetched(int slot) {
   for (int i = 0; i < OutputSize(); ++i) {
     switch (data_types_[i]) {
     case TensorProto::FLOAT:
     case TensorProto::BYTE:
-    {
-      auto* output = OperatorBase::Output<Tensor<float, DeviceContext> >(i);
-      auto& input =
-          prefetched_blobs_[i]->template Get<Tensor<float, CPUContext> >();
-      output->ReshapeLike(input);
-      this->device_context_.template Copy<float, CPUContext, DeviceContext>(
-          input.size(), input.data(), output->mutable_data());
+      HandOverPrefetched(
+          prefetched_blobs_[slot][i]
+              ->template GetMutable<Tensor<float, CPUContext> >(),
+          OperatorBase::Output<Tensor<float, DeviceContext> >(i),
+          &this->device_context_);
       break;
-    }
     case TensorProto::INT32:
-    {
-      auto* output = OperatorBase::Output<Tensor<int, DeviceContext> >(i);
-      auto& input =
-          prefetched_blobs_[i]->template Get<Tensor<int, CPUContext> >();
-      output->ReshapeLike(input);
-      this->device_context_.template Copy<int, CPUContext, DeviceContext>(
-          input.size(), input.data(), output->mutable_data());
+      HandOverPrefetched(
+          prefetched_blobs_[slot][i]
+              ->template GetMutable<Tensor<int, CPUContext> >(),
+          OperatorBase::Output<Tensor<int, DeviceContext> >(i),
+          &this->device_context_);
       break;
-    }
     case TensorProto::STRING:
       LOG(FATAL) << "Not expecting string.";
     }
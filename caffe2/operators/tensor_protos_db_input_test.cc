@@ -1,3 +1,6 @@
+#include <unistd.h>
+
+#include <cstdio>
 #include <iostream>
 
 #include "caffe2/operators/tensor_protos_db_input.h"
@@ -78,4 +81,138 @@ TEST(TensorProtosDBInputTest, TestLoadBatch64) {
   TestMNISTLoad(64);
 }
 
+// Writes a minidb of kNumRecords records, each holding a float, an int and a
+// byte tensor derived from the index of the record.
+const int kNumRecords = 10;
+
+static string WriteTestDB() {
+  const string db_path = "/tmp/tensor_protos_db_input_test_" +
+      std::to_string(getpid());
+  unique_ptr<db::DB> test_db(db::CreateDB("minidb", db_path, db::NEW));
+  unique_ptr<db::Transaction> transaction(test_db->NewTransaction());
+  for (int record = 0; record < kNumRecords; ++record) {
+    TensorProtos protos;
+    TensorProto* float_proto = protos.add_protos();
+    float_proto->set_data_type(TensorProto::FLOAT);
+    float_proto->add_dims(1);
+    float_proto->add_dims(3);
+    TensorProto* int_proto = protos.add_protos();
+    int_proto->set_data_type(TensorProto::INT32);
+    int_proto->add_dims(1);
+    TensorProto* byte_proto = protos.add_protos();
+    byte_proto->set_data_type(TensorProto::BYTE);
+    byte_proto->add_dims(1);
+    byte_proto->add_dims(2);
+    string bytes;
+    for (int i = 0; i < 3; ++i) {
+      float_proto->add_float_data(record * 10 + i);
+    }
+    int_proto->add_int32_data(record);
+    bytes.push_back(static_cast<char>(record));
+    bytes.push_back(static_cast<char>(128 + record));
+    byte_proto->set_byte_data(bytes);
+    string value;
+    protos.SerializeToString(&value);
+    transaction->Put(std::to_string(record), value);
+  }
+  transaction->Commit();
+  return db_path;
+}
+
+// Reading the records with several decode threads gives the same batches, in
+// the same order, as reading them with one.
+TEST(TensorProtosDBInputTest, TestDecodeThreads) {
+  const string db_path = WriteTestDB();
+  const int batch_size = 4;
+  for (int decode_threads : {1, 3}) {
+    Workspace ws;
+    OperatorDef def;
+    def.set_type("TensorProtosDBInput");
+    def.add_output("float");
+    def.add_output("int");
+    def.add_output("byte");
+    auto* arg = def.add_arg();
+    arg->set_name("batch_size");
+    arg->set_i(batch_size);
+    arg = def.add_arg();
+    arg->set_name("db");
+    arg->set_s(db_path);
+    arg = def.add_arg();
+    arg->set_name("db_type");
+    arg->set_s("minidb");
+    arg = def.add_arg();
+    arg->set_name("decode_threads");
+    arg->set_i(decode_threads);
+    unique_ptr<OperatorBase> op(CreateOperator(def, &ws));
+    ASSERT_TRUE(op.get() != nullptr);
+    for (int iter = 0; iter < 5; ++iter) {
+      ASSERT_TRUE(op->Run());
+      auto& float_tensor =
+          ws.GetBlob("float")->Get<Tensor<float, CPUContext> >();
+      auto& int_tensor = ws.GetBlob("int")->Get<Tensor<int, CPUContext> >();
+      auto& byte_tensor =
+          ws.GetBlob("byte")->Get<Tensor<float, CPUContext> >();
+      EXPECT_EQ(float_tensor.dims(), (vector<int>{batch_size, 3}));
+      EXPECT_EQ(byte_tensor.dims(), (vector<int>{batch_size, 2}));
+      for (int i = 0; i < batch_size; ++i) {
+        // The db is read in a loop.
+        const int record = (iter * batch_size + i) % kNumRecords;
+        EXPECT_EQ(int_tensor.data()[i], record);
+        for (int j = 0; j < 3; ++j) {
+          EXPECT_EQ(float_tensor.data()[i * 3 + j], record * 10 + j);
+        }
+        EXPECT_EQ(byte_tensor.data()[i * 2], record / 256.f);
+        EXPECT_EQ(byte_tensor.data()[i * 2 + 1], (128 + record) / 256.f);
+      }
+    }
+  }
+  std::remove(db_path.c_str());
+}
+
+// On the CPU, the batches are handed over by swapping the storage of the
+// outputs with the prefetched ones, and a batch still in use elsewhere is not
+// overwritten.
+TEST(TensorProtosDBInputTest, TestHandsOverBatchesWithoutCopies) {
+  const string db_path = WriteTestDB();
+  Workspace ws;
+  OperatorDef def;
+  def.set_type("TensorProtosDBInput");
+  def.add_output("float");
+  def.add_output("int");
+  def.add_output("byte");
+  auto* arg = def.add_arg();
+  arg->set_name("batch_size");
+  arg->set_i(2);
+  arg = def.add_arg();
+  arg->set_name("db");
+  arg->set_s(db_path);
+  arg = def.add_arg();
+  arg->set_name("db_type");
+  arg->set_s("minidb");
+  unique_ptr<OperatorBase> op(CreateOperator(def, &ws));
+  ASSERT_TRUE(op.get() != nullptr);
+  auto* output = ws.GetBlob("int")->GetMutable<Tensor<int, CPUContext> >();
+  vector<const int*> pointers;
+  for (int iter = 0; iter < 4; ++iter) {
+    ASSERT_TRUE(op->Run());
+    pointers.push_back(output->data());
+  }
+  // With one prefetch slot, the output and the slot take turns with two
+  // storages.
+  EXPECT_NE(pointers[0], pointers[1]);
+  EXPECT_EQ(pointers[0], pointers[2]);
+  EXPECT_EQ(pointers[1], pointers[3]);
+  // Keep the batch of records 6 and 7 around.
+  Tensor<int, CPUContext> kept_batch(output->dims());
+  kept_batch.ShareData(*output);
+  for (int iter = 0; iter < 3; ++iter) {
+    ASSERT_TRUE(op->Run());
+    EXPECT_NE(output->data(), kept_batch.data());
+  }
+  EXPECT_EQ(kept_batch.data()[0], 6);
+  EXPECT_EQ(kept_batch.data()[1], 7);
+  op.reset();
+  std::remove(db_path.c_str());
+}
+
 }  // namespace caffe2
@@ -0,0 +1,28 @@
+// Helpers shared by the operator tests.
+#ifndef CAFFE2_OPERATORS_TEST_UTIL_H_
+#define CAFFE2_OPERATORS_TEST_UTIL_H_
+
+#include <random>
+
+#include "caffe2/core/context.h"
+#include "caffe2/core/workspace.h"
+
+namespace caffe2 {
+
+// Creates the blob in ws as a float tensor of the given shape, filled with
+// values drawn uniformly from [-1, 1). The values only depend on the name and
+// the shape, so that two workspaces set up the same way hold the same inputs.
+inline void AddRandomInput(const std::vector<int>& shape, const string& name,
+                           Workspace* ws) {
+  std::mt19937 random_generator(1701 + name.size());
+  std::uniform_real_distribution<float> distribution(-1, 1);
+  auto* tensor = ws->CreateBlob(name)->GetMutable<Tensor<float, CPUContext> >();
+  tensor->Reshape(shape);
+  for (int i = 0; i < tensor->size(); ++i) {
+    tensor->mutable_data()[i] = distribution(random_generator);
+  }
+}
+
+}  // namespace caffe2
+
+#endif  // CAFFE2_OPERATORS_TEST_UTIL_H_
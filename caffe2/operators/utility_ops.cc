@@ -14,6 +14,12 @@ REGISTER_CPU_OPERATOR(Sum, SumOp<float, CPUContext>);
 REGISTER_CPU_OPERATOR(WeightedSum, WeightedSumOp<float, CPUContext>);
 REGISTER_CPU_OPERATOR(Copy, CopyOp<float, CPUContext, CPUContext, CPUContext>);
 
+// The outputs of these share the data of their (first) input.
+REGISTER_SHARED_STORAGE_OUTPUTS(Alias);
+REGISTER_SHARED_STORAGE_OUTPUTS(Flatten);
+REGISTER_SHARED_STORAGE_OUTPUTS(ReshapeLike);
+REGISTER_SHARED_STORAGE_OUTPUTS(Split);
+
 
 }  // namespace
 }  // namespace caffe2
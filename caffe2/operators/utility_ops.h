@@ -133,6 +133,8 @@ class AliasOp final : public Operator<dtype, DeviceContext> {
     return true;
   }
 
+  OUTPUT_SHAPES_LIKE_INPUT;
+
   INPUT_OUTPUT_STATS(1, 1, 1, 1);
   DISABLE_COPY_AND_ASSIGN(AliasOp);
 };
@@ -152,6 +154,18 @@ class FlattenOp : public Operator<dtype, DeviceContext> {
     return true;
   }
 
+  bool InferOutputShapes(const vector<TensorShape>& input_shapes,
+                         vector<TensorShape>* output_shapes) override {
+    if (input_shapes[0].dims.empty()) {
+      return false;
+    }
+    const int N = input_shapes[0].dims[0];
+    output_shapes->assign(1, TensorShape(
+        vector<int>{N, input_shapes[0].size() / N},
+        input_shapes[0].data_type));
+    return true;
+  }
+
   INPUT_OUTPUT_STATS(1, 1, 1, 1);
   DISABLE_COPY_AND_ASSIGN(FlattenOp);
 };
@@ -191,6 +205,8 @@ class SplitOp : public Operator<dtype, DeviceContext> {
     return true;
   }
 
+  OUTPUT_SHAPES_LIKE_INPUT;
+
   INPUT_OUTPUT_STATS(1, 1, 1, INT_MAX);
   DISABLE_COPY_AND_ASSIGN(SplitOp);
 };
@@ -214,6 +230,8 @@ class SumOp : public Operator<dtype, DeviceContext> {
     return true;
   }
 
+  OUTPUT_SHAPES_LIKE_INPUT;
+
   INPUT_OUTPUT_STATS(1, INT_MAX, 1, 1);
   DISABLE_COPY_AND_ASSIGN(SumOp);
 };
@@ -0,0 +1,106 @@
+#include "caffe2/core/net.h"
+#include "caffe2/core/operator.h"
+#include "caffe2/core/workspace.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+namespace caffe2 {
+
+// b aliases a, and d is produced once a is no longer read, so a memory plan
+// that ignored the aliasing would hand the storage of a, and thus of b, to d.
+const char kAliasNetDefString[] =
+"  name: \"alias\""
+"  op { output: \"a\" type: \"ConstantFill\""
+"       arg { name: \"shape\" ints: 1 } arg { name: \"value\" f: 4 } }"
+"  op { input: \"a\" output: \"b\" type: \"Alias\" }"
+"  op { input: \"b\" input: \"b\" output: \"c\" type: \"Add\" }"
+"  op { output: \"d\" type: \"ConstantFill\""
+"       arg { name: \"shape\" ints: 1 } arg { name: \"value\" f: 6 } }"
+"  op { input: \"c\" input: \"b\" output: \"out\" type: \"Add\" }"
+"  external_output: \"out\"";
+
+TEST(UtilityOpsTest, TestAliasWithMemoryPlanning) {
+  for (bool plan_memory : {false, true}) {
+    NetDef net_def;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        string(kAliasNetDefString), &net_def));
+    net_def.set_plan_memory(plan_memory);
+    Workspace ws;
+    ASSERT_TRUE(ws.CreateNet(net_def));
+    ASSERT_TRUE(ws.RunNet("alias"));
+    auto& out = ws.GetBlob("out")->Get<Tensor<float, CPUContext> >();
+    EXPECT_EQ(out.data()[0], 12);
+  }
+}
+
+// Relu runs in place on the output of Flatten, which shares its storage with
+// the input of Flatten.
+const char kInPlaceOnAliasNetDefString[] =
+"  name: \"in_place_on_alias\""
+"  op { output: \"a\" type: \"ConstantFill\""
+"       arg { name: \"shape\" ints: 2 ints: 2 ints: 3 }"
+"       arg { name: \"value\" f: -2 } }"
+"  op { input: \"a\" output: \"f\" type: \"Flatten\" }"
+"  op { input: \"f\" output: \"f\" type: \"Relu\" }"
+"  external_output: \"f\"";
+
+TEST(UtilityOpsTest, TestInPlaceOperatorOnFlattenOutput) {
+  NetDef net_def;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      string(kInPlaceOnAliasNetDefString), &net_def));
+  Workspace ws;
+  ASSERT_TRUE(ws.CreateNet(net_def));
+  ASSERT_TRUE(ws.RunNet("in_place_on_alias"));
+  auto& a = ws.GetBlob("a")->Get<Tensor<float, CPUContext> >();
+  auto& f = ws.GetBlob("f")->Get<Tensor<float, CPUContext> >();
+  EXPECT_EQ(f.dims(), (vector<int>{2, 6}));
+  EXPECT_EQ(f.data(), a.data());
+  for (int i = 0; i < f.size(); ++i) {
+    EXPECT_EQ(f.data()[i], 0);
+  }
+}
+
+// Runs the operators that share storage, and some that do not, and checks
+// that OutputHasOwnStorage(), and thus the memory planner, agrees with what
+// each output does.
+TEST(UtilityOpsTest, TestOutputHasOwnStorageMatchesRun) {
+  const char* kOpDefStrings[] = {
+      "input: \"x\" output: \"y\" type: \"Alias\"",
+      "input: \"x\" output: \"y\" type: \"Flatten\"",
+      "input: \"x\" input: \"w\" output: \"y\" type: \"ReshapeLike\"",
+      "input: \"x\" output: \"y\" output: \"z\" type: \"Split\"",
+      "input: \"x\" input: \"w\" output: \"y\" output: \"z\""
+      "  type: \"WeightedSumLoss\"",
+      "input: \"x\" output: \"y\" type: \"Relu\"",
+      "input: \"x\" input: \"w\" output: \"y\" type: \"Sum\""};
+  for (const char* op_def_string : kOpDefStrings) {
+    OperatorDef op_def;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        string(op_def_string), &op_def));
+    Workspace ws;
+    for (const string& name : {"x", "w"}) {
+      auto* tensor =
+          ws.CreateBlob(name)->GetMutable<Tensor<float, CPUContext> >();
+      tensor->Reshape(vector<int>{2, 3});
+      for (int i = 0; i < tensor->size(); ++i) {
+        tensor->mutable_data()[i] = i;
+      }
+    }
+    unique_ptr<OperatorBase> op(CreateOperator(op_def, &ws));
+    ASSERT_TRUE(op.get() != nullptr) << op_def.type();
+    ASSERT_TRUE(op->Run()) << op_def.type();
+    for (int i = 0; i < op_def.output_size(); ++i) {
+      const float* data = ws.GetBlob(op_def.output(i))
+          ->Get<Tensor<float, CPUContext> >().data();
+      bool shares_input = false;
+      for (const string& input : op_def.input()) {
+        shares_input |=
+            data == ws.GetBlob(input)->Get<Tensor<float, CPUContext> >().data();
+      }
+      EXPECT_EQ(op->OutputHasOwnStorage(i), !shares_input)
+          << op_def.type() << " output " << i;
+    }
+  }
+}
+
+}  // namespace caffe2
@@ -0,0 +1,222 @@
+#ifndef CAFFE2_UTILS_MPMC_QUEUE_H_
+#define CAFFE2_UTILS_MPMC_QUEUE_H_
+
+#include <atomic>
+#include <condition_variable>  // NOLINT
+#include <cstddef>
+#include <cstdint>
+#include <mutex>  // NOLINT
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace caffe2 {
+
+// MPMCQueue is a bounded multi-producer, multi-consumer queue with the same
+// Push() / Pop() / NoMoreJobs() contract as SimpleQueue, but whose fast path
+// does not take any lock. It is a ring buffer of cells in which each cell
+// carries a sequence number that tells producers and consumers whether it is
+// ready to be written or read (this is Dmitry Vyukov's bounded MPMC queue).
+//
+// Since the queue is bounded, Push() waits if the queue is full. Both Push()
+// and Pop() spin for a short while before they go to sleep on a condition
+// variable, and the other side only takes the lock to wake them up if somebody
+// is actually sleeping.
+template <typename T>
+class MPMCQueue {
+ public:
+  // Creates a queue that holds at least the given number of elements. The
+  // capacity is rounded up to a power of two.
+  explicit MPMCQueue(size_t capacity = 1024)
+      : cells_(RoundUpToPowerOfTwo(capacity)), mask_(cells_.size() - 1),
+        no_more_jobs_(false), enqueue_pos_(0), dequeue_pos_(0),
+        push_waiters_(0), pop_waiters_(0) {
+    for (size_t i = 0; i < cells_.size(); ++i) {
+      cells_[i].sequence_.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  inline size_t capacity() const { return mask_ + 1; }
+
+  // Pops a value and writes it to the value pointer. If there is nothing in the
+  // queue, this will wait till a value is inserted to the queue. If there are
+  // no more jobs to pop, the function returns false. Otherwise, it returns
+  // true.
+  bool Pop(T* value) {
+    for (int i = 0; i < kSpinCount; ++i) {
+      if (TryPop(value)) return true;
+      if (no_more_jobs_) return TryPop(value);
+      std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> mutex_lock(mutex_);
+    ++pop_waiters_;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool success;
+    while (!(success = TryPopWithoutNotify(value)) && !no_more_jobs_) {
+      not_empty_cv_.wait(mutex_lock);
+    }
+    if (!success) {
+      // Closed: check out anything that was pushed right before closing.
+      success = TryPopWithoutNotify(value);
+    }
+    --pop_waiters_;
+    mutex_lock.unlock();
+    if (success) NotifyPushWaiters();
+    return success;
+  }
+
+  // Push pushes a value to the queue. If the queue is full, this will wait
+  // till a value is popped from the queue.
+  void Push(const T& value) {
+    CHECK(!no_more_jobs_)
+        << "Cannot push to a closed queue.";
+    for (int i = 0; i < kSpinCount; ++i) {
+      if (TryPush(value)) return;
+      std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> mutex_lock(mutex_);
+    ++push_waiters_;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!TryPushWithoutNotify(value)) {
+      not_full_cv_.wait(mutex_lock);
+    }
+    --push_waiters_;
+    mutex_lock.unlock();
+    NotifyPopWaiters();
+  }
+
+  // TryPop() and TryPush() are the non-blocking versions of Pop() and Push().
+  // They return false immediately if the queue is empty or full respectively.
+  bool TryPop(T* value) {
+    if (!TryPopWithoutNotify(value)) return false;
+    NotifyPushWaiters();
+    return true;
+  }
+
+  bool TryPush(const T& value) {
+    if (!TryPushWithoutNotify(value)) return false;
+    NotifyPopWaiters();
+    return true;
+  }
+
+  // NoMoreJobs() marks the close of this queue. It also notifies all waiting
+  // Pop() calls so that they either check out remaining jobs, or return false.
+  // After NoMoreJobs() is called, this queue is considered closed - no more
+  // Push() functions are allowed, and once existing items are all checked out
+  // by the Pop() functions, any more Pop() function will immediately return
+  // false with nothing set to the value.
+  void NoMoreJobs() {
+    std::unique_lock<std::mutex> mutex_lock(mutex_);
+    no_more_jobs_ = true;
+    mutex_lock.unlock();
+    not_empty_cv_.notify_all();
+  }
+
+ private:
+  // The number of attempts Push() and Pop() make before going to sleep.
+  static const int kSpinCount = 64;
+
+  struct Cell {
+    std::atomic<size_t> sequence_;
+    T value_;
+  };
+
+  static size_t RoundUpToPowerOfTwo(size_t capacity) {
+    CHECK_GT(capacity, 0);
+    size_t rounded_capacity = 1;
+    while (rounded_capacity < capacity) rounded_capacity <<= 1;
+    return rounded_capacity;
+  }
+
+  // The lock-free part of the queue. These two functions never take the lock,
+  // so they can be called with or without holding mutex_.
+  bool TryPushWithoutNotify(const T& value) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      size_t sequence = cell->sequence_.load(std::memory_order_acquire);
+      intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // The cell still holds a value from the previous lap: full.
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value_ = value;
+    cell->sequence_.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool TryPopWithoutNotify(T* value) {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      size_t sequence = cell->sequence_.load(std::memory_order_acquire);
+      intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // The cell has not been written in this lap yet: empty.
+        return false;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    *value = cell->value_;
+    cell->sequence_.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  // The waiters increment their counter and then retry under the lock, while
+  // the other side updates the queue and then checks the counter. The fences
+  // make sure that at least one of them sees the other, so no wakeup is lost.
+  // Must be called without holding mutex_.
+  void NotifyPopWaiters() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (pop_waiters_.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> mutex_lock(mutex_);
+      not_empty_cv_.notify_one();
+    }
+  }
+
+  void NotifyPushWaiters() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (push_waiters_.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> mutex_lock(mutex_);
+      not_full_cv_.notify_one();
+    }
+  }
+
+  std::vector<Cell> cells_;
+  size_t mask_;
+  std::atomic<bool> no_more_jobs_;
+  // The producer and consumer positions are kept on separate cache lines so
+  // that producers and consumers do not invalidate each other's caches.
+  alignas(64) std::atomic<size_t> enqueue_pos_;
+  alignas(64) std::atomic<size_t> dequeue_pos_;
+  alignas(64) std::atomic<int> push_waiters_;
+  std::atomic<int> pop_waiters_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_cv_;
+  std::condition_variable not_full_cv_;
+  // We do not allow copy constructors.
+  MPMCQueue(const MPMCQueue& src) {}
+};
+
+}  // namespace caffe2
+
+#endif  // CAFFE2_UTILS_MPMC_QUEUE_H_
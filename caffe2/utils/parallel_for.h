@@ -0,0 +1,124 @@
+#ifndef CAFFE2_UTILS_PARALLEL_FOR_H_
+#define CAFFE2_UTILS_PARALLEL_FOR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>  // NOLINT
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>  // NOLINT
+
+#include "caffe2/core/context.h"
+#include "caffe2/utils/thread_pool.h"
+
+namespace caffe2 {
+
+namespace internal {
+// Whether the calling thread is running a range of a ParallelFor().
+inline bool& InParallelFor() {
+  static thread_local bool in_parallel_for = false;
+  return in_parallel_for;
+}
+}  // namespace internal
+
+// The function run by ParallelFor() on each range [begin, end). worker
+// identifies the thread running the range (see ParallelFor()).
+typedef std::function<void(int begin, int end, int worker)>
+    ParallelForFunction;
+
+// The number of workers that ParallelFor() uses for a loop of n iterations:
+// the calling thread and the threads of the pool, but no more than n. A
+// ParallelFor() nested in another one runs on the calling thread alone, since
+// waiting for the pool from inside the pool could deadlock it.
+inline int NumParallelForWorkers(ThreadPool* pool, int n) {
+  if (internal::InParallelFor()) {
+    return std::min(n, 1);
+  }
+  return std::min(n, pool->num_threads() + 1);
+}
+
+// ParallelFor() splits [0, n) into consecutive ranges, runs fn on each of
+// them on the calling thread and the threads of the pool, and returns once all
+// of them are done. The worker passed to fn is below
+// NumParallelForWorkers(pool, n), and no two ranges with the same worker run
+// at the same time, so fn can use it to pick scratch space of its own.
+inline void ParallelFor(ThreadPool* pool, int n,
+                        const ParallelForFunction& fn) {
+  const int num_workers = NumParallelForWorkers(pool, n);
+  if (num_workers <= 1) {
+    if (n > 0) {
+      fn(0, n, 0);
+    }
+    return;
+  }
+  // The ranges are handed out one at a time from a shared counter, so a busy
+  // pool only slows the loop down rather than holding it up: a worker that
+  // starts late finds the ranges done by the others and leaves right away.
+  // Only the state of the loop is shared with the pool, and fn is only
+  // called while ParallelFor() is still waiting.
+  struct LoopState {
+    const ParallelForFunction* fn;
+    std::atomic<int> next_range;
+    std::atomic<int> num_done_ranges;
+    std::mutex mutex;
+    std::condition_variable cv;
+  };
+  auto state = std::make_shared<LoopState>();
+  state->fn = &fn;
+  state->next_range = 0;
+  state->num_done_ranges = 0;
+  const int num_ranges = std::min(n, num_workers * 4);
+  auto run_ranges = [state, n, num_ranges](int worker) {
+    internal::InParallelFor() = true;
+    for (int range = state->next_range++; range < num_ranges;
+         range = state->next_range++) {
+      const int begin = static_cast<int64_t>(n) * range / num_ranges;
+      const int end = static_cast<int64_t>(n) * (range + 1) / num_ranges;
+      (*state->fn)(begin, end, worker);
+      if (++state->num_done_ranges == num_ranges) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->cv.notify_one();
+      }
+    }
+    internal::InParallelFor() = false;
+  };
+  for (int worker = 1; worker < num_workers; ++worker) {
+    pool->RunTask([run_ranges, worker]() { run_ranges(worker); });
+  }
+  run_ranges(0);
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->cv.wait(lock, [state, num_ranges]() {
+    return state->num_done_ranges == num_ranges;
+  });
+}
+
+// The versions for operators that are templated on their context. On
+// CPUContext, the loop is split across CPUContext::thread_pool(). On the
+// other contexts, whose kernels are parallel already, fn runs on the whole
+// range at once.
+template <class DeviceContext>
+inline int NumParallelForWorkers(int n) {
+  return std::min(n, 1);
+}
+
+template <>
+inline int NumParallelForWorkers<CPUContext>(int n) {
+  return NumParallelForWorkers(CPUContext::thread_pool(), n);
+}
+
+template <class DeviceContext>
+inline void ParallelFor(int n, const ParallelForFunction& fn) {
+  if (n > 0) {
+    fn(0, n, 0);
+  }
+}
+
+template <>
+inline void ParallelFor<CPUContext>(int n, const ParallelForFunction& fn) {
+  ParallelFor(CPUContext::thread_pool(), n, fn);
+}
+
+}  // namespace caffe2
+
+#endif  // CAFFE2_UTILS_PARALLEL_FOR_H_
@@ -0,0 +1,86 @@
+#include <atomic>
+#include <vector>
+
+#include "caffe2/utils/parallel_for.h"
+#include "gtest/gtest.h"
+
+namespace caffe2 {
+
+TEST(ParallelForTest, RunsEveryIndexOnce) {
+  ThreadPool pool(3);
+  for (int n : {0, 1, 3, 4, 17, 1000}) {
+    std::vector<std::atomic<int> > counts(n);
+    for (auto& count : counts) {
+      count = 0;
+    }
+    const int num_workers = NumParallelForWorkers(&pool, n);
+    EXPECT_LE(num_workers, 4);
+    EXPECT_LE(num_workers, n);
+    std::atomic<bool> valid_workers(true);
+    ParallelFor(&pool, n, [&](int begin, int end, int worker) {
+      if (worker < 0 || worker >= num_workers || begin >= end) {
+        valid_workers = false;
+      }
+      for (int i = begin; i < end; ++i) {
+        ++counts[i];
+      }
+    });
+    EXPECT_TRUE(valid_workers);
+    for (int i = 0; i < n; ++i) {
+      EXPECT_EQ(counts[i], 1) << i;
+    }
+  }
+}
+
+TEST(ParallelForTest, WorkersDoNotOverlap) {
+  ThreadPool pool(3);
+  const int n = 1000;
+  std::vector<std::atomic<int> > busy(NumParallelForWorkers(&pool, n));
+  for (auto& worker_busy : busy) {
+    worker_busy = 0;
+  }
+  std::atomic<bool> overlapped(false);
+  ParallelFor(&pool, n, [&](int begin, int end, int worker) {
+    if (busy[worker]++ != 0) {
+      overlapped = true;
+    }
+    --busy[worker];
+  });
+  EXPECT_FALSE(overlapped);
+}
+
+TEST(ParallelForTest, NestedLoopsRunSerially) {
+  ThreadPool pool(3);
+  std::atomic<int> sum(0);
+  std::atomic<bool> nested_serially(true);
+  ParallelFor(&pool, 8, [&](int begin, int end, int worker) {
+    for (int i = begin; i < end; ++i) {
+      if (NumParallelForWorkers(&pool, 10) != 1) {
+        nested_serially = false;
+      }
+      ParallelFor(&pool, 10, [&](int inner_begin, int inner_end,
+                                 int inner_worker) {
+        if (inner_begin != 0 || inner_end != 10 || inner_worker != 0) {
+          nested_serially = false;
+        }
+        sum += inner_end - inner_begin;
+      });
+    }
+  });
+  EXPECT_TRUE(nested_serially);
+  EXPECT_EQ(sum, 80);
+}
+
+TEST(ParallelForTest, CPUContextUsesItsThreadPool) {
+  EXPECT_EQ(NumParallelForWorkers<CPUContext>(1000),
+            CPUContext::thread_pool()->num_threads() + 1);
+  std::atomic<int> sum(0);
+  ParallelFor<CPUContext>(100, [&](int begin, int end, int worker) {
+    for (int i = begin; i < end; ++i) {
+      sum += i;
+    }
+  });
+  EXPECT_EQ(sum, 4950);
+}
+
+}  // namespace caffe2
@@ -1,5 +1,9 @@
+#include <atomic>
+#include <chrono>  // NOLINT
 #include <thread>  // NOLINT
+#include <vector>
 
+#include "caffe2/utils/mpmc_queue.h"
 #include "caffe2/utils/simple_queue.h"
 #include "gtest/gtest.h"
 
@@ -67,7 +71,110 @@ TEST(SimpleQueueDeathTest, CannotAddAfterQueueFinished) {
                "Check failed: !no_more_jobs_ Cannot push to a closed queue.");
 }
 
+TEST(MPMCQueueTest, CapacityIsRoundedUp) {
+  MPMCQueue<int> queue(10);
+  EXPECT_EQ(queue.capacity(), 16);
+  for (int i = 0; i < 16; ++i) {
+    EXPECT_TRUE(queue.TryPush(i));
+  }
+  EXPECT_FALSE(queue.TryPush(16));
+  int value;
+  for (int i = 0; i < 16; ++i) {
+    EXPECT_TRUE(queue.TryPop(&value));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_FALSE(queue.TryPop(&value));
+}
 
-}  // namespace caffe2
+TEST(MPMCQueueTest, PopRemainingJobsAfterQueueFinished) {
+  MPMCQueue<int> queue(4);
+  queue.Push(0);
+  queue.Push(1);
+  queue.NoMoreJobs();
+  int value;
+  EXPECT_TRUE(queue.Pop(&value));
+  EXPECT_EQ(value, 0);
+  EXPECT_TRUE(queue.Pop(&value));
+  EXPECT_EQ(value, 1);
+  EXPECT_FALSE(queue.Pop(&value));
+}
 
+TEST(MPMCQueueTest, PushWaitsWhenFull) {
+  // A tiny queue forces producers to block and be woken up by consumers.
+  MPMCQueue<int> queue(2);
+  std::atomic<int> sum(0);
+  std::thread consumer([&queue, &sum]() {
+    int value;
+    while (queue.Pop(&value)) sum += value;
+  });
+  for (int i = 0; i < 1000; ++i) {
+    queue.Push(i);
+  }
+  queue.NoMoreJobs();
+  consumer.join();
+  EXPECT_EQ(sum, 999 * 1000 / 2);
+}
 
+TEST(MPMCQueueDeathTest, CannotAddAfterQueueFinished) {
+  MPMCQueue<int> queue(4);
+  queue.Push(0);
+  queue.NoMoreJobs();
+  EXPECT_DEATH(queue.Push(0),
+               "Check failed: !no_more_jobs_ Cannot push to a closed queue.");
+}
+
+// Runs half of the threads as producers and half as consumers over the given
+// queue, checks that every pushed value is popped exactly once, and returns
+// the number of milliseconds it took.
+template <class Queue>
+static int RunContention(Queue* queue, int num_threads, int num_items) {
+  const int num_producers = num_threads / 2;
+  const int num_consumers = num_threads - num_producers;
+  const int items_per_producer = num_items / num_producers;
+  std::atomic<int64_t> sum(0);
+  auto start_time = std::chrono::system_clock::now();
+  std::vector<std::thread> consumers;
+  for (int i = 0; i < num_consumers; ++i) {
+    consumers.emplace_back([queue, &sum]() {
+      int value;
+      int64_t local_sum = 0;
+      while (queue->Pop(&value)) local_sum += value;
+      sum += local_sum;
+    });
+  }
+  std::vector<std::thread> producers;
+  for (int i = 0; i < num_producers; ++i) {
+    producers.emplace_back([queue, i, items_per_producer]() {
+      for (int j = 0; j < items_per_producer; ++j) {
+        queue->Push(i * items_per_producer + j);
+      }
+    });
+  }
+  for (auto& producer : producers) producer.join();
+  queue->NoMoreJobs();
+  for (auto& consumer : consumers) consumer.join();
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now() - start_time);
+  const int64_t total = static_cast<int64_t>(num_producers) *
+                        items_per_producer;
+  EXPECT_EQ(sum, total * (total - 1) / 2);
+  return duration.count();
+}
+
+// This is a contention benchmark rather than a strict test: it logs the time
+// both queues take to pass the same number of items at different thread
+// counts, so the numbers can be compared on the machine at hand.
+TEST(MPMCQueueTest, ContentionBenchmark) {
+  const int kNumItems = 1 << 18;
+  for (int num_threads = 2; num_threads <= 64; num_threads *= 2) {
+    SimpleQueue<int> simple_queue;
+    int simple_ms = RunContention(&simple_queue, num_threads, kNumItems);
+    MPMCQueue<int> mpmc_queue(1024);
+    int mpmc_ms = RunContention(&mpmc_queue, num_threads, kNumItems);
+    LOG(INFO) << num_threads << " threads, " << kNumItems << " items: "
+              << "SimpleQueue " << simple_ms << " ms, "
+              << "MPMCQueue " << mpmc_ms << " ms.";
+  }
+}
+
+}  // namespace caffe2
@@ -0,0 +1,55 @@
+#ifndef CAFFE2_UTILS_THREAD_POOL_H_
+#define CAFFE2_UTILS_THREAD_POOL_H_
+
+#include <functional>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "caffe2/utils/simple_queue.h"
+#include "glog/logging.h"
+
+namespace caffe2 {
+
+// ThreadPool is a fixed set of worker threads that run the tasks given to
+// RunTask() in the order they are given. When the pool is destroyed, the tasks
+// that are still queued are run before the workers exit.
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_threads) {
+    CHECK_GT(num_threads, 0);
+    for (int i = 0; i < num_threads; ++i) {
+      workers_.push_back(std::thread(&ThreadPool::WorkerFunction, this));
+    }
+  }
+
+  ~ThreadPool() {
+    tasks_.NoMoreJobs();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  inline int num_threads() const { return workers_.size(); }
+
+  // Queues the task to be run by one of the workers.
+  void RunTask(const std::function<void()>& task) {
+    tasks_.Push(task);
+  }
+
+ private:
+  void WorkerFunction() {
+    std::function<void()> task;
+    while (tasks_.Pop(&task)) {
+      task();
+    }
+  }
+
+  SimpleQueue<std::function<void()> > tasks_;
+  std::vector<std::thread> workers_;
+  // We do not allow copy constructors.
+  ThreadPool(const ThreadPool& src) {}
+};
+
+}  // namespace caffe2
+
+#endif  // CAFFE2_UTILS_THREAD_POOL_H_
@@ -0,0 +1,43 @@
+#include <atomic>
+#include <chrono>  // NOLINT
+#include <thread>  // NOLINT
+
+#include "caffe2/utils/thread_pool.h"
+#include "gtest/gtest.h"
+
+namespace caffe2 {
+
+TEST(ThreadPoolTest, RunsAllTasks) {
+  std::atomic<int> sum(0);
+  {
+    ThreadPool pool(4);
+    EXPECT_EQ(pool.num_threads(), 4);
+    for (int i = 1; i <= 100; ++i) {
+      pool.RunTask([&sum, i]() { sum += i; });
+    }
+    // Destroying the pool runs the remaining tasks.
+  }
+  EXPECT_EQ(sum, 5050);
+}
+
+TEST(ThreadPoolTest, RunsTasksConcurrently) {
+  std::atomic<int> num_started(0);
+  std::atomic<bool> all_started(false);
+  {
+    ThreadPool pool(2);
+    for (int i = 0; i < 2; ++i) {
+      pool.RunTask([&num_started, &all_started]() {
+        ++num_started;
+        // Each task waits for the other one, which only finishes if they run
+        // at the same time.
+        while (num_started < 2) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        all_started = true;
+      });
+    }
+  }
+  EXPECT_TRUE(all_started);
+}
+
+}  // namespace caffe2